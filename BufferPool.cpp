@@ -0,0 +1,107 @@
+#include "BufferPool.h"
+#include <cerrno>
+#include <sys/socket.h>
+#include "Stats.h"
+
+// 一次RecvAppend最多使用的缓冲区数
+const int MaxChainLength = 16;
+
+static size_t poolBufferSize = 4096;
+
+static char *NewBuffer()
+{
+    ++proxyStats.buffersAllocated;
+    return new char[poolBufferSize];
+}
+
+static void DeleteBuffer(char *buffer)
+{
+    --proxyStats.buffersAllocated;
+    delete[] buffer;
+}
+
+// 每个线程的空闲缓冲区，线程退出时释放
+struct FreeBuffers
+{
+    char *buffers[MaxFreeBuffers];
+    size_t count = 0;
+
+    ~FreeBuffers()
+    {
+        while(count > 0)
+            DeleteBuffer(buffers[--count]);
+    }
+};
+
+static thread_local FreeBuffers threadBuffers;
+
+void BufferPool::init(size_t bufferSize)
+{
+    poolBufferSize = bufferSize > 0 ? bufferSize : 4096;
+}
+
+size_t BufferPool::bufferSize()
+{
+    return poolBufferSize;
+}
+
+char *BufferPool::acquire()
+{
+    if(threadBuffers.count > 0)
+        return threadBuffers.buffers[--threadBuffers.count];
+    return NewBuffer();
+}
+
+void BufferPool::release(char *buffer)
+{
+    if(threadBuffers.count < MaxFreeBuffers)
+        threadBuffers.buffers[threadBuffers.count++] = buffer;
+    else
+        DeleteBuffer(buffer);
+}
+
+ssize_t RecvAppend(int fd, std::string &buf, int maxBuffers)
+{
+    if(maxBuffers > MaxChainLength)
+        maxBuffers = MaxChainLength;
+    char *chain[MaxChainLength];
+    size_t lengths[MaxChainLength];
+    int used = 0;
+    size_t total = 0;
+    ssize_t result = 0;
+
+    while(used < maxBuffers)
+    {
+        char *buffer = BufferPool::acquire();
+        ssize_t recvLen = recv(fd, buffer, poolBufferSize, used == 0 ? 0 : MSG_DONTWAIT);
+        if(recvLen < 0 && errno == EINTR)
+        {
+            BufferPool::release(buffer);
+            continue;
+        }
+        if(recvLen <= 0)
+        {
+            // 已经读到数据时，关闭或出错留给下一次调用处理
+            if(used == 0)
+                result = recvLen;
+            BufferPool::release(buffer);
+            break;
+        }
+        chain[used] = buffer;
+        lengths[used++] = recvLen;
+        total += recvLen;
+        // 没有读满，暂时没有更多数据了
+        if((size_t)recvLen < poolBufferSize)
+            break;
+    }
+
+    if(used == 0)
+        return result;
+    buf.reserve(buf.size() + total);
+    for(int i = 0; i < used; ++i)
+    {
+        buf.append(chain[i], lengths[i]);
+        BufferPool::release(chain[i]);
+    }
+    return total;
+}
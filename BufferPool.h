@@ -0,0 +1,40 @@
+/*
+ * 接收缓冲区池
+ *
+ * 每次recv都需要一块临时缓冲区。缓冲区大小固定为BufferSize，每个线程有自己的空闲链表，
+ * 用完还回链表，下次直接复用：不在栈上临时分配，也不需要清零（recv只会读出实际写入的部分）。
+ * 每个线程最多留MaxFreeBuffers块空闲缓冲区，多出的直接释放，因此内存占用只与线程数有关，与连接数无关。
+ *
+ * 一次可以读到较多数据时（例如大的body），每读满一块就从池中再取一块继续读，组成一条链，
+ * 读完后按总长度一次性追加到连接的数据中，string只需要扩容一次。
+*/
+
+#ifndef BUFFER_POOL_BY_YQ
+#define BUFFER_POOL_BY_YQ
+
+#include <string>
+#include <cstddef>
+#include <sys/types.h>
+
+// 每个线程最多保留的空闲缓冲区数
+const size_t MaxFreeBuffers = 16;
+
+class BufferPool
+{
+public:
+    // 设置缓冲区大小，在开始工作之前调用
+    static void init(size_t bufferSize);
+    static size_t bufferSize();
+
+    // 从当前线程的空闲链表中取一块缓冲区，没有时新分配
+    static char *acquire();
+    // 还回当前线程的空闲链表
+    static void release(char *buffer);
+};
+
+// 从socket接收当前可以读到的数据追加到buf，最多读maxBuffers块缓冲区
+// 第一次recv按socket本身的方式（阻塞或非阻塞），之后只在缓冲区被读满时用MSG_DONTWAIT继续读
+// 返回读到的字节数；0表示对端已关闭；-1表示出错，errno为第一次recv的错误
+ssize_t RecvAppend(int fd, std::string &buf, int maxBuffers);
+
+#endif
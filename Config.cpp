@@ -0,0 +1,303 @@
+#include "Config.h"
+#include <cstring>
+#include <algorithm>
+#include <csignal>
+#include <unistd.h>
+#include <pthread.h>
+#include "SimpleIni/SimpleIni.h"
+#include "Upstream.h"
+#include "Resolver.h"
+#include "Utils.h"
+using namespace std;
+
+// 当前生效的配置，通过atomic_load/atomic_store读写
+static shared_ptr<const ProxyConfig> currentConfig;
+
+static string configPath;
+static ConfigReloadHandler reloadHandler = NULL;
+static Logger reloadLogger;
+
+bool LoadConfig(const char *path, ProxyConfig &config, string &error)
+{
+    CSimpleIniA ini;
+	ini.SetUnicode();
+
+	SI_Error rc = ini.LoadFile(path);
+	if (rc < 0) {
+        error = "Fail to load config file!";
+        return false;
+    };
+
+    // ListenHost
+    const char* data;
+	data = ini.GetValue("Main", "ListenHost", config.listenHost.c_str());
+    config.listenHost = string(data);
+    if(config.listenHost.empty())
+        config.listenHost = "0.0.0.0";
+
+    // ListenPort
+    config.listenPort = ini.GetLongValue("Main", "ListenPort", config.listenPort);
+    // MaxListen
+    config.maxListen = ini.GetLongValue("Main", "MaxListen", config.maxListen);
+
+    // BufferSize
+    config.bufferSize = ini.GetLongValue("Main", "BufferSize", config.bufferSize);
+    if(config.bufferSize <= 0)
+        config.bufferSize = 4096;
+
+    // LogLevel
+    data = ini.GetValue("Main", "LogLevel", "INFO");
+    if(strcmp(data, "DEBUG") == 0)
+        config.logLevel = Logger::LogLevel::DEBUG;
+    else if(strcmp(data, "INFO") == 0)
+        config.logLevel = Logger::LogLevel::INFO;
+    else if(strcmp(data, "WARN") == 0)
+        config.logLevel = Logger::LogLevel::WARN;
+    else if(strcmp(data, "ERROR") == 0)
+        config.logLevel = Logger::LogLevel::ERROR;
+    else if(strcmp(data, "FATAL") == 0)
+        config.logLevel = Logger::LogLevel::FATAL;
+    else if(strcmp(data, "NONE") == 0)
+        config.logLevel = Logger::LogLevel::NONE;
+
+    // StatsInterval
+    config.statsInterval = ini.GetLongValue("Main", "StatsInterval", config.statsInterval);
+
+    // Engine
+    data = ini.GetValue("Main", "Engine", "ThreadPool");
+    if(strcmp(data, "EventLoop") == 0)
+        config.engineMode = EngineMode::EventLoop;
+    else
+        config.engineMode = EngineMode::ThreadPool;
+
+    // TargetHost
+    data = ini.GetValue("Proxy", "TargetHost", config.targetHost.c_str());
+    config.targetHost = string(data);
+    // 去掉前缀后缀
+    string &targetHost = config.targetHost;
+    if(StartsWith(targetHost, "http://"))
+        targetHost = targetHost.substr(7);
+    else if(StartsWith(targetHost, "https://"))
+        targetHost = targetHost.substr(8);
+    auto pos = targetHost.find("/");
+    if(pos != std::string::npos)
+        targetHost = targetHost.substr(0, pos);
+
+    // TargetPort
+    config.targetPort = ini.GetLongValue("Proxy", "TargetPort", config.targetPort);
+    // StreamBody
+    config.streamBody = ini.GetBoolValue("Proxy", "StreamBody", config.streamBody);
+    // ZeroCopy
+    config.zeroCopy = ini.GetBoolValue("Proxy", "ZeroCopy", config.zeroCopy);
+
+    // Upstream，Backends为空时使用TargetHost:TargetPort
+    config.upstreamBackends = ini.GetValue("Upstream", "Backends", config.upstreamBackends.c_str());
+    config.upstreamPolicy = ini.GetValue("Upstream", "Policy", config.upstreamPolicy.c_str());
+    config.upstreamHashKey = ini.GetValue("Upstream", "HashKey", config.upstreamHashKey.c_str());
+    config.upstreamConnectTimeout = ini.GetLongValue("Upstream", "ConnectTimeout", config.upstreamConnectTimeout);
+    config.upstreamMaxFails = ini.GetLongValue("Upstream", "MaxFails", config.upstreamMaxFails);
+    config.upstreamEjectTime = ini.GetLongValue("Upstream", "EjectTime", config.upstreamEjectTime);
+    config.upstreamSlowStart = ini.GetLongValue("Upstream", "SlowStart", config.upstreamSlowStart);
+
+    // HealthCheck
+    config.healthCheckEnable = ini.GetBoolValue("HealthCheck", "Enable", config.healthCheckEnable);
+    config.healthCheckInterval = ini.GetLongValue("HealthCheck", "Interval", config.healthCheckInterval);
+    config.healthCheckTimeout = ini.GetLongValue("HealthCheck", "Timeout", config.healthCheckTimeout);
+    config.healthCheckPath = ini.GetValue("HealthCheck", "Path", config.healthCheckPath.c_str());
+    config.healthCheckExpectStatus = ini.GetLongValue("HealthCheck", "ExpectStatus", config.healthCheckExpectStatus);
+    config.healthCheckRise = ini.GetLongValue("HealthCheck", "Rise", config.healthCheckRise);
+    config.healthCheckFall = ini.GetLongValue("HealthCheck", "Fall", config.healthCheckFall);
+
+    // Cache
+    config.cacheEnable = ini.GetBoolValue("Cache", "Enable", config.cacheEnable);
+    config.cacheMaxSize = ini.GetLongValue("Cache", "MaxSize", config.cacheMaxSize);
+    config.cacheMaxObjectSize = ini.GetLongValue("Cache", "MaxObjectSize", config.cacheMaxObjectSize);
+    config.cacheShards = ini.GetLongValue("Cache", "Shards", config.cacheShards);
+    config.cacheStaleTime = ini.GetLongValue("Cache", "StaleTime", config.cacheStaleTime);
+    config.cacheCollapse = ini.GetBoolValue("Cache", "Collapse", config.cacheCollapse);
+    config.cacheDiskEnable = ini.GetBoolValue("Cache", "DiskEnable", config.cacheDiskEnable);
+    config.cacheDiskPath = ini.GetValue("Cache", "DiskPath", config.cacheDiskPath.c_str());
+    config.cacheDiskSize = ini.GetLongValue("Cache", "DiskSize", config.cacheDiskSize);
+    config.cacheDiskSlabSize = ini.GetLongValue("Cache", "DiskSlabSize", config.cacheDiskSlabSize);
+    config.cacheDiskMaxObjectSize = ini.GetLongValue("Cache", "DiskMaxObjectSize", config.cacheDiskMaxObjectSize);
+
+    // MinThread
+    config.minThread = ini.GetLongValue("ThreadPool", "MinThread", config.minThread);
+    // MaxThread
+    config.maxThread = ini.GetLongValue("ThreadPool", "MaxThread", config.maxThread);
+    // WaitBeforeShrink
+    config.waitBeforeShrink = ini.GetLongValue("ThreadPool", "WaitBeforeShrink", config.waitBeforeShrink);
+    // Scheduler
+    config.workStealing = (strcmp(ini.GetValue("ThreadPool", "Scheduler", "Queue"), "WorkStealing") == 0);
+
+    // UpstreamPool
+    config.poolEnable = ini.GetBoolValue("UpstreamPool", "Enable", config.poolEnable);
+    config.poolMaxIdle = ini.GetLongValue("UpstreamPool", "MaxIdle", config.poolMaxIdle);
+    config.poolMaxPerHost = ini.GetLongValue("UpstreamPool", "MaxPerHost", config.poolMaxPerHost);
+    config.poolIdleTimeout = ini.GetLongValue("UpstreamPool", "IdleTimeout", config.poolIdleTimeout);
+
+    // Resolver
+    config.resolverCacheTtl = ini.GetLongValue("Resolver", "CacheTtl", config.resolverCacheTtl);
+    config.resolverNegativeTtl = ini.GetLongValue("Resolver", "NegativeTtl", config.resolverNegativeTtl);
+    config.resolverTimeout = ini.GetLongValue("Resolver", "Timeout", config.resolverTimeout);
+
+    // LoopThreads，为0时使用CPU核数
+    config.loopThreads = ini.GetLongValue("EventLoop", "LoopThreads", config.loopThreads);
+    if(config.loopThreads <= 0)
+        config.loopThreads = std::max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+    // ReusePort
+    config.reusePort = ini.GetBoolValue("EventLoop", "ReusePort", config.reusePort);
+    // PinCpu
+    config.pinCpu = ini.GetBoolValue("EventLoop", "PinCpu", config.pinCpu);
+
+    // Plugins，每一项为 插件文件名=优先级
+    CSimpleIniA::TNamesDepend pluginNames;
+    ini.GetAllKeys("Plugins", pluginNames);
+    for(const auto &entry : pluginNames)
+        config.pluginPriority[entry.pItem] = ini.GetLongValue("Plugins", entry.pItem, DefaultPluginPriority);
+    // AsyncPlugins
+    config.observerThreads = max(1, (int)ini.GetLongValue("AsyncPlugins", "Threads", config.observerThreads));
+    config.observerMaxQueued = max(1, (int)ini.GetLongValue("AsyncPlugins", "MaxQueued", config.observerMaxQueued));
+
+    // 检查数据
+    if((config.targetHost.empty() && config.upstreamBackends.empty()) || config.listenPort < 0
+        || config.listenPort > 65535 || config.targetPort < 0 || config.targetPort > 65535 )
+    {
+        error = "Bad config file!";
+        return false;
+    }
+
+    // 上游服务器组
+    string upstreamError;
+    config.upstream = make_shared<UpstreamGroup>();
+    if(!config.upstream->init(config.upstreamBackends, config.targetHost, config.targetPort, config.upstreamPolicy,
+        config.upstreamHashKey, upstreamError))
+    {
+        error = "Bad upstream config: " + upstreamError;
+        return false;
+    }
+    config.upstream->setHealthOptions(config.upstreamMaxFails, config.upstreamEjectTime, config.upstreamSlowStart,
+        config.logLevel);
+    return true;
+}
+
+shared_ptr<const ProxyConfig> CurrentConfig()
+{
+    return atomic_load(&currentConfig);
+}
+
+void PublishConfig(shared_ptr<const ProxyConfig> config)
+{
+    atomic_store(&currentConfig, std::move(config));
+}
+
+// 提示只在启动时使用、修改后需要重启的配置
+static void WarnRestartRequired(const ProxyConfig &old, const ProxyConfig &now)
+{
+    struct
+    {
+        const char *name;
+        bool changed;
+    } items[] = {
+        {"[Main] ListenHost/ListenPort/MaxListen", old.listenHost != now.listenHost || old.listenPort != now.listenPort
+            || old.maxListen != now.maxListen},
+        {"[Main] BufferSize", old.bufferSize != now.bufferSize},
+        {"[Main] StatsInterval", old.statsInterval != now.statsInterval},
+        {"[Main] Engine", old.engineMode != now.engineMode},
+        {"[HealthCheck]", old.healthCheckEnable != now.healthCheckEnable
+            || old.healthCheckInterval != now.healthCheckInterval || old.healthCheckTimeout != now.healthCheckTimeout
+            || old.healthCheckPath != now.healthCheckPath || old.healthCheckExpectStatus != now.healthCheckExpectStatus
+            || old.healthCheckRise != now.healthCheckRise || old.healthCheckFall != now.healthCheckFall},
+        {"[Cache]", old.cacheEnable != now.cacheEnable || old.cacheMaxSize != now.cacheMaxSize
+            || old.cacheMaxObjectSize != now.cacheMaxObjectSize || old.cacheShards != now.cacheShards
+            || old.cacheStaleTime != now.cacheStaleTime || old.cacheCollapse != now.cacheCollapse
+            || old.cacheDiskEnable != now.cacheDiskEnable || old.cacheDiskPath != now.cacheDiskPath
+            || old.cacheDiskSize != now.cacheDiskSize || old.cacheDiskSlabSize != now.cacheDiskSlabSize
+            || old.cacheDiskMaxObjectSize != now.cacheDiskMaxObjectSize},
+        {"[ThreadPool]", old.minThread != now.minThread || old.maxThread != now.maxThread
+            || old.waitBeforeShrink != now.waitBeforeShrink || old.workStealing != now.workStealing},
+        {"[UpstreamPool]", old.poolEnable != now.poolEnable || old.poolMaxIdle != now.poolMaxIdle
+            || old.poolMaxPerHost != now.poolMaxPerHost || old.poolIdleTimeout != now.poolIdleTimeout},
+        {"[Resolver]", old.resolverCacheTtl != now.resolverCacheTtl || old.resolverNegativeTtl != now.resolverNegativeTtl
+            || old.resolverTimeout != now.resolverTimeout},
+        {"[EventLoop]", old.loopThreads != now.loopThreads || old.reusePort != now.reusePort
+            || old.pinCpu != now.pinCpu},
+        {"[AsyncPlugins]", old.observerThreads != now.observerThreads
+            || old.observerMaxQueued != now.observerMaxQueued},
+    };
+    for(const auto &item : items)
+    {
+        if(item.changed)
+            reloadLogger.warn("%s changed, restart the proxy to apply it.", item.name);
+    }
+}
+
+// 重新读取配置文件，成功后发布新配置
+static void ReloadConfig()
+{
+    shared_ptr<const ProxyConfig> old = CurrentConfig();
+    shared_ptr<ProxyConfig> config = make_shared<ProxyConfig>();
+    string error;
+    if(!LoadConfig(configPath.c_str(), *config, error))
+    {
+        reloadLogger.error("Reload failed, keep using the old config: %s", error.c_str());
+        return;
+    }
+
+    // 沿用原有后端的健康状态，新的后端在这里（后台线程中）先解析好地址，事件循环线程不用等待
+    config->upstream->inheritState(*old->upstream);
+    for(Backend *backend : config->upstream->getBackends())
+    {
+        in_addr addr;
+        if(backend->lastAddr == 0 && resolver.resolve(backend->host, addr))
+            backend->lastAddr = addr.s_addr;
+    }
+    WarnRestartRequired(*old, *config);
+    reloadLogger.setLogLevel(config->logLevel);
+
+    PublishConfig(config);
+    reloadLogger.info("Config reloaded, %d backends, policy %s. Existing connections keep the old config.",
+        (int)config->upstream->getBackends().size(), config->upstream->getPolicyName());
+}
+
+// 重新加载线程函数
+static void* funcConfigReloader(void* data)
+{
+    sigset_t *signals = (sigset_t *)data;
+    while(true)
+    {
+        int sig;
+        if(sigwait(signals, &sig) == 0 && sig == SIGHUP)
+        {
+            reloadLogger.info("SIGHUP received, reloading %s...", configPath.c_str());
+            ReloadConfig();
+            if(reloadHandler != NULL)
+                reloadHandler(*CurrentConfig());
+        }
+    }
+    return NULL;
+}
+
+bool StartConfigReloader(const char *path, Logger::LogLevel logLevel, ConfigReloadHandler onReload)
+{
+    configPath = path;
+    reloadHandler = onReload;
+    reloadLogger.setLogLevel(logLevel);
+    reloadLogger.setPrefix("Config");
+
+    // 所有线程都屏蔽SIGHUP，只由重新加载线程用sigwait接收
+    static sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    if(pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0)
+        return false;
+
+    pthread_t threadId;
+    if(pthread_create(&threadId, NULL, funcConfigReloader, &signals) != 0)
+    {
+        reloadLogger.warn("Fail to start config reloader, SIGHUP will be ignored.");
+        return false;
+    }
+    pthread_detach(threadId);
+    return true;
+}
@@ -0,0 +1,123 @@
+/*
+ * 配置与热加载
+ *
+ * config.ini中的所有配置项读入一个ProxyConfig，生成之后不再修改。当前生效的配置是一份shared_ptr快照：
+ * 每个客户端连接在accept时取一份，整个连接期间都使用它。
+ * 收到SIGHUP时重新读取配置文件，成功后原子地换成新的快照：之后的新连接使用新配置，
+ * 已有的连接继续使用旧配置直到结束，旧快照在最后一个使用它的连接结束时自动释放，不会断开任何连接。
+ * 配置文件有误时保留原来的配置。
+ *
+ * 可以热加载的配置：LogLevel、[Proxy]（TargetHost/TargetPort/StreamBody/ZeroCopy）、[Upstream]、[Plugins]。
+ * 每份配置有自己的上游服务器组，新的组中与原来host:port相同的后端沿用原来的健康状态。
+ * 重新加载配置之后还会重新扫描插件目录，按新的[Plugins]加载新增和修改过的插件（见Plugins.h）。
+ * 其他配置（监听地址、工作模式、线程数、缓存、连接池、域名解析、健康检查、异步插件线程等）只在启动时使用，
+ * 修改后需要重启才能生效，重新加载时会在日志中提示。
+*/
+
+#ifndef CONFIG_BY_YQ
+#define CONFIG_BY_YQ
+
+#include <string>
+#include <memory>
+#include <map>
+#include "Logger.h"
+
+class UpstreamGroup;
+
+// 没有在[Plugins]中指定优先级的插件
+const int DefaultPluginPriority = 100;
+
+// 工作模式：线程池（每个连接一个线程）或者事件循环（epoll）
+enum class EngineMode { ThreadPool, EventLoop };
+
+struct ProxyConfig
+{
+    // main
+    std::string listenHost = "0.0.0.0";
+    int listenPort = 8080;
+    int maxListen = 5;
+    int bufferSize = 4096;
+    Logger::LogLevel logLevel = Logger::LogLevel::INFO;
+    // 定期输出统计信息的间隔（秒），0表示不输出
+    int statsInterval = 0;
+    EngineMode engineMode = EngineMode::ThreadPool;
+    // proxy
+    std::string targetHost = "";
+    int targetPort = 80;
+    // 没有插件需要完整body时，边收边转发body
+    bool streamBody = true;
+    // 流式转发的body使用splice()零拷贝
+    bool zeroCopy = true;
+    // upstream
+    std::string upstreamBackends = "";
+    std::string upstreamPolicy = "round_robin";
+    std::string upstreamHashKey = "client_ip";
+    int upstreamConnectTimeout = 3;
+    int upstreamMaxFails = 3;
+    int upstreamEjectTime = 10;
+    int upstreamSlowStart = 30;
+    // health check
+    bool healthCheckEnable = false;
+    int healthCheckInterval = 5;
+    int healthCheckTimeout = 2;
+    std::string healthCheckPath = "/";
+    int healthCheckExpectStatus = 200;
+    int healthCheckRise = 2;
+    int healthCheckFall = 3;
+    // response cache
+    bool cacheEnable = false;
+    int cacheMaxSize = 64;              // MB
+    int cacheMaxObjectSize = 1024;      // KB
+    int cacheShards = 16;
+    bool cacheDiskEnable = false;
+    std::string cacheDiskPath = "cache";
+    int cacheDiskSize = 1024;           // MB
+    int cacheDiskSlabSize = 64;         // MB
+    int cacheDiskMaxObjectSize = 32;    // MB
+    int cacheStaleTime = 30;
+    bool cacheCollapse = true;
+    // threadpool
+    int minThread = 3;
+    int maxThread = 20;
+    int waitBeforeShrink = 3;
+    // 任务调度方式：共享任务队列，或者工作窃取
+    bool workStealing = false;
+    // upstream pool
+    bool poolEnable = true;
+    int poolMaxIdle = 64;
+    int poolMaxPerHost = 16;
+    int poolIdleTimeout = 30;
+    // resolver
+    int resolverCacheTtl = 60;
+    int resolverNegativeTtl = 5;
+    int resolverTimeout = 5;
+    // eventloop
+    int loopThreads = 0;
+    bool reusePort = false;
+    bool pinCpu = false;
+    // plugins，插件文件名 -> 优先级，数值小的先调用，没有列出的插件使用DefaultPluginPriority，负数表示不加载
+    std::map<std::string, int> pluginPriority;
+    // async plugins，调用异步观察插件的后台线程数和等待队列的长度上限
+    int observerThreads = 1;
+    int observerMaxQueued = 10000;
+
+    // 按本配置建立的上游服务器组
+    std::shared_ptr<UpstreamGroup> upstream;
+};
+
+// 读取配置文件并建立上游服务器组，失败时返回false，error为原因
+bool LoadConfig(const char *path, ProxyConfig &config, std::string &error);
+
+// 当前生效的配置
+std::shared_ptr<const ProxyConfig> CurrentConfig();
+// 换成新的配置，之后调用CurrentConfig()得到的都是新配置
+void PublishConfig(std::shared_ptr<const ProxyConfig> config);
+
+// 每次收到SIGHUP、重新读取配置之后在重新加载线程中调用，参数为当前生效的配置（读取失败时是原来的配置）
+typedef void (*ConfigReloadHandler)(const ProxyConfig &config);
+
+// 启动重新加载配置的线程，收到SIGHUP时重新读取path，然后调用onReload（可以为空）
+// 会在调用线程中屏蔽SIGHUP，必须在创建其他线程之前调用，之后创建的线程都继承这个设置
+bool StartConfigReloader(const char *path, Logger::LogLevel logLevel, ConfigReloadHandler onReload = NULL);
+
+#endif
@@ -0,0 +1,370 @@
+#include "DiskCache.h"
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "ResponseCache.h"
+#include "Upstream.h"
+#include "Stats.h"
+using namespace std;
+
+DiskCache diskCache;
+
+static const char SlabMagic[8] = "YQSLAB1";
+static const uint32_t RecordMagic = 0x52445159;     // "YQDR"
+
+// slab文件开头的信息
+struct SlabHeader
+{
+    char magic[8];
+    uint64_t generation;
+    uint64_t slabSize;
+};
+
+// 每个条目的记录头，后面依次是key、Vary名称、head、notModifiedHead、etag、body
+struct RecordHeader
+{
+    uint32_t magic;                 // 条目写完后才写入
+    uint32_t keyHash;               // 重建时校验key
+    uint64_t generation;            // 写入时slab的代数，slab重新使用后旧条目的代数对不上
+    uint32_t keyLen;
+    uint32_t baseKeyLen;            // key的前baseKeyLen字节为基础key
+    uint32_t varyLen;               // Vary头部名称，以'\n'分隔
+    uint32_t headLen;
+    uint32_t notModifiedHeadLen;
+    uint32_t etagLen;
+    uint64_t bodyLen;
+    int64_t storedAt;
+    int64_t expires;
+    int64_t lastModified;
+    int64_t ageAtStore;
+};
+
+// 条目按8字节对齐
+static size_t Align(size_t len)
+{
+    return (len + 7) & ~(size_t)7;
+}
+
+static const size_t SlabDataStart = Align(sizeof(SlabHeader));
+
+static size_t RecordLength(const RecordHeader &rec)
+{
+    return Align(sizeof(RecordHeader) + (size_t)rec.keyLen + rec.varyLen + rec.headLen
+        + rec.notModifiedHeadLen + rec.etagLen + rec.bodyLen);
+}
+
+static vector<string> SplitNames(const char *data, size_t len)
+{
+    vector<string> names;
+    size_t begin = 0;
+    while(begin < len)
+    {
+        const char *end = (const char *)memchr(data + begin, '\n', len - begin);
+        size_t pos = end ? end - data : len;
+        names.emplace_back(data + begin, pos - begin);
+        begin = pos + 1;
+    }
+    return names;
+}
+
+DiskCache::~DiskCache()
+{
+    for(Slab *slab : slabs)
+    {
+        if(slab->data)
+            munmap(slab->data, slabSize);
+        if(slab->fd >= 0)
+            close(slab->fd);
+        delete slab;
+    }
+}
+
+bool DiskCache::init(bool enabled, const string &path, size_t size, size_t slabSize, size_t maxObjectSize,
+    Logger::LogLevel logLevel)
+{
+    logger.setLogLevel(logLevel);
+    logger.setPrefix("DiskCache");
+    if(!enabled)
+        return true;
+
+    this->path = path;
+    this->slabSize = slabSize;
+    // 一个条目不能跨slab
+    this->maxObjectSize = min(maxObjectSize, slabSize / 2);
+    if(slabSize < (1 << 20) || size < slabSize)
+    {
+        logger.error("Bad disk cache size: %d MB in %d MB slabs.", (int)(size >> 20), (int)(slabSize >> 20));
+        return false;
+    }
+    if(mkdir(path.c_str(), 0755) < 0 && errno != EEXIST)
+    {
+        logger.error("Fail to create cache directory %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // 至少两个slab，否则重新使用唯一的slab时会丢掉全部缓存
+    int slabCount = max((size_t)2, size / slabSize);
+    for(int i = 0; i < slabCount; ++i)
+    {
+        slabs.push_back(new Slab());
+        if(!openSlab(i))
+            return false;
+    }
+
+    // 按代数从旧到新扫描，同一个key以较新的条目为准
+    timeval begin, end;
+    gettimeofday(&begin, NULL);
+    time_t now = time(NULL);
+    vector<int> order;
+    for(int i = 0; i < slabCount; ++i)
+        if(slabs[i]->generation > 0)
+            order.push_back(i);
+    sort(order.begin(), order.end(), [this](int a, int b) { return slabs[a]->generation < slabs[b]->generation; });
+    for(int i : order)
+    {
+        size_t dataEnd = scanSlab(i, now);
+        currentSlab = i;
+        writeOffset = dataEnd;
+        maxGeneration = slabs[i]->generation;
+    }
+    if(order.empty())
+        recycle(0);
+    gettimeofday(&end, NULL);
+    long ms = (end.tv_sec - begin.tv_sec) * 1000 + (end.tv_usec - begin.tv_usec) / 1000;
+    logger.info("Loaded %d entries from %d slabs in %s in %ld ms.", (int)index.size(), slabCount, path.c_str(), ms);
+
+    this->enabled = true;
+    return true;
+}
+
+bool DiskCache::openSlab(int i)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/slab.%03d", i);
+    string fileName = path + name;
+    Slab *slab = slabs[i];
+
+    slab->fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(slab->fd < 0)
+    {
+        logger.error("Fail to open %s: %s", fileName.c_str(), strerror(errno));
+        return false;
+    }
+    // 预先分配好磁盘空间，否则磁盘满时写入映射会触发SIGBUS
+    struct stat st;
+    bool fresh = (fstat(slab->fd, &st) < 0 || (size_t)st.st_size != slabSize);
+    if(fresh && ftruncate(slab->fd, 0) < 0)
+    {
+        logger.error("Fail to truncate %s: %s", fileName.c_str(), strerror(errno));
+        return false;
+    }
+    int err = posix_fallocate(slab->fd, 0, slabSize);
+    if(err != 0)
+    {
+        logger.error("Fail to allocate %d MB for %s: %s", (int)(slabSize >> 20), fileName.c_str(), strerror(err));
+        return false;
+    }
+    slab->data = (char *)mmap(NULL, slabSize, PROT_READ | PROT_WRITE, MAP_SHARED, slab->fd, 0);
+    if(slab->data == MAP_FAILED)
+    {
+        slab->data = nullptr;
+        logger.error("Fail to map %s: %s", fileName.c_str(), strerror(errno));
+        return false;
+    }
+
+    const SlabHeader *header = (const SlabHeader *)slab->data;
+    if(!fresh && memcmp(header->magic, SlabMagic, sizeof(SlabMagic)) == 0 && header->slabSize == slabSize)
+        slab->generation = header->generation;
+    return true;
+}
+
+size_t DiskCache::scanSlab(int i, time_t now)
+{
+    Slab *slab = slabs[i];
+    size_t offset = SlabDataStart;
+    while(offset + sizeof(RecordHeader) <= slabSize)
+    {
+        const RecordHeader *rec = (const RecordHeader *)(slab->data + offset);
+        if(rec->magic != RecordMagic || rec->generation != slab->generation)
+            break;
+        size_t len = RecordLength(*rec);
+        if(len > slabSize - offset || rec->baseKeyLen > rec->keyLen)
+            break;
+        const char *key = (const char *)(rec + 1);
+        if(HashBytes(key, rec->keyLen) != rec->keyHash)
+            break;
+
+        if(rec->expires > now)
+        {
+            Location location{i, offset, (time_t)rec->expires, string(key, rec->baseKeyLen)};
+            addEntry(string(key, rec->keyLen), SplitNames(key + rec->keyLen, rec->varyLen), std::move(location));
+        }
+        offset += len;
+    }
+    return offset;
+}
+
+void DiskCache::recycle(int i)
+{
+    for(auto it = index.begin(); it != index.end(); )
+    {
+        auto cur = it++;
+        if(cur->second.slab == i)
+            removeEntry(cur);
+    }
+
+    Slab *slab = slabs[i];
+    slab->generation = ++maxGeneration;
+    SlabHeader *header = (SlabHeader *)slab->data;
+    memcpy(header->magic, SlabMagic, sizeof(SlabMagic));
+    header->generation = slab->generation;
+    header->slabSize = slabSize;
+    currentSlab = i;
+    writeOffset = SlabDataStart;
+    logger.debug("Reusing slab %d, generation %llu.", i, (unsigned long long)slab->generation);
+}
+
+void DiskCache::addEntry(const string &key, const vector<string> &names, Location &&location)
+{
+    auto old = index.find(key);
+    if(old != index.end())
+        removeEntry(old);
+    auto &vary = varyNames[location.baseKey];
+    vary.first = names;
+    ++vary.second;
+    index[key] = std::move(location);
+}
+
+void DiskCache::removeEntry(unordered_map<string, Location>::iterator it)
+{
+    auto vary = varyNames.find(it->second.baseKey);
+    if(vary != varyNames.end() && --vary->second.second <= 0)
+        varyNames.erase(vary);
+    index.erase(it);
+}
+
+shared_ptr<CachedResponse> DiskCache::lookup(const CacheRequest &request, time_t now, int staleTime,
+    vector<string> &names)
+{
+    if(!enabled)
+        return nullptr;
+
+    locker.lock();
+    auto vary = varyNames.find(request.key);
+    if(vary == varyNames.end())
+    {
+        locker.unlock();
+        return nullptr;
+    }
+    auto it = index.find(MakeVariantKey(request.key, vary->second.first, request.headers));
+    if(it == index.end() || now >= it->second.expires + staleTime)
+    {
+        if(it != index.end())
+            removeEntry(it);
+        locker.unlock();
+        return nullptr;
+    }
+    names = vary->second.first;
+    Slab *slab = slabs[it->second.slab];
+    size_t offset = it->second.offset;
+    ++slab->pins;
+    locker.unlock();
+
+    // 持有引用期间slab不会被覆盖，可以不加锁读取
+    const RecordHeader *rec = (const RecordHeader *)(slab->data + offset);
+    const char *data = (const char *)(rec + 1);
+    auto entry = make_shared<CachedResponse>();
+    entry->key.assign(data, rec->keyLen);
+    entry->baseKey.assign(data, rec->baseKeyLen);
+    data += rec->keyLen + rec->varyLen;
+    entry->head.assign(data, rec->headLen);
+    data += rec->headLen;
+    entry->notModifiedHead.assign(data, rec->notModifiedHeadLen);
+    data += rec->notModifiedHeadLen;
+    entry->etag.assign(data, rec->etagLen);
+    data += rec->etagLen;
+    entry->storedAt = rec->storedAt;
+    entry->expires = rec->expires;
+    entry->lastModified = rec->lastModified;
+    entry->ageAtStore = rec->ageAtStore;
+    entry->mappedBody = data;
+    entry->mappedLength = rec->bodyLen;
+    entry->bodyFd = slab->fd;
+    entry->bodyOffset = data - slab->data;
+    entry->pin = shared_ptr<void>(slab, [](Slab *slab) { --slab->pins; });
+    return entry;
+}
+
+void DiskCache::store(const CachedResponse &entry, const vector<string> &names)
+{
+    if(!enabled || entry.body.size() > maxObjectSize)
+        return;
+
+    string vary;
+    for(const string &name : names)
+    {
+        if(!vary.empty())
+            vary += '\n';
+        vary += name;
+    }
+    RecordHeader rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.keyHash = HashBytes(entry.key.data(), entry.key.size());
+    rec.keyLen = entry.key.size();
+    rec.baseKeyLen = entry.baseKey.size();
+    rec.varyLen = vary.size();
+    rec.headLen = entry.head.size();
+    rec.notModifiedHeadLen = entry.notModifiedHead.size();
+    rec.etagLen = entry.etag.size();
+    rec.bodyLen = entry.body.size();
+    rec.storedAt = entry.storedAt;
+    rec.expires = entry.expires;
+    rec.lastModified = entry.lastModified;
+    rec.ageAtStore = entry.ageAtStore;
+    size_t len = RecordLength(rec);
+    if(len > slabSize - SlabDataStart)
+        return;
+
+    // 先占好位置，拷贝数据时不持有锁
+    locker.lock();
+    if(writeOffset + len > slabSize)
+    {
+        int next = (currentSlab + 1) % slabs.size();
+        if(slabs[next]->pins > 0)
+        {
+            locker.unlock();
+            logger.debug("Slab %d is in use, skip storing %s.", next, entry.baseKey.c_str());
+            return;
+        }
+        recycle(next);
+    }
+    int slabIndex = currentSlab;
+    Slab *slab = slabs[slabIndex];
+    size_t offset = writeOffset;
+    writeOffset += len;
+    rec.generation = slab->generation;
+    ++slab->pins;
+    locker.unlock();
+
+    RecordHeader *target = (RecordHeader *)(slab->data + offset);
+    memcpy(target, &rec, sizeof(rec));
+    char *data = (char *)(target + 1);
+    const string *parts[] = {&entry.key, &vary, &entry.head, &entry.notModifiedHead, &entry.etag, &entry.body};
+    for(const string *part : parts)
+    {
+        memcpy(data, part->data(), part->size());
+        data += part->size();
+    }
+
+    locker.lock();
+    target->magic = RecordMagic;
+    addEntry(entry.key, names, Location{slabIndex, offset, entry.expires, entry.baseKey});
+    --slab->pins;
+    locker.unlock();
+    ++proxyStats.cacheDiskStores;
+    logger.debug("Stored %s on disk, slab %d, offset %d.", entry.baseKey.c_str(), slabIndex, (int)offset);
+}
@@ -0,0 +1,97 @@
+/*
+ * 磁盘二级缓存
+ *
+ * 开启DiskEnable后，可缓存的响应在存入内存的同时写入DiskPath目录下的slab文件，内存放不下的大响应只存在磁盘上，
+ * 代理重启后仍然可以命中，不必每次都从冷缓存开始。
+ *
+ * 每个slab文件大小固定（DiskSlabSize），整个映射到内存中，条目按顺序追加写入，写满后换下一个slab；
+ * 所有slab轮流使用，重新使用一个slab时其中原有的条目全部作废（先进先出淘汰）。
+ *
+ * 每个条目以固定格式的记录头开头，记录头中有key、各部分长度、过期时间等信息，这些记录头就是磁盘上的索引：
+ * 启动时按slab的代数从旧到新扫描，只读取记录头和key、跳过body，很快就能重建内存中的索引。
+ * 记录头的magic最后写入，没有写完的条目在重建时会被丢弃。
+ *
+ * 命中时body不读入内存，CachedResponse中给出slab文件和偏移，线程池引擎用sendfile()直接发给客户端。
+ * 读取或写入期间持有slab的引用，被引用的slab不会被覆盖（这时新的响应放弃写入磁盘）。
+*/
+
+#ifndef DISK_CACHE_BY_YQ
+#define DISK_CACHE_BY_YQ
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
+#include <ctime>
+#include "ThreadPool/mutex.h"
+#include "Logger.h"
+
+struct CacheRequest;
+struct CachedResponse;
+
+class DiskCache
+{
+private:
+    struct Slab
+    {
+        int fd = -1;
+        char *data = nullptr;           // 整个文件映射到的地址
+        uint64_t generation = 0;        // 每次重新使用时加一，0表示还没有使用过
+        std::atomic<int> pins{0};       // 正在读取或写入其中条目的数量
+    };
+
+    // 索引中的一个条目
+    struct Location
+    {
+        int slab;
+        size_t offset;                  // 记录头在slab中的偏移
+        time_t expires;
+        std::string baseKey;
+    };
+
+    bool enabled = false;
+    std::string path;
+    size_t slabSize = 0;
+    size_t maxObjectSize = 0;
+    std::vector<Slab *> slabs;
+
+    Mutex locker;
+    int currentSlab = 0;                // 正在写入的slab
+    size_t writeOffset = 0;             // 当前slab中下一个条目的位置
+    uint64_t maxGeneration = 0;
+    std::unordered_map<std::string, Location> index;
+    // 每个基础key最近一次响应的Vary头部名称，以及使用它的条目数
+    std::unordered_map<std::string, std::pair<std::vector<std::string>, int>> varyNames;
+    Logger logger;
+
+public:
+    ~DiskCache();
+
+    // 打开或创建slab文件并重建索引，在开始工作之前调用；失败时返回false，磁盘缓存保持关闭
+    bool init(bool enabled, const std::string &path, size_t size, size_t slabSize, size_t maxObjectSize,
+        Logger::LogLevel logLevel);
+    bool isEnabled() const { return enabled; }
+    size_t getMaxObjectSize() const { return maxObjectSize; }
+
+    // 查找新鲜或过期不超过staleTime秒的缓存，没有时返回空；找到时names为该基础key的Vary头部名称
+    std::shared_ptr<CachedResponse> lookup(const CacheRequest &request, time_t now, int staleTime,
+        std::vector<std::string> &names);
+    // 写入一个响应（body在内存中），空间不够或slab正被引用时放弃
+    void store(const CachedResponse &entry, const std::vector<std::string> &names);
+
+private:
+    bool openSlab(int i);
+    // 扫描slab中的记录头，把有效且没有过期的条目加入索引，返回有效数据的结束位置
+    size_t scanSlab(int i, time_t now);
+    // 开始使用下一个slab，丢弃其中原有的条目，调用前需要持有locker
+    void recycle(int i);
+    // 以下调用前需要持有locker
+    void addEntry(const std::string &key, const std::vector<std::string> &names, Location &&location);
+    void removeEntry(std::unordered_map<std::string, Location>::iterator it);
+};
+
+// 全局共享的磁盘缓存
+extern DiskCache diskCache;
+
+#endif
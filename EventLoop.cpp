@@ -0,0 +1,1315 @@
+#include "EventLoop.h"
+#include <cstring>
+#include <cerrno>
+#include <deque>
+#include <memory>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sched.h>
+#include "HttpRequestPacket.h"
+#include "HttpResponsePacket.h"
+#include "HttpFramer.h"
+#include "Plugins.h"
+#include "UpstreamPool.h"
+#include "Resolver.h"
+#include "Upstream.h"
+#include "Config.h"
+#include "ResponseCache.h"
+#include "PendingRequest.h"
+#include "Stats.h"
+#include "BufferPool.h"
+#include "Utils.h"
+using namespace std;
+
+// 一次epoll_wait最多取出的事件数
+const int MaxEvents = 256;
+// 发往一端的数据积压超过此值时，暂停读取另一端，防止内存无限增长
+const size_t MaxPendingOutput = 1024 * 1024;
+// 一次可读事件中最多连续recv的次数（每次读入一块缓冲区），避免一个连接饿死其他连接
+const int MaxReadsPerEvent = 16;
+// 一次监听socket可读事件中最多accept的连接数
+const int MaxAcceptsPerEvent = 64;
+// 缓存命中时，内存中不超过此大小的body直接拷贝进发送缓冲区，更大的和磁盘缓存中的body等可写时分段发送
+const size_t MaxCopiedCacheBody = 64 * 1024;
+// 有连接需要检查超时时，epoll_wait最多等待的毫秒数
+const int TimeoutCheckMs = 200;
+
+// 注册到epoll中的事件来源
+struct EventSource
+{
+    enum class Type { Wakeup, Listen, Client, Server };
+    Type type;
+    LoopConnection *conn;
+};
+
+// 事件循环中的一个客户端连接，以及它对应的上游连接
+struct LoopConnection
+{
+    uint64_t id = 0;
+    EventSource clientSrc{EventSource::Type::Client, this};
+    EventSource serverSrc{EventSource::Type::Server, this};
+    int clientFd = -1;
+    int serverFd = -1;              // 收到第一个请求、选好后端之后才建立上游连接
+    in_addr clientAddr;             // 按客户端IP做一致性哈希时使用
+    std::shared_ptr<const ProxyConfig> config;  // accept时的配置，连接期间一直使用
+    Backend *backend = nullptr;     // 当前上游连接对应的后端
+    bool connecting = false;        // 上游的非阻塞connect尚未完成
+    long connectDeadline = 0;       // connect的截止时间（单调时钟毫秒数），0表示不限时
+    size_t connectAttempts = 0;     // 为当前请求已经尝试过的后端数，每个后端最多试一次
+    // 连接建立之前转发的第一个请求（插件处理之后的副本），连接失败或超时时换一个后端重发
+    unique_ptr<HttpRequestPacket> connectPacket;
+    bool closed = false;
+    bool closeAfterFlush = false;   // 上游已断开，发完剩余数据后关闭
+    bool serverReusable = false;    // 上游连接当前是否空闲且可以归还到连接池
+    // 上游连接取自连接池并且还没有收到任何响应。这时连接被关闭多半是服务器关闭空闲连接与复用之间的竞争，
+    // 用新连接重发replay中已经发出的请求，不算作后端故障；请求body流式转发或者请求太多时不保留（replayable为false）
+    bool serverPooled = false;
+    bool replayable = false;
+    string replay;
+    bool requestKeepAlive = true;   // 最近一个请求是否允许保持连接
+    uint32_t clientEvents = 0;      // 当前在epoll中注册的事件
+    uint32_t serverEvents = 0;
+    Logger logger;
+
+    string clientIn, serverIn;      // 收到但还没有凑成完整消息的数据
+    string toClient, toServer;      // 等待发出的数据
+    size_t toClientSent = 0, toServerSent = 0;
+
+    HttpFramer reqFramer{false};
+    HttpFramer respFramer{true};
+    bool respStarted = false;
+    bool reqChecked = false;        // 已经询问过插件是否需要当前消息的完整body
+    bool respChecked = false;
+    bool reqStreaming = false;      // 当前消息的body正在流式转发
+    bool respStreaming = false;
+    bool respKeepAlive = false;     // 当前响应之后上游连接能否继续使用
+    unique_ptr<BodyFilter> respFilter;  // 当前响应的body要经过的流式过滤插件
+    string respBody;                // 流式过滤时，解码后还没有交给插件的body
+    deque<PendingRequest> pending;  // 已转发但还没有收到响应的请求，按转发顺序与响应配对
+
+    // 等待其他请求获取同一个响应时暂存的请求，等待期间不处理后面的请求
+    bool waitingFetch = false;
+    long waitDeadline = 0;          // 最多等待FetchWaitSeconds秒（单调时钟毫秒数），超时后自己转发
+    unique_ptr<HttpRequestPacket> waitingPacket;
+    CacheRequest waitingCache;
+
+    // 正在发送body的缓存响应（toClient发完之后接着发送），发完之前不处理后面的请求，
+    // 持有期间磁盘缓存中的body所在的slab不会被覆盖
+    shared_ptr<const CachedResponse> cacheBody;
+    size_t cacheBodySent = 0;
+};
+
+// 单调时钟的毫秒数
+static long NowMs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 设置非阻塞
+static bool SetNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) >= 0;
+}
+
+// 事件循环线程函数
+void* funcInEventLoop(void* data)
+{
+    EventLoop *loop = (EventLoop *)data;   // data为所属事件循环的this指针
+    loop->run();
+    return NULL;
+}
+
+EventLoop::EventLoop(int id, const EventLoopOptions &options)
+    :id(id), options(options)
+{
+    logger.setLogLevel(options.logLevel);
+    logger.setPrefix("EventLoop #" + std::to_string(id));
+}
+
+EventLoop::~EventLoop()
+{
+    if(epollFd >= 0)
+        close(epollFd);
+    if(wakeFd >= 0)
+        close(wakeFd);
+    if(listenFd >= 0)
+        close(listenFd);
+}
+
+bool EventLoop::start(int listenSocket)
+{
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(epollFd < 0 || wakeFd < 0)
+    {
+        logger.error("Fail to create epoll instance.");
+        return false;
+    }
+
+    // eventfd用于主线程分派新连接时唤醒
+    static EventSource wakeSrc{EventSource::Type::Wakeup, nullptr};
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &wakeSrc;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+
+    // 自己持有监听socket时，新连接直接在本线程accept
+    if(listenSocket >= 0)
+    {
+        static EventSource listenSrc{EventSource::Type::Listen, nullptr};
+        listenFd = listenSocket;
+        SetNonBlocking(listenFd);
+        ev.events = EPOLLIN;
+        ev.data.ptr = &listenSrc;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+    }
+
+    if(pthread_create(&threadId, NULL, funcInEventLoop, this) != 0)
+    {
+        logger.error("Fail to create event loop thread.");
+        return false;
+    }
+    pthread_detach(threadId);
+
+    // 绑定到CPU核，让accept、解析和转发始终在同一个核上完成
+    if(options.pinCpu)
+    {
+        int cpuCount = std::max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(id % cpuCount, &cpuSet);
+        if(pthread_setaffinity_np(threadId, sizeof(cpuSet), &cpuSet) != 0)
+            logger.warn("Fail to pin event loop to CPU %d.", id % cpuCount);
+        else
+            logger.debug("Pinned to CPU %d.", id % cpuCount);
+    }
+    return true;
+}
+
+void EventLoop::wakeWaiter(uint64_t connId)
+{
+    pendingLocker.lock();
+    readyWaiters.push_back(connId);
+    pendingLocker.unlock();
+
+    uint64_t one = 1;
+    if(write(wakeFd, &one, sizeof(one)) < 0)
+        logger.warn("Fail to wake up event loop.");
+}
+
+void EventLoop::addClient(int clientSocket, sockaddr_in clientAddr)
+{
+    pendingLocker.lock();
+    pendingClients.push_back({clientSocket, clientAddr});
+    pendingLocker.unlock();
+
+    uint64_t one = 1;
+    if(write(wakeFd, &one, sizeof(one)) < 0)
+        logger.warn("Fail to wake up event loop.");
+}
+
+// 循环等待事件
+void EventLoop::run()
+{
+    logger.debug("Event loop started.");
+    epoll_event events[MaxEvents];
+    while(true)
+    {
+        // 有正在connect的上游连接或者等待中的连接时定时醒来检查超时
+        int timeout = (connectingConns.empty() && waitingConns.empty()) ? -1 : TimeoutCheckMs;
+        int n = epoll_wait(epollFd, events, MaxEvents, timeout);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            logger.error("Error in epoll_wait().");
+            break;
+        }
+
+        for(int i = 0; i < n; ++i)
+        {
+            EventSource *src = (EventSource *)events[i].data.ptr;
+            if(src->type == EventSource::Type::Wakeup)
+            {
+                uint64_t count;
+                while(read(wakeFd, &count, sizeof(count)) > 0)
+                    ;
+                acceptPending();
+                resumeWaiters();
+            }
+            else if(src->type == EventSource::Type::Listen)
+                acceptClients();
+            else
+                handleEvent(src->conn, src->type == EventSource::Type::Server, events[i].events);
+        }
+
+        checkTimeouts();
+
+        // 同一批事件中可能还有已关闭连接的事件，因此放到最后统一释放
+        for(LoopConnection *conn : closedConns)
+            delete conn;
+        closedConns.clear();
+    }
+}
+
+// 接管主线程分派过来的新连接
+void EventLoop::acceptPending()
+{
+    vector<pair<int, sockaddr_in>> clients;
+    pendingLocker.lock();
+    clients.swap(pendingClients);
+    pendingLocker.unlock();
+
+    for(auto &item : clients)
+        openConnection(item.first, item.second);
+}
+
+// 继续处理等待的响应已经获取完成的连接：再查一次缓存，没有命中就自己转发
+void EventLoop::resumeWaiters()
+{
+    vector<uint64_t> ids;
+    pendingLocker.lock();
+    ids.swap(readyWaiters);
+    pendingLocker.unlock();
+
+    for(uint64_t connId : ids)
+    {
+        auto it = waitingConns.find(connId);
+        if(it != waitingConns.end())
+            resumeWaiter(it->second, false);
+    }
+}
+
+// 结束一个连接的等待：等待的响应获取完成时先查缓存，超时（或者没有命中）时自己转发
+void EventLoop::resumeWaiter(LoopConnection *conn, bool timedOut)
+{
+    waitingConns.erase(conn->id);
+    conn->waitingFetch = false;
+    unique_ptr<HttpRequestPacket> packet = std::move(conn->waitingPacket);
+    CacheRequest cacheReq = std::move(conn->waitingCache);
+    if(timedOut)
+        conn->logger.warn("[S <- C] Timeout waiting for the same response, forwarding by itself.");
+    if((timedOut || !replyFromCache(conn, *packet, cacheReq)) && !forwardRequest(conn, *packet, std::move(cacheReq)))
+    {
+        closeConnection(conn);
+        return;
+    }
+    // 等待期间收到的后续请求
+    if(!processClientInput(conn))
+    {
+        closeConnection(conn);
+        return;
+    }
+    if(conn->closeAfterFlush && conn->toClient.empty() && !conn->cacheBody)
+        closeConnection(conn);
+    else
+        updateEvents(conn);
+}
+
+// 从自己的监听socket上accept新连接
+void EventLoop::acceptClients()
+{
+    for(int i = 0; i < MaxAcceptsPerEvent; ++i)
+    {
+        sockaddr_in clientAddr;
+        socklen_t addrLen = sizeof(clientAddr);
+        int clientSocket = accept4(listenFd, (sockaddr *)&clientAddr, &addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(clientSocket < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            if(errno != EAGAIN && errno != EWOULDBLOCK)
+                logger.error("Fail to recv connection from client");
+            return;
+        }
+        openConnection(clientSocket, clientAddr);
+    }
+}
+
+void EventLoop::openConnection(int clientSocket, sockaddr_in clientAddr)
+{
+    LoopConnection *conn = new LoopConnection();
+    conn->id = ++nextConnId;
+    conn->clientFd = clientSocket;
+    conn->clientAddr = clientAddr.sin_addr;
+    conn->config = CurrentConfig();
+
+    char ipBuf[16] = {0};
+    inet_ntop(AF_INET, &clientAddr.sin_addr, ipBuf, 16);
+    conn->logger.setLogLevel(conn->config->logLevel);
+    conn->logger.setPrefix(string(ipBuf) + ":" + std::to_string(ntohs(clientAddr.sin_port)));
+    conn->logger.info("New connection received.");
+    if(!SetNonBlocking(clientSocket))
+    {
+        close(clientSocket);
+        delete conn;
+        return;
+    }
+
+    // 先以空事件注册，实际关注的事件由updateEvents决定
+    // 上游连接在收到第一个请求时按负载均衡策略建立
+    epoll_event ev;
+    ev.events = 0;
+    ev.data.ptr = &conn->clientSrc;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, conn->clientFd, &ev);
+
+    ++connCount;
+    logger.debug("Connection accepted. %d connections in this loop.", connCount);
+    updateEvents(conn);
+}
+
+// 连接到后端：优先复用连接池中的空闲连接，否则非阻塞地连接，连接完成时会收到EPOLLOUT
+bool EventLoop::connectServer(LoopConnection *conn, Backend *backend, bool usePool)
+{
+    conn->backend = backend;
+    conn->logger.debug("Connecting to server %s...", backend->hostStr.c_str());
+    int res = -1;
+    conn->serverFd = usePool ? upstreamPool.acquire(backend->poolKey, true) : -1;
+    conn->serverPooled = (conn->serverFd >= 0);
+    conn->replayable = conn->serverPooled;
+    conn->replay.clear();
+    if(conn->serverFd >= 0)
+    {
+        conn->logger.debug("Reuse idle server connection from pool.");
+        res = 0;
+    }
+    else
+    {
+        // 从解析缓存中取最新的地址（不等待），没有缓存时沿用上一次的地址
+        sockaddr_in targetAddr;
+        memset(&targetAddr, 0, sizeof(targetAddr));
+        targetAddr.sin_family = AF_INET;
+        targetAddr.sin_port = htons(backend->port);
+        if(resolver.resolve(backend->host, targetAddr.sin_addr, false))
+            backend->lastAddr = targetAddr.sin_addr.s_addr;
+        else
+            targetAddr.sin_addr.s_addr = backend->lastAddr;
+        if(targetAddr.sin_addr.s_addr == 0)
+        {
+            conn->logger.error("Fail to resolve domain: %s", backend->host.c_str());
+            conn->config->upstream->reportFailure(backend, "resolve failed");
+            return false;
+        }
+        conn->serverFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(conn->serverFd >= 0)
+            res = connect(conn->serverFd, (sockaddr *)&targetAddr, sizeof(targetAddr));
+    }
+    if(res < 0 && errno != EINPROGRESS)
+    {
+        conn->logger.error("Failed to connect to server %s.", backend->hostStr.c_str());
+        conn->config->upstream->reportFailure(backend, "connect failed");
+        if(conn->serverFd >= 0)
+            close(conn->serverFd);
+        conn->serverFd = -1;
+        return false;
+    }
+    conn->connecting = (res < 0);
+    if(conn->connecting)
+    {
+        int timeout = conn->config->upstreamConnectTimeout;
+        conn->connectDeadline = (timeout > 0) ? NowMs() + timeout * 1000L : 0;
+        connectingConns[conn->id] = conn;
+    }
+    else
+        conn->connectAttempts = 0;
+
+    epoll_event ev;
+    ev.events = 0;
+    ev.data.ptr = &conn->serverSrc;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, conn->serverFd, &ev);
+    conn->serverEvents = 0;
+    if(!conn->connecting)
+        conn->logger.debug("Connected to server %s.", backend->hostStr.c_str());
+    return true;
+}
+
+// 结束当前的上游连接，没有未完成的请求/响应时还给连接池供其他客户端复用
+void EventLoop::releaseServer(LoopConnection *conn)
+{
+    if(conn->backend && !conn->pending.empty())
+        UpstreamGroup::endRequest(conn->backend, conn->pending.size());
+    if(conn->serverFd >= 0)
+    {
+        bool idle = conn->pending.empty() && !conn->respStarted && conn->serverIn.empty()
+            && conn->toServer.empty() && !conn->connecting;
+        if(conn->serverReusable && idle)
+        {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->serverFd, nullptr);
+            conn->logger.debug("Return server connection to pool.");
+            upstreamPool.release(conn->backend->poolKey, conn->serverFd);
+        }
+        else
+            close(conn->serverFd);     // close会自动把fd从epoll中移除
+    }
+    if(conn->connecting)
+        connectingConns.erase(conn->id);
+    conn->serverFd = -1;
+    conn->serverEvents = 0;
+    conn->connecting = false;
+    conn->connectPacket.reset();
+    conn->serverReusable = false;
+    conn->serverPooled = false;
+    conn->replayable = false;
+    conn->replay.clear();
+    conn->pending.clear();
+    conn->serverIn.clear();
+    conn->toServer.clear();
+    conn->toServerSent = 0;
+    conn->respStarted = false;
+    conn->respStreaming = false;
+    conn->respChecked = false;
+    conn->respFilter.reset();
+    conn->respBody.clear();
+}
+
+void EventLoop::closeConnection(LoopConnection *conn)
+{
+    if(conn->closed)
+        return;
+    conn->closed = true;
+    // close会自动把fd从epoll中移除
+    if(conn->clientFd >= 0)
+        close(conn->clientFd);
+    releaseServer(conn);
+    conn->cacheBody.reset();
+    conn->clientFd = -1;
+    if(conn->waitingFetch)
+        waitingConns.erase(conn->id);
+    closedConns.push_back(conn);
+
+    --connCount;
+    logger.debug("Connection closed. %d connections in this loop.", connCount);
+}
+
+void EventLoop::handleEvent(LoopConnection *conn, bool isServer, uint32_t events)
+{
+    if(conn->closed)
+        return;
+
+    if(!isServer)
+    {
+        if(events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        {
+            // client -> server
+            bool alive = readAll(conn->clientFd, conn->clientIn);
+            if(!processClientInput(conn))
+            {
+                closeConnection(conn);
+                return;
+            }
+            if(!alive)
+            {
+                conn->logger.debug("[S <- C] Connection closed by client.");
+                closeConnection(conn);
+                return;
+            }
+        }
+        if(events & EPOLLOUT)
+        {
+            bool sendingCache = (conn->cacheBody != nullptr);
+            if(!flushClient(conn))
+            {
+                conn->logger.error("[S -> C] Fail to send data to client.");
+                closeConnection(conn);
+                return;
+            }
+            // 缓存命中的body发完后，继续处理后面的请求
+            if(sendingCache && !conn->cacheBody && !conn->clientIn.empty() && !processClientInput(conn))
+            {
+                closeConnection(conn);
+                return;
+            }
+        }
+    }
+    else if(conn->serverFd < 0)
+    {
+        // 同一批事件中，上游连接已经在处理前面的事件时结束了
+        return;
+    }
+    else if(conn->connecting)
+    {
+        if(events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+            finishConnect(conn);
+    }
+    else
+    {
+        if(events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        {
+            // server -> client
+            bool alive = readAll(conn->serverFd, conn->serverIn);
+            // 收到响应之后，连接的关闭不再是复用时的竞争
+            if(!conn->serverIn.empty())
+            {
+                conn->serverPooled = false;
+                conn->replay.clear();
+            }
+            if(!processServerInput(conn))
+            {
+                closeConnection(conn);
+                return;
+            }
+            if(!alive)
+            {
+                conn->logger.debug("[S -> C] Connection closed by server.");
+                onServerClosed(conn);
+            }
+            // 等待响应的请求减少后，继续处理因流水线过深而暂停的请求
+            else if(!conn->clientIn.empty() && !processClientInput(conn))
+            {
+                closeConnection(conn);
+                return;
+            }
+        }
+        if(!conn->closed && conn->serverFd >= 0 && !conn->connecting && (events & EPOLLOUT))
+        {
+            if(!flushServer(conn))
+            {
+                conn->logger.error("[S <- C] Fail to send data to target server.");
+                closeConnection(conn);
+                return;
+            }
+        }
+    }
+
+    // 客户端数据都已发完，且上游已断开，可以关闭了
+    if(!conn->closed && conn->closeAfterFlush && conn->toClient.empty() && !conn->cacheBody)
+        closeConnection(conn);
+    if(!conn->closed)
+        updateEvents(conn);
+}
+
+// 非阻塞connect完成
+void EventLoop::finishConnect(LoopConnection *conn)
+{
+    int err = 0;
+    socklen_t errLen = sizeof(err);
+    if(getsockopt(conn->serverFd, SOL_SOCKET, SO_ERROR, &err, &errLen) < 0 || err != 0)
+    {
+        conn->logger.error("Failed to connect to server %s.", conn->backend->hostStr.c_str());
+        conn->config->upstream->reportFailure(conn->backend, "connect failed");
+        retryConnect(conn);
+        return;
+    }
+    // 换了上游连接后，同一批事件中可能还有旧连接的事件，此时新连接还没有完成
+    sockaddr_in peerAddr;
+    socklen_t peerLen = sizeof(peerAddr);
+    if(getpeername(conn->serverFd, (sockaddr *)&peerAddr, &peerLen) < 0)
+        return;
+    conn->connecting = false;
+    connectingConns.erase(conn->id);
+    conn->connectAttempts = 0;
+    conn->connectPacket.reset();
+    conn->logger.debug("Connected to server %s.", conn->backend->hostStr.c_str());
+
+    // 连接期间可能已经积攒了请求
+    if(!flushServer(conn))
+    {
+        conn->logger.error("[S <- C] Fail to send data to target server.");
+        closeConnection(conn);
+    }
+}
+
+// 从非阻塞socket中读取数据追加到in，返回false表示连接已断开或出错
+bool EventLoop::readAll(int fd, string &in)
+{
+    ssize_t recvLen = RecvAppend(fd, in, MaxReadsPerEvent);
+    if(recvLen > 0)
+        return true;
+    if(recvLen == 0)
+        return false;
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+// 尽量发出out中的数据，发不完的等下一次EPOLLOUT，返回false表示出错
+bool EventLoop::flush(int fd, string &out, size_t &sent)
+{
+    while(sent < out.size())
+    {
+        ssize_t bytesWritten = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if(bytesWritten < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        sent += bytesWritten;
+    }
+    out.clear();
+    sent = 0;
+    return true;
+}
+
+// 发出toClient中的数据，发完后接着发送缓存命中的body：磁盘缓存中的用sendfile直接从slab文件发送，
+// 内存中的直接send，每次最多MaxPendingOutput字节，socket缓冲区满了就等下次可写
+bool EventLoop::flushClient(LoopConnection *conn)
+{
+    if(!flush(conn->clientFd, conn->toClient, conn->toClientSent))
+        return false;
+    if(!conn->cacheBody || !conn->toClient.empty())
+        return true;
+    const CachedResponse &cached = *conn->cacheBody;
+    while(conn->cacheBodySent < cached.bodySize())
+    {
+        size_t len = min(cached.bodySize() - conn->cacheBodySent, MaxPendingOutput);
+        ssize_t bytesWritten;
+        if(cached.bodyFd >= 0)
+        {
+            off_t offset = cached.bodyOffset + conn->cacheBodySent;
+            bytesWritten = sendfile(conn->clientFd, cached.bodyFd, &offset, len);
+        }
+        else
+            bytesWritten = send(conn->clientFd, cached.bodyData() + conn->cacheBodySent, len, MSG_NOSIGNAL);
+        if(bytesWritten < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if(bytesWritten == 0)
+            return false;
+        conn->cacheBodySent += bytesWritten;
+    }
+    // 发完后释放，磁盘缓存的slab不再被占用
+    conn->cacheBody.reset();
+    conn->cacheBodySent = 0;
+    return true;
+}
+
+// 处理客户端发来的数据并发出结果；缓存命中的body一次就发完时，接着处理后面的请求
+bool EventLoop::processClientInput(LoopConnection *conn)
+{
+    while(true)
+    {
+        if(!processClientRequests(conn))
+            return false;
+        bool sendingCache = (conn->cacheBody != nullptr);
+        if(!flushClient(conn))
+        {
+            conn->logger.error("[S -> C] Fail to send data to client.");
+            return false;
+        }
+        if(!sendingCache || conn->cacheBody || conn->clientIn.empty())
+            return true;
+    }
+}
+
+// 每凑齐一个完整请求就处理并转发
+bool EventLoop::processClientRequests(LoopConnection *conn)
+{
+    Logger &logger = conn->logger;
+    while(!conn->clientIn.empty() && !conn->closeAfterFlush && !conn->waitingFetch && !conn->cacheBody
+        && (conn->reqStreaming || conn->pending.size() < MaxPipelineDepth))
+    {
+        auto res = conn->reqFramer.advance(conn->clientIn.data(), conn->clientIn.size());
+        if(res == HttpFramer::Result::Error)
+        {
+            logger.error("[S <- C] Bad request from client.");
+            if(conn->reqStreaming || !conn->pending.empty() || conn->respStarted)
+                return false;
+            conn->toClient.append(BadRequestResponse);
+            conn->clientIn.clear();
+            conn->closeAfterFlush = true;
+            return true;
+        }
+
+        if(conn->reqStreaming)
+        {
+            // 流式转发中，已经确定属于当前请求的body直接发出去
+            size_t len = conn->reqFramer.getLength();
+            conn->toServer.append(conn->clientIn, 0, len);
+            conn->clientIn.erase(0, len);
+            conn->reqFramer.discard(len);
+            if(res != HttpFramer::Result::Complete)
+                break;
+            conn->reqStreaming = false;
+            conn->reqChecked = false;
+            conn->reqFramer.reset(false);
+            continue;
+        }
+
+        if(res == HttpFramer::Result::NeedMore)
+        {
+            // 请求头已经完整但body还没收完，没有插件需要完整body时改为流式转发
+            if(!conn->config->streamBody || conn->reqChecked || !conn->reqFramer.headerComplete())
+                break;
+            size_t headerLen = conn->reqFramer.getHeaderLength();
+            HttpRequestPacket packet(conn->clientIn.substr(0, headerLen));
+            conn->reqChecked = true;
+            if(PluginsWantRequestBody(&packet))
+                break;
+
+            logger.debug("[S <- C] Streaming request body to server.");
+            if(!forwardRequest(conn, packet, CacheRequest()))
+                return false;
+            // 流式转发的body不保留，池中的连接失效或者连接失败时都无法重发
+            conn->replayable = false;
+            conn->replay.clear();
+            conn->connectPacket.reset();
+            conn->clientIn.erase(0, headerLen);
+            conn->reqFramer.discard(headerLen);
+            conn->reqStreaming = true;
+            continue;
+        }
+
+        size_t len = conn->reqFramer.getLength();
+        HttpRequestPacket packet(conn->clientIn.substr(0, len));
+        CacheRequest cacheReq;
+        responseCache.prepare(packet, cacheReq);
+        if(!dispatchRequest(conn, packet, std::move(cacheReq)))
+            return false;
+        conn->clientIn.erase(0, len);
+        conn->reqChecked = false;
+        conn->reqFramer.reset(false);
+    }
+
+    if(conn->serverFd >= 0 && !conn->connecting && !conn->toServer.empty())
+    {
+        if(!flushServer(conn))
+        {
+            logger.error("[S <- C] Fail to send data to target server.");
+            return false;
+        }
+    }
+    return true;
+}
+
+// 处理服务端发来的数据，每凑齐一个完整响应就处理并转发
+bool EventLoop::processServerInput(LoopConnection *conn)
+{
+    Logger &logger = conn->logger;
+    while(!conn->serverIn.empty())
+    {
+        if(!conn->respStarted)
+        {
+            conn->respFramer.reset(true, !conn->pending.empty() && conn->pending.front().head);
+            conn->respStarted = true;
+        }
+        auto res = conn->respFramer.advance(conn->serverIn.data(), conn->serverIn.size());
+        if(res == HttpFramer::Result::Error)
+        {
+            logger.error("[S -> C] Bad response from server.");
+            conn->config->upstream->reportFailure(conn->backend, "bad response");
+            return false;
+        }
+
+        if(conn->respStreaming)
+        {
+            // 流式转发中，已经确定属于当前响应的body直接发出去，需要改写时经过插件后按chunked发出
+            size_t len = conn->respFramer.getLength();
+            if(conn->respFilter)
+            {
+                bool last = (res == HttpFramer::Result::Complete);
+                if(!conn->respBody.empty() || last)
+                    conn->respFilter->filterChunked(conn->respBody.data(), conn->respBody.size(), last, conn->toClient);
+                conn->respBody.clear();
+                if(last)
+                    conn->respFilter.reset();
+            }
+            else
+                conn->toClient.append(conn->serverIn, 0, len);
+            conn->serverIn.erase(0, len);
+            conn->respFramer.discard(len);
+            if(res != HttpFramer::Result::Complete)
+                break;
+            conn->respStreaming = false;
+            finishResponse(conn);
+            continue;
+        }
+
+        if(res == HttpFramer::Result::NeedMore)
+        {
+            // 响应头已经完整但body还没收完，没有插件需要完整body时改为流式转发
+            if(!conn->config->streamBody || conn->respChecked || !conn->respFramer.headerComplete())
+                break;
+            size_t headerLen = conn->respFramer.getHeaderLength();
+            HttpResponsePacket packet(conn->serverIn.substr(0, headerLen));
+            conn->respChecked = true;
+            // 需要存入缓存的响应也要完整接收
+            bool lengthKnown = conn->respFramer.getBodyMode() != HttpFramer::BodyMode::UntilClose;
+            if(!conn->pending.empty() && responseCache.wantResponse(conn->pending.front().cache, packet, lengthKnown))
+                break;
+            // 不能缓存的响应，马上让等待同一个响应的请求各自转发
+            if(!conn->pending.empty() && packet.code >= 200)
+                conn->pending.front().cache.fetch.reset();
+            const PendingRequest *request = conn->pending.empty() ? nullptr : &conn->pending.front();
+            if(PluginsWantResponseBody(&packet, request ? request->uri : string()))
+                break;
+            // 有插件要逐段改写body时改为chunked转发，客户端不支持chunked时只能完整接收
+            if(conn->respFramer.getBodyMode() != HttpFramer::BodyMode::None)
+                conn->respFilter = PluginsStartBodyFilter(&packet, request ? request->uri : string());
+            if(conn->respFilter && !(request && request->acceptChunked))
+                break;
+
+            logger.debug("[S -> C] Streaming response body to client.");
+            conn->respKeepAlive = forwardResponse(conn, packet, false);
+            conn->serverIn.erase(0, headerLen);
+            conn->respFramer.discard(headerLen);
+            if(conn->respFilter)
+                conn->respFramer.setBodySink(&conn->respBody);
+            conn->respStreaming = true;
+            continue;
+        }
+
+        size_t len = conn->respFramer.getLength();
+        HttpResponsePacket packet(conn->serverIn.substr(0, len));
+        conn->respKeepAlive = forwardResponse(conn, packet, true);
+        if(!conn->pending.empty())
+            responseCache.store(conn->pending.front().cache, packet);
+        conn->serverIn.erase(0, len);
+        finishResponse(conn);
+    }
+
+    if(!conn->toClient.empty())
+    {
+        if(!flushClient(conn))
+        {
+            logger.error("[S -> C] Fail to send data to client.");
+            return false;
+        }
+    }
+    return true;
+}
+
+// 一个响应已经完整转发
+void EventLoop::finishResponse(LoopConnection *conn)
+{
+    // 1xx临时响应之后，同一个请求还会有最终响应
+    int code = conn->respFramer.getStatusCode();
+    if((code < 100 || code >= 200 || code == 101) && !conn->pending.empty())
+    {
+        conn->pending.pop_front();
+        UpstreamGroup::endRequest(conn->backend);
+        conn->config->upstream->reportSuccess(conn->backend);
+    }
+
+    conn->serverReusable = conn->respKeepAlive && conn->requestKeepAlive && conn->pending.empty();
+    conn->respStarted = false;
+    conn->respChecked = false;
+}
+
+// 为请求选择后端，需要时换一个上游连接
+// 上一个请求的响应还没有收完时，只能继续发给同一个后端
+// 连接失败时换一个后端再试，每个后端最多试一次（包括之前connect失败或超时的）
+bool EventLoop::selectBackend(LoopConnection *conn, HttpRequestPacket &packet)
+{
+    if(conn->serverFd >= 0 && (!conn->pending.empty() || conn->respStarted))
+        return true;
+    size_t attempts = conn->config->upstream->getBackends().size();
+    while(conn->connectAttempts < attempts)
+    {
+        Backend *backend = conn->config->upstream->select(conn->clientAddr, packet.uri);
+        if(conn->serverFd >= 0 && backend == conn->backend)
+            return true;
+        releaseServer(conn);
+        ++conn->connectAttempts;
+        if(connectServer(conn, backend))
+            return true;
+    }
+    return false;
+}
+
+// 上游连接没有建立起来（失败或超时），请求还没有发出去：换一个后端重发暂存的请求
+// 请求已经调用过插件、通知过观察插件、计入了统计，这里只重新选择后端、改写Host后重新放入发送缓冲区
+// 连接期间已经转发了多个请求或者开始流式转发body时无法重发，关闭客户端连接
+void EventLoop::retryConnect(LoopConnection *conn)
+{
+    unique_ptr<HttpRequestPacket> packet = std::move(conn->connectPacket);
+    if(!packet || conn->pending.size() != 1 || conn->reqStreaming)
+    {
+        closeConnection(conn);
+        return;
+    }
+    PendingRequest request = std::move(conn->pending.front());
+    releaseServer(conn);
+    if(!selectBackend(conn, *packet))
+    {
+        closeConnection(conn);
+        return;
+    }
+    packet->headers["Host"] = conn->backend->hostStr;
+    conn->logger.debug("[S <- C] Retry on server %s.", conn->backend->hostStr.c_str());
+    appendRequest(conn, *packet);
+    if(conn->connecting)
+        conn->connectPacket = std::move(packet);
+    conn->pending.push_back(std::move(request));
+    UpstreamGroup::beginRequest(conn->backend);
+}
+
+// 检查超时：正在connect的上游连接超时算作后端故障，换一个后端重试；
+// 等待其他请求获取同一个响应超过FetchWaitSeconds秒的连接不再等待，自己转发
+void EventLoop::checkTimeouts()
+{
+    if(connectingConns.empty() && waitingConns.empty())
+        return;
+    long now = NowMs();
+    if(now < nextTimeoutCheck)
+        return;
+    nextTimeoutCheck = now + TimeoutCheckMs;
+
+    vector<LoopConnection*> expired;
+    for(auto &item : connectingConns)
+        if(item.second->connectDeadline > 0 && now >= item.second->connectDeadline)
+            expired.push_back(item.second);
+    for(LoopConnection *conn : expired)
+    {
+        conn->logger.error("Timeout connecting to server %s.", conn->backend->hostStr.c_str());
+        conn->config->upstream->reportFailure(conn->backend, "connect timeout");
+        retryConnect(conn);
+        if(!conn->closed)
+            updateEvents(conn);
+    }
+
+    expired.clear();
+    for(auto &item : waitingConns)
+        if(now >= item.second->waitDeadline)
+            expired.push_back(item.second);
+    for(LoopConnection *conn : expired)
+        if(!conn->closed && conn->waitingFetch)
+            resumeWaiter(conn, true);
+}
+
+// 缓存中有新鲜的响应时直接放入发往客户端的缓冲区，不经过上游和插件
+// 前面的请求还在等响应时不能插队
+bool EventLoop::replyFromCache(LoopConnection *conn, HttpRequestPacket &packet, const CacheRequest &cacheReq)
+{
+    if(!conn->pending.empty() || conn->respStarted)
+        return false;
+    shared_ptr<const CachedResponse> cached = responseCache.lookup(cacheReq);
+    if(!cached)
+        return false;
+
+    string head;
+    bool withBody = cached->buildResponse(cacheReq, time(NULL), head);
+    conn->logger.info("[S <- C] %s", packet.requestLine.c_str());
+    conn->logger.info("[S -> C] %s (cache hit)", head.substr(0, head.find('\r')).c_str());
+    conn->toClient.append(head);
+    // 小的body直接拷贝；大的body（包括磁盘缓存中的）在头部之后分段发送，不整个拷贝进发送缓冲区
+    if(withBody && cached->bodyFd < 0 && cached->bodySize() <= MaxCopiedCacheBody)
+        conn->toClient.append(cached->bodyData(), cached->bodySize());
+    else if(withBody && cached->bodySize() > 0)
+    {
+        conn->cacheBody = cached;
+        conn->cacheBodySent = 0;
+    }
+    // 客户端不保持连接时，发完就关闭
+    if(!packet.isKeepAlive())
+        conn->closeAfterFlush = true;
+    return true;
+}
+
+// 处理一个完整的请求：缓存命中时直接回复；其他请求正在获取同一个响应时暂停这个连接，等它完成；否则转发
+bool EventLoop::dispatchRequest(LoopConnection *conn, HttpRequestPacket &packet, CacheRequest &&cacheReq)
+{
+    if(replyFromCache(conn, packet, cacheReq))
+        return true;
+    if(conn->pending.empty() && !conn->respStarted && cacheReq.lookup)
+    {
+        // 回调在完成获取的线程中调用，只能通过编号唤醒本事件循环，连接此时可能已经关闭
+        uint64_t connId = conn->id;
+        if(responseCache.joinFetch(cacheReq, [this, connId]() { wakeWaiter(connId); }))
+        {
+            conn->logger.debug("[S <- C] Waiting for the same response being fetched.");
+            conn->waitingFetch = true;
+            conn->waitDeadline = NowMs() + FetchWaitSeconds * 1000L;
+            conn->waitingPacket.reset(new HttpRequestPacket(packet));
+            conn->waitingCache = std::move(cacheReq);
+            waitingConns[connId] = conn;
+            return true;
+        }
+    }
+    return forwardRequest(conn, packet, std::move(cacheReq));
+}
+
+// 处理一个请求（流式转发时只有请求头），放入发往服务端的缓冲区，无法连接到后端时返回false
+bool EventLoop::forwardRequest(LoopConnection *conn, HttpRequestPacket &packet, CacheRequest &&cacheReq)
+{
+    Logger &logger = conn->logger;
+    logger.info("[S <- C] %s", packet.requestLine.c_str());
+
+    if(!selectBackend(conn, packet))
+        return false;
+
+    // 重写headers里的Host
+    const string &targetStr = conn->backend->hostStr;
+    PendingRequest request(packet, std::move(cacheReq));
+    packet.headers["Host"] = targetStr;
+    logger.debug("[S <- C] Rewrite Host: %s -> %s", request.clientHost.c_str(), targetStr.c_str());
+
+    // 调用插件
+    PluginsCallClientRequest(&packet);
+
+    // 新连接还没有建立时保留插件处理过的第一个请求，连接失败时换后端重发，不再经过插件
+    if(conn->connecting && conn->pending.empty())
+        conn->connectPacket.reset(new HttpRequestPacket(packet));
+    appendRequest(conn, packet);
+    PluginsObserveRequest(&packet);
+    if(!conn->pending.empty())
+        ++proxyStats.pipelinedRequests;
+    ++proxyStats.forwardedRequests;
+    conn->pending.push_back(std::move(request));
+    UpstreamGroup::beginRequest(conn->backend);
+    conn->serverReusable = false;
+    conn->requestKeepAlive = packet.isKeepAlive();
+    return true;
+}
+
+// 把请求放入发往服务端的缓冲区，池中取出的连接同时保留一份，连接失效时重发
+void EventLoop::appendRequest(LoopConnection *conn, HttpRequestPacket &packet)
+{
+    size_t requestStart = conn->toServer.size();
+    packet.appendTo(conn->toServer);
+    if(conn->serverPooled && conn->replayable)
+    {
+        conn->replay.append(conn->toServer, requestStart, string::npos);
+        if(conn->replay.size() > MaxPendingOutput)
+        {
+            conn->replayable = false;
+            conn->replay.clear();
+        }
+    }
+}
+
+// 处理一个响应（流式转发时只有响应头，bodyComplete为false），放入发往客户端的缓冲区，返回此响应之后上游连接能否继续使用
+bool EventLoop::forwardResponse(LoopConnection *conn, HttpResponsePacket &packet, bool bodyComplete)
+{
+    Logger &logger = conn->logger;
+    const PendingRequest *request = conn->pending.empty() ? nullptr : &conn->pending.front();
+    if(request)
+        logger.info("[S -> C] %s (%s, %ld ms)", packet.responseLine.c_str(), request->requestLine.c_str(),
+            request->elapsedMs());
+    else
+        logger.info("[S -> C] %s", packet.responseLine.c_str());
+
+    // 处理301和302
+    // （改写Location为对应请求原来的Host）
+    if((packet.code == 301 || packet.code == 302) && request)
+    {
+        const string &targetHost = conn->backend->host;
+        ReplaceStr(packet.headers["Location"], targetHost, request->clientHost);
+        logger.debug("[S -> C] %d redirect, rewrite Location: %s -> %s", packet.code,
+            targetHost.c_str(), request->clientHost.c_str());
+    }
+
+    // 判断连接能否复用要在插件修改之前
+    bool keepAlive = packet.isKeepAlive();
+
+    // 调用插件
+    const string requestUri = request ? request->uri : string();
+    PluginsCallServerResponse(&packet, requestUri);
+    if(bodyComplete && conn->respFramer.getBodyMode() != HttpFramer::BodyMode::None)
+    {
+        if(!conn->respFilter)
+            conn->respFilter = PluginsStartBodyFilter(&packet, requestUri);
+        PluginsFinishBody(&packet, conn->respFilter.get());
+        conn->respFilter.reset();
+    }
+    else if(conn->respFilter)
+        BodyFilter::UseChunked(&packet);
+
+    packet.appendTo(conn->toClient);
+    PluginsObserveResponse(&packet, requestUri, request ? request->elapsedMs() : 0);
+    return keepAlive;
+}
+
+// 上游断开连接：没有长度的响应在此结束，发完剩余数据后关闭客户端
+// 没有等待中的请求时只是空闲的上游连接被关闭，客户端的下一个请求再重新连接
+void EventLoop::onServerClosed(LoopConnection *conn)
+{
+    conn->serverReusable = false;
+    if(conn->pending.empty() && !conn->respStarted)
+    {
+        releaseServer(conn);
+        return;
+    }
+    // 池中取出的连接在收到任何响应之前就被关闭了，换一个新连接重发请求
+    bool stale = conn->serverPooled && !conn->respStarted && conn->serverIn.empty();
+    if(stale && reconnectServer(conn))
+        return;
+
+    if(conn->respStarted && conn->respFramer.finishOnClose())
+    {
+        // 读到连接关闭为止的响应，此时已经完整（流式转发时数据已经全部发出，过滤插件还要输出剩余的内容）
+        if(!conn->respStreaming)
+        {
+            HttpResponsePacket packet(conn->serverIn);
+            forwardResponse(conn, packet, true);
+        }
+        else if(conn->respFilter)
+        {
+            conn->respFilter->filterChunked(conn->respBody.data(), conn->respBody.size(), true, conn->toClient);
+            conn->respFilter.reset();
+            conn->respBody.clear();
+        }
+        conn->serverIn.clear();
+        conn->respStreaming = false;
+        conn->respStarted = false;
+        flush(conn->clientFd, conn->toClient, conn->toClientSent);
+    }
+    else if(!stale)
+        conn->config->upstream->reportFailure(conn->backend, "connection closed before response completed");
+
+    releaseServer(conn);
+    conn->closeAfterFlush = true;
+}
+
+// 向上游发出toServer中的数据，池中取出的连接已经失效时换一个新连接重发
+bool EventLoop::flushServer(LoopConnection *conn)
+{
+    if(flush(conn->serverFd, conn->toServer, conn->toServerSent))
+        return true;
+    return reconnectServer(conn);
+}
+
+// 池中取出的上游连接在收到任何响应之前失效时，用新建的连接（不再取自连接池）重发已经发出的请求，
+// 等待响应的请求保持不变，只重试一次，返回false时由调用方按连接出错处理
+bool EventLoop::reconnectServer(LoopConnection *conn)
+{
+    if(!conn->serverPooled || !conn->replayable || conn->respStarted || !conn->serverIn.empty())
+        return false;
+    conn->logger.debug("[S <- C] Pooled server connection is stale, reconnecting...");
+    close(conn->serverFd);      // close会自动把fd从epoll中移除
+    conn->serverFd = -1;
+    conn->serverEvents = 0;
+    conn->toServer = std::move(conn->replay);
+    conn->toServerSent = 0;
+    return connectServer(conn, conn->backend, false);
+}
+
+// 根据当前各缓冲区的状态，更新在epoll中关注的事件
+void EventLoop::updateEvents(LoopConnection *conn)
+{
+    uint32_t clientWant = 0, serverWant = 0;
+    size_t toServerPending = conn->toServer.size() - conn->toServerSent;
+    size_t toClientPending = conn->toClient.size() - conn->toClientSent;
+
+    // 积压过多，或者暂停处理后面的请求时（流水线过深、等待其他请求获取同一个响应）不再读取客户端，
+    // 数据留在内核缓冲区中形成背压，否则不停流水线发送的客户端会让clientIn无限增长
+    bool clientPaused = conn->waitingFetch || conn->cacheBody
+        || (!conn->reqStreaming && conn->pending.size() >= MaxPipelineDepth);
+    if(!conn->closeAfterFlush && toServerPending < MaxPendingOutput && !clientPaused)
+        clientWant |= EPOLLIN;
+    if(toClientPending > 0 || conn->cacheBody)
+        clientWant |= EPOLLOUT;
+
+    if(conn->connecting)
+        serverWant = EPOLLOUT;
+    else if(conn->serverFd >= 0)
+    {
+        if(toClientPending < MaxPendingOutput)
+            serverWant |= EPOLLIN;
+        if(toServerPending > 0)
+            serverWant |= EPOLLOUT;
+    }
+
+    epoll_event ev;
+    if(clientWant != conn->clientEvents)
+    {
+        ev.events = clientWant;
+        ev.data.ptr = &conn->clientSrc;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, conn->clientFd, &ev);
+        conn->clientEvents = clientWant;
+    }
+    if(conn->serverFd >= 0 && serverWant != conn->serverEvents)
+    {
+        ev.events = serverWant;
+        ev.data.ptr = &conn->serverSrc;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, conn->serverFd, &ev);
+        conn->serverEvents = serverWant;
+    }
+}
+
+// 新建一个与主监听socket绑定相同地址的SO_REUSEPORT监听socket
+static int CreateReusePortSocket(const EventLoopOptions &options)
+{
+    int listenSocket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(listenSocket < 0)
+        return -1;
+    int on = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    if(bind(listenSocket, (sockaddr *)&options.listenAddr, sizeof(options.listenAddr)) < 0
+        || listen(listenSocket, options.maxListen) < 0)
+    {
+        close(listenSocket);
+        return -1;
+    }
+    return listenSocket;
+}
+
+bool RunEventLoops(int listenSocket, const EventLoopOptions &options)
+{
+    Logger logger(options.logLevel, "EventLoop");
+
+    // 后端地址在启动时解析好，之后事件循环线程只从缓存中取地址，不做阻塞的域名解析
+    int resolved = 0;
+    for(Backend *backend : CurrentConfig()->upstream->getBackends())
+    {
+        in_addr addr;
+        if(resolver.resolve(backend->host, addr))
+        {
+            backend->lastAddr = addr.s_addr;
+            ++resolved;
+        }
+        else
+            logger.warn("Fail to resolve domain: %s", backend->host.c_str());
+    }
+    if(resolved == 0)
+    {
+        logger.error("No backend can be resolved.");
+        return false;
+    }
+
+    // 启动事件循环
+    vector<EventLoop *> loops;
+    for(int i = 0; i < options.loopThreads; ++i)
+    {
+        int loopListenSocket = -1;
+        if(options.reusePort)
+        {
+            loopListenSocket = (i == 0 ? listenSocket : CreateReusePortSocket(options));
+            if(loopListenSocket < 0)
+            {
+                logger.error("Fail to create SO_REUSEPORT listen socket for event loop #%d", i);
+                return false;
+            }
+        }
+        EventLoop *loop = new EventLoop(i, options);
+        if(!loop->start(loopListenSocket))
+            return false;
+        loops.push_back(loop);
+    }
+    logger.info("%d event loops started.", (int)loops.size());
+
+    if(options.reusePort)
+    {
+        // 各事件循环自己accept，主线程无事可做
+        logger.info("SO_REUSEPORT enabled, each event loop accepts on its own socket.");
+        while(true)
+            pause();
+    }
+
+    // 循环监听客户端，轮流分派给各个事件循环
+    size_t next = 0;
+    while(true)
+    {
+        sockaddr_in clientAddr;
+        socklen_t addrLen = sizeof(clientAddr);
+        int clientSocket = accept(listenSocket, (sockaddr *)&clientAddr, &addrLen);
+        if(clientSocket < 0)
+        {
+            logger.error("Fail to recv connection from client");
+            continue;
+        }
+        loops[next]->addClient(clientSocket, clientAddr);
+        next = (next + 1) % loops.size();
+    }
+    return true;
+}
@@ -0,0 +1,127 @@
+/*
+ * 基于epoll的事件循环引擎
+ *
+ * 线程池模式下每个客户端连接独占一个线程，空闲的keep-alive连接也会一直占着线程。
+ * 事件循环模式下由少量事件循环线程持有所有非阻塞的客户端/上游socket，
+ * 每个连接用一个状态机驱动：读请求 -> 判定消息边界 -> 调用插件 -> 转发，响应方向同理。
+ * 消息头完整而body尚未收完时，如果没有插件需要完整的body，则先转发头部，之后body收到多少转发多少。
+ *
+ * 默认由主线程负责accept，然后把新连接轮流分派给各个事件循环（通过eventfd唤醒）。
+ * 开启ReusePort后，每个事件循环各自持有一个SO_REUSEPORT的监听socket，由内核在它们之间分配新连接，
+ * accept、解析和转发都在同一个线程（可选绑定到同一个CPU核）上完成，没有跨线程的交接。
+*/
+
+#ifndef EVENT_LOOP_BY_YQ
+#define EVENT_LOOP_BY_YQ
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <cstdint>
+#include <pthread.h>
+#include <netinet/in.h>
+#include "ThreadPool/mutex.h"
+#include "Logger.h"
+
+// 事件循环运行参数
+struct EventLoopOptions
+{
+    int loopThreads;            // 事件循环线程数
+    Logger::LogLevel logLevel;
+    bool reusePort;             // 每个事件循环使用各自的SO_REUSEPORT监听socket
+    bool pinCpu;                // 将事件循环线程绑定到CPU核
+    sockaddr_in listenAddr;     // ReusePort模式下新建监听socket使用
+    int maxListen;
+};
+
+struct LoopConnection;
+struct EventSource;
+struct HttpRequestPacket;
+struct HttpResponsePacket;
+struct Backend;
+struct CacheRequest;
+
+class EventLoop
+{
+private:
+    // 线程函数设友元以便访问私有成员
+    friend void* funcInEventLoop(void* data);
+
+    int id;
+    const EventLoopOptions &options;
+
+    int epollFd = -1;
+    int wakeFd = -1;
+    int listenFd = -1;          // ReusePort模式下此事件循环自己的监听socket
+    pthread_t threadId;
+    Logger logger;
+
+    // 主线程分派过来、尚未接管的新连接，以及等待的响应已经获取完成、可以继续处理的连接（均由pendingLocker保护）
+    Mutex pendingLocker;
+    std::vector<std::pair<int, sockaddr_in>> pendingClients;
+    std::vector<uint64_t> readyWaiters;
+
+    // 正在等待其他请求获取同一个响应的连接，按连接编号索引（连接可能在等待期间关闭）
+    std::unordered_map<uint64_t, LoopConnection*> waitingConns;
+    uint64_t nextConnId = 0;
+
+    // 上游connect尚未完成的连接，按连接编号索引，用于检查连接超时
+    std::unordered_map<uint64_t, LoopConnection*> connectingConns;
+    long nextTimeoutCheck = 0;
+
+    // 本轮事件处理中关闭的连接，处理完一批事件后统一释放
+    std::vector<LoopConnection*> closedConns;
+    int connCount = 0;
+
+public:
+    EventLoop(int id, const EventLoopOptions &options);
+    ~EventLoop();
+
+    // 启动事件循环线程，listenSocket >= 0 时由此事件循环自己accept
+    bool start(int listenSocket = -1);
+    // 分派一个新的客户端连接给此事件循环（线程安全）
+    void addClient(int clientSocket, sockaddr_in clientAddr);
+    // 连接等待的响应已经获取完成，唤醒此事件循环继续处理（线程安全）
+    void wakeWaiter(uint64_t connId);
+
+private:
+    void run();
+    void acceptPending();
+    void resumeWaiters();
+    void resumeWaiter(LoopConnection *conn, bool timedOut);
+    void acceptClients();
+    void openConnection(int clientSocket, sockaddr_in clientAddr);
+    void closeConnection(LoopConnection *conn);
+    // usePool为false时不使用连接池中的空闲连接
+    bool connectServer(LoopConnection *conn, Backend *backend, bool usePool = true);
+    bool reconnectServer(LoopConnection *conn);
+    void releaseServer(LoopConnection *conn);
+    void handleEvent(LoopConnection *conn, bool isServer, uint32_t events);
+    void finishConnect(LoopConnection *conn);
+    bool readAll(int fd, std::string &in);
+    bool flush(int fd, std::string &out, size_t &sent);
+    bool flushClient(LoopConnection *conn);
+    bool flushServer(LoopConnection *conn);
+    bool processClientInput(LoopConnection *conn);
+    bool processClientRequests(LoopConnection *conn);
+    bool processServerInput(LoopConnection *conn);
+    void finishResponse(LoopConnection *conn);
+    bool selectBackend(LoopConnection *conn, HttpRequestPacket &packet);
+    void retryConnect(LoopConnection *conn);
+    void checkTimeouts();
+    bool dispatchRequest(LoopConnection *conn, HttpRequestPacket &packet, CacheRequest &&cacheReq);
+    bool replyFromCache(LoopConnection *conn, HttpRequestPacket &packet, const CacheRequest &cacheReq);
+    bool forwardRequest(LoopConnection *conn, HttpRequestPacket &packet, CacheRequest &&cacheReq);
+    void appendRequest(LoopConnection *conn, HttpRequestPacket &packet);
+    bool forwardResponse(LoopConnection *conn, HttpResponsePacket &packet, bool bodyComplete);
+    void onServerClosed(LoopConnection *conn);
+    void updateEvents(LoopConnection *conn);
+};
+
+// 解析各后端地址，启动所有事件循环，然后在当前线程中循环accept并分派连接
+// ReusePort模式下listenSocket交给第一个事件循环，其余事件循环各自新建监听socket
+// 正常情况下不会返回
+bool RunEventLoops(int listenSocket, const EventLoopOptions &options);
+
+#endif
@@ -0,0 +1,144 @@
+#include "HealthCheck.h"
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "Upstream.h"
+#include "Config.h"
+#include "Resolver.h"
+#include "Stats.h"
+#include "Utils.h"
+using namespace std;
+
+HealthChecker healthChecker;
+
+// 检查线程函数
+void* funcInHealthChecker(void* data)
+{
+    ((HealthChecker *)data)->run();
+    return NULL;
+}
+
+void HealthChecker::init(bool enabled, int interval, int timeout, const string &path, int expectStatus,
+    int rise, int fall, Logger::LogLevel logLevel)
+{
+    this->enabled = enabled;
+    this->interval = interval > 0 ? interval : 1;
+    this->timeout = timeout > 0 ? timeout : 1;
+    this->path = path.empty() ? "/" : path;
+    this->expectStatus = expectStatus;
+    this->rise = rise > 0 ? rise : 1;
+    this->fall = fall > 0 ? fall : 1;
+    logger.setLogLevel(logLevel);
+    logger.setPrefix("HealthCheck");
+}
+
+bool HealthChecker::start()
+{
+    if(!enabled)
+        return false;
+
+    pthread_t threadId;
+    if(pthread_create(&threadId, NULL, funcInHealthChecker, this) != 0)
+    {
+        logger.warn("Fail to start health check thread.");
+        return false;
+    }
+    pthread_detach(threadId);
+    logger.info("Checking GET %s every %d seconds, expect status %d.", path.c_str(), interval, expectStatus);
+    return true;
+}
+
+void HealthChecker::run()
+{
+    while(true)
+    {
+        // 持有当前配置直到这一轮结束，期间重新加载配置不影响这一轮
+        shared_ptr<const ProxyConfig> config = CurrentConfig();
+        UpstreamGroup &upstreamGroup = *config->upstream;
+        unordered_map<string, State> lastStates;
+        lastStates.swap(states);
+        for(Backend *backend : upstreamGroup.getBackends())
+        {
+            State &state = states[backend->poolKey];
+            auto it = lastStates.find(backend->poolKey);
+            if(it != lastStates.end())
+                state = it->second;
+            int status = 0;
+            if(probe(backend, status))
+            {
+                logger.debug("%s OK.", backend->hostStr.c_str());
+                state.failures = 0;
+                if(++state.successes >= rise)
+                    upstreamGroup.setHealthy(backend, true);
+            }
+            else
+            {
+                ++proxyStats.healthCheckFailures;
+                if(status != 0)
+                    logger.debug("%s failed, status %d.", backend->hostStr.c_str(), status);
+                else
+                    logger.debug("%s failed, no valid response.", backend->hostStr.c_str());
+                state.successes = 0;
+                if(++state.failures >= fall)
+                    upstreamGroup.setHealthy(backend, false);
+            }
+        }
+        sleep(interval);
+    }
+}
+
+bool HealthChecker::probe(Backend *backend, int &status)
+{
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(backend->port);
+    if(!resolver.resolve(backend->host, addr.sin_addr))
+        return false;
+
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(sock < 0)
+        return false;
+    if(!ConnectWithTimeout(sock, addr, timeout * 1000))
+    {
+        close(sock);
+        return false;
+    }
+
+    // 收发都限时，服务器卡住时不会一直等下去
+    timeval tv = {timeout, 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    string request = "GET " + path + " HTTP/1.1\r\nHost: " + backend->hostStr
+        + "\r\nConnection: close\r\nUser-Agent: proxy-health-check\r\n\r\n";
+    if(send(sock, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size())
+    {
+        close(sock);
+        return false;
+    }
+
+    // 只需要状态行
+    char buf[256];
+    size_t len = 0;
+    while(len < sizeof(buf) - 1 && !memchr(buf, '\n', len))
+    {
+        ssize_t recvLen = recv(sock, buf + len, sizeof(buf) - 1 - len, 0);
+        if(recvLen <= 0)
+            break;
+        len += recvLen;
+    }
+    close(sock);
+    buf[len] = '\0';
+
+    // HTTP/1.x NNN ...
+    if(strncmp(buf, "HTTP/", 5) != 0)
+        return false;
+    const char *code = strchr(buf, ' ');
+    if(!code)
+        return false;
+    status = atoi(code + 1);
+    return status == expectStatus;
+}
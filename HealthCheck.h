@@ -0,0 +1,61 @@
+/*
+ * 后端主动健康检查
+ *
+ * 后台线程每隔Interval秒向每个后端发一个 GET Path 请求（Connection: close），
+ * 在Timeout秒内连接成功并收到ExpectStatus状态码算作一次成功，否则算作一次失败。
+ * 连续Fall次失败后把后端标记为不健康，不再转发请求；连续Rise次成功后重新标记为健康，并开始慢启动。
+ * 正常流量中的连接/读取失败由UpstreamGroup被动统计，两者互相独立。
+ * 每一轮检查当前配置中的后端，重新加载配置后，host:port不变的后端继续累计原来的成功/失败次数。
+*/
+
+#ifndef HEALTH_CHECK_BY_YQ
+#define HEALTH_CHECK_BY_YQ
+
+#include <string>
+#include <unordered_map>
+#include <pthread.h>
+#include "Logger.h"
+
+struct Backend;
+
+class HealthChecker
+{
+private:
+    // 线程函数设友元以便访问私有成员
+    friend void* funcInHealthChecker(void* data);
+
+    // 每个后端连续成功/失败的次数
+    struct State
+    {
+        int successes = 0;
+        int failures = 0;
+    };
+
+    bool enabled = false;
+    int interval = 5;
+    int timeout = 2;
+    std::string path = "/";
+    int expectStatus = 200;
+    int rise = 2;
+    int fall = 3;
+
+    std::unordered_map<std::string, State> states;      // 按后端的host:port索引
+    Logger logger;
+
+public:
+    // 设置参数，在start之前调用
+    void init(bool enabled, int interval, int timeout, const std::string &path, int expectStatus,
+        int rise, int fall, Logger::LogLevel logLevel);
+    // 启动检查线程，没有开启时不启动
+    bool start();
+
+private:
+    void run();
+    // 探测一次，成功时返回true，status为收到的状态码（没有收到时为0）
+    bool probe(Backend *backend, int &status);
+};
+
+// 全局的健康检查
+extern HealthChecker healthChecker;
+
+#endif
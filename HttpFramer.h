@@ -0,0 +1,378 @@
+#ifndef HTTP_FRAMER_BY_YQ
+#define HTTP_FRAMER_BY_YQ
+
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <climits>
+#include <string_view>
+#include <strings.h>
+#include "HttpParser.h"
+#include "Scanner.h"
+
+/* HTTP消息边界判定
+ *
+ * 在不断增长的接收缓冲区上增量推进，判断一个完整的请求/响应到哪里结束，过程中不拷贝数据。
+ * 传入的buf总是从当前消息的起始位置开始，已经检查过的部分不会重复扫描。
+ *
+ * body长度的判断规则：
+ *   响应码为1xx/204/304，或者是HEAD请求的响应 -> 没有body
+ *   Transfer-Encoding的最后一个编码是chunked  -> 按chunk逐块解析
+ *   响应的Transfer-Encoding是其他编码          -> 读到连接关闭为止
+ *   给出了Content-Length                    -> 固定长度
+ *   其他情况：请求没有body，响应读到连接关闭为止
+ *
+ * 上游连接会在多个客户端之间复用，对body长度理解不一致会让后面的请求错位（请求走私），所以格式要求严格：
+ * Content-Length必须全是数字且不溢出，多个Content-Length的值必须相同；
+ * 请求同时带有Content-Length和Transfer-Encoding，或者Transfer-Encoding的最后一个编码不是chunked时视为错误；
+ * chunk size必须是16进制数字，后面只能跟空白或者;开头的扩展。
+*/
+class HttpFramer
+{
+public:
+    enum class Result { NeedMore, Complete, Error };
+    enum class BodyMode { None, Fixed, Chunked, UntilClose };
+
+    // 请求头最大长度，超过视为错误
+    static const size_t MaxHeaderSize = 64 * 1024;
+    // chunk size行最大长度
+    static const size_t MaxChunkLineSize = 1024;
+
+private:
+    enum class State { Header, FixedBody, ChunkSize, ChunkData, ChunkDataEnd, Trailer, UntilClose, Done, Failed };
+
+    bool isResponse = false;
+    bool noBody = false;        // HEAD请求对应的响应没有body
+    State state = State::Header;
+    BodyMode bodyMode = BodyMode::None;
+    size_t pos = 0;             // 当前消息中已经处理到的位置
+    size_t headerLen = 0;       // 头部长度（包含结尾的\r\n\r\n）
+    size_t remains = 0;         // Fixed模式下剩余的body长度 / 当前chunk剩余的长度
+    size_t bodyStart = 0;       // body在buf中开始的位置
+    unsigned long long contentLength = 0;
+    int statusCode = 0;
+    std::string *bodySink = nullptr;    // 不为空时把body的内容（去掉chunked分块）追加到这里
+    HttpParser parser;
+
+public:
+    HttpFramer(bool isResponse = false, bool noBody = false)
+    {
+        reset(isResponse, noBody);
+    }
+
+    // 开始判定下一个消息
+    void reset(bool isResponse, bool noBody = false)
+    {
+        this->isResponse = isResponse;
+        this->noBody = noBody;
+        this->state = State::Header;
+        this->bodyMode = BodyMode::None;
+        this->pos = 0;
+        this->headerLen = 0;
+        this->remains = 0;
+        this->bodyStart = 0;
+        this->contentLength = 0;
+        this->statusCode = 0;
+        this->bodySink = nullptr;
+        this->parser.reset(isResponse);
+    }
+
+    // 之后推进时，把经过的body内容解码后追加到sink中（流式过滤body时使用），reset时取消
+    // 判定头部时可能已经顺带经过了一部分body，这里回到body的开头重新推进，所以必须在body被discard之前调用
+    void setBodySink(std::string *sink)
+    {
+        bodySink = sink;
+        if(!headerComplete() || bodyMode == BodyMode::None)
+            return;
+        pos = bodyStart;
+        remains = 0;
+        if(bodyMode == BodyMode::Fixed)
+        {
+            remains = contentLength;
+            state = (remains == 0 ? State::Done : State::FixedBody);
+        }
+        else if(bodyMode == BodyMode::Chunked)
+            state = State::ChunkSize;
+        else
+            state = State::UntilClose;
+    }
+
+    // Transfer-Encoding的值（逗号分隔的编码列表）中最后一个编码是否为chunked
+    static bool IsChunkedEncoding(std::string_view value)
+    {
+        size_t comma = value.rfind(',');
+        if(comma != std::string_view::npos)
+            value.remove_prefix(comma + 1);
+        while(!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+            value.remove_prefix(1);
+        while(!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+            value.remove_suffix(1);
+        return value.size() == 7 && strncasecmp(value.data(), "chunked", 7) == 0;
+    }
+
+    // 把完整的chunked body解码到out中，trailer被丢弃，格式错误或不完整时返回false
+    static bool DecodeChunked(const std::string &body, std::string &out)
+    {
+        HttpFramer framer(true);
+        framer.state = State::ChunkSize;
+        framer.bodyMode = BodyMode::Chunked;
+        framer.bodySink = &out;
+        return framer.advance(body.data(), body.size()) == Result::Complete;
+    }
+
+    // 在buf上继续推进判定，buf必须从当前消息的起始位置开始
+    Result advance(const char *buf, size_t len)
+    {
+        while(true)
+        {
+            switch(state)
+            {
+            case State::Header:
+            {
+                // 头部由HttpParser逐行解析，上次已经解析过的行不会重复扫描
+                HttpParser::Result res = parser.parse(buf, len);
+                if(res == HttpParser::Result::Error)
+                    return fail();
+                if(res == HttpParser::Result::NeedMore)
+                {
+                    pos = len;
+                    return Result::NeedMore;
+                }
+                headerLen = parser.getHeaderLength();
+                pos = headerLen;
+                bodyStart = headerLen;
+                if(!parseHeader())
+                    return fail();
+                break;
+            }
+            case State::FixedBody:
+            case State::ChunkData:
+            {
+                size_t take = len - pos < remains ? len - pos : remains;
+                if(bodySink)
+                    bodySink->append(buf + pos, take);
+                pos += take;
+                remains -= take;
+                if(remains > 0)
+                    return Result::NeedMore;
+                state = (state == State::FixedBody ? State::Done : State::ChunkDataEnd);
+                break;
+            }
+            case State::ChunkSize:
+            {
+                // chunk size为16进制，后面可能跟着;开头的扩展
+                const char *lineEnd = FindCrlf(buf + pos, len - pos);
+                if(!lineEnd)
+                {
+                    if(len - pos > MaxChunkLineSize)
+                        return fail();
+                    return Result::NeedMore;
+                }
+                const char *sizeEnd = buf + pos;
+                unsigned long long chunkSize = 0;
+                for(int digit; sizeEnd < lineEnd && (digit = HexValue(*sizeEnd)) >= 0; ++sizeEnd)
+                {
+                    if(chunkSize > (ULLONG_MAX >> 4))
+                        return fail();
+                    chunkSize = (chunkSize << 4) | digit;
+                }
+                if(sizeEnd == buf + pos || (sizeEnd != lineEnd && *sizeEnd != ';' && *sizeEnd != ' ' && *sizeEnd != '\t'))
+                    return fail();
+                pos = lineEnd - buf + 2;
+                remains = chunkSize;
+                state = (chunkSize == 0 ? State::Trailer : State::ChunkData);
+                break;
+            }
+            case State::ChunkDataEnd:
+            {
+                if(len - pos < 2)
+                    return Result::NeedMore;
+                if(buf[pos] != '\r' || buf[pos + 1] != '\n')
+                    return fail();
+                pos += 2;
+                state = State::ChunkSize;
+                break;
+            }
+            case State::Trailer:
+            {
+                // 最后一个chunk之后可能有trailer，以空行结束
+                const char *lineEnd = FindCrlf(buf + pos, len - pos);
+                if(!lineEnd)
+                {
+                    if(len - pos > MaxHeaderSize)
+                        return fail();
+                    return Result::NeedMore;
+                }
+                bool emptyLine = (lineEnd == buf + pos);
+                pos = lineEnd - buf + 2;
+                if(emptyLine)
+                    state = State::Done;
+                break;
+            }
+            case State::UntilClose:
+                if(bodySink)
+                    bodySink->append(buf + pos, len - pos);
+                pos = len;
+                return Result::NeedMore;
+            case State::Done:
+                return Result::Complete;
+            case State::Failed:
+                return Result::Error;
+            }
+        }
+    }
+
+    // 对端关闭了连接。对于读到关闭为止的响应，这意味着消息结束
+    bool finishOnClose()
+    {
+        if(state != State::UntilClose)
+            return false;
+        state = State::Done;
+        return true;
+    }
+
+    // 丢弃已经处理过的n个字节（流式转发时使用），之后传入的buf从丢弃后的位置开始
+    void discard(size_t n)
+    {
+        pos -= n;
+        bodyStart = (bodyStart > n ? bodyStart - n : 0);
+    }
+
+    // 当前可以不经过缓冲区直接转发的body字节数（固定长度body或chunk数据的剩余部分）
+    // 读到连接关闭为止的body返回SIZE_MAX，其他状态返回0
+    size_t getBodyRemains() const
+    {
+        if(state == State::FixedBody || state == State::ChunkData)
+            return remains;
+        if(state == State::UntilClose)
+            return SIZE_MAX;
+        return 0;
+    }
+
+    // 有n个body字节没有经过buf直接转发了（n不超过getBodyRemains()）
+    void skipBody(size_t n)
+    {
+        if(state != State::FixedBody && state != State::ChunkData)
+            return;
+        remains -= n;
+        if(remains == 0)
+            state = (state == State::FixedBody ? State::Done : State::ChunkDataEnd);
+    }
+
+    bool headerComplete() const { return state != State::Header && state != State::Failed; }
+    bool isFailed() const { return state == State::Failed; }
+    bool isComplete() const { return state == State::Done; }
+    BodyMode getBodyMode() const { return bodyMode; }
+    int getStatusCode() const { return statusCode; }
+    size_t getHeaderLength() const { return headerLen; }
+    // 当前已经确定属于这个消息的字节数，消息完整时即为消息总长度
+    size_t getLength() const { return pos; }
+
+private:
+    Result fail()
+    {
+        state = State::Failed;
+        return Result::Error;
+    }
+
+    static int HexValue(char c)
+    {
+        if(c >= '0' && c <= '9')
+            return c - '0';
+        if(c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if(c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    // 解析1*DIGIT的十进制数，不接受符号、空白和其他字符，溢出时返回false
+    static bool ParseDecimal(std::string_view str, unsigned long long &value)
+    {
+        if(str.empty())
+            return false;
+        value = 0;
+        for(char c : str)
+        {
+            if(c < '0' || c > '9')
+                return false;
+            unsigned digit = c - '0';
+            if(value > (ULLONG_MAX - digit) / 10)
+                return false;
+            value = value * 10 + digit;
+        }
+        return true;
+    }
+
+    // 根据头部决定body的长度模式
+    bool parseHeader()
+    {
+        statusCode = parser.getStatusCode();
+
+        bool chunked = false;
+        bool hasEncoding = false;
+        bool hasLength = false;
+        contentLength = 0;
+        for(size_t i = 0; i < parser.getHeaderCount(); ++i)
+        {
+            std::string_view name = parser.getHeaderName(i);
+            std::string_view value = parser.getHeaderValue(i);
+
+            // 头部名称不区分大小写
+            if(name.size() == 17 && strncasecmp(name.data(), "Transfer-Encoding", 17) == 0)
+            {
+                // 多个Transfer-Encoding头部按顺序连起来，以最后一个编码为准
+                hasEncoding = true;
+                chunked = IsChunkedEncoding(value);
+            }
+            else if(name.size() == 14 && strncasecmp(name.data(), "Content-Length", 14) == 0)
+            {
+                unsigned long long length = 0;
+                if(!ParseDecimal(value, length) || (hasLength && length != contentLength))
+                    return false;
+                contentLength = length;
+                hasLength = true;
+            }
+        }
+        // 请求的长度有歧义时拒绝，不能让上游按另一种方式理解
+        if(!isResponse && hasEncoding && (hasLength || !chunked))
+            return false;
+
+        if(isResponse && (noBody || (statusCode >= 100 && statusCode < 200 && statusCode != 101)
+            || statusCode == 204 || statusCode == 304))
+        {
+            bodyMode = BodyMode::None;
+            state = State::Done;
+        }
+        else if(chunked)
+        {
+            bodyMode = BodyMode::Chunked;
+            state = State::ChunkSize;
+        }
+        else if(hasEncoding)
+        {
+            bodyMode = BodyMode::UntilClose;
+            state = State::UntilClose;
+        }
+        else if(hasLength)
+        {
+            bodyMode = BodyMode::Fixed;
+            remains = contentLength;
+            state = (remains == 0 ? State::Done : State::FixedBody);
+        }
+        else if(isResponse)
+        {
+            bodyMode = BodyMode::UntilClose;
+            state = State::UntilClose;
+        }
+        else
+        {
+            bodyMode = BodyMode::None;
+            state = State::Done;
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,384 @@
+#ifndef HTTP_HEADERS_BY_YQ
+#define HTTP_HEADERS_BY_YQ
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <strings.h>
+#include <sys/uio.h>
+#include "Utils.h"
+
+/* HTTP头部列表
+ *
+ * 按收到的顺序保存各个头部，允许同名头部（比如多个Set-Cookie）同时存在，名称比较不区分大小写。
+ * 前InlineFields个头部直接放在对象内部，一般的请求/响应不需要为头部列表单独申请内存，超出的部分放到vector里。
+ * 常用的头部名称在加入时就转换成HeaderId，按这些名称查找时只需要比较整数。
+ *
+ * 从收到的数据解析出来的头部会记下它在原始数据中的位置，发送时没有被修改过的头部直接使用原始字节，
+ * 只有被修改或新加的头部需要重新拼接。
+ *
+ * 为了兼容之前基于std::map的写法，保留了headers["Name"]、find()、end()等接口：
+ * operator[]返回第一个同名头部的值，没有时在末尾添加一个空的头部。
+*/
+
+// 常用头部名称
+enum class HeaderId : uint8_t
+{
+    Other = 0,
+    Host,
+    Connection,
+    KeepAlive,
+    ProxyConnection,
+    ContentLength,
+    ContentType,
+    ContentEncoding,
+    TransferEncoding,
+    Location,
+    AcceptEncoding,
+    CacheControl,
+    Pragma,
+    Expires,
+    Date,
+    LastModified,
+    ETag,
+    IfModifiedSince,
+    IfNoneMatch,
+    Age,
+    Vary,
+    Cookie,
+    SetCookie,
+    Upgrade,
+    Te,
+    Trailer,
+    Range,
+};
+
+// 名称转换成HeaderId，不是常用头部时返回HeaderId::Other
+inline HeaderId LookupHeaderId(std::string_view name)
+{
+    struct KnownHeader
+    {
+        const char *name;
+        size_t length;
+        HeaderId id;
+    };
+    static const KnownHeader knownHeaders[] = {
+        {"Host", 4, HeaderId::Host},
+        {"Connection", 10, HeaderId::Connection},
+        {"Keep-Alive", 10, HeaderId::KeepAlive},
+        {"Proxy-Connection", 16, HeaderId::ProxyConnection},
+        {"Content-Length", 14, HeaderId::ContentLength},
+        {"Content-Type", 12, HeaderId::ContentType},
+        {"Content-Encoding", 16, HeaderId::ContentEncoding},
+        {"Transfer-Encoding", 17, HeaderId::TransferEncoding},
+        {"Location", 8, HeaderId::Location},
+        {"Accept-Encoding", 15, HeaderId::AcceptEncoding},
+        {"Cache-Control", 13, HeaderId::CacheControl},
+        {"Pragma", 6, HeaderId::Pragma},
+        {"Expires", 7, HeaderId::Expires},
+        {"Date", 4, HeaderId::Date},
+        {"Last-Modified", 13, HeaderId::LastModified},
+        {"ETag", 4, HeaderId::ETag},
+        {"If-Modified-Since", 17, HeaderId::IfModifiedSince},
+        {"If-None-Match", 13, HeaderId::IfNoneMatch},
+        {"Age", 3, HeaderId::Age},
+        {"Vary", 4, HeaderId::Vary},
+        {"Cookie", 6, HeaderId::Cookie},
+        {"Set-Cookie", 10, HeaderId::SetCookie},
+        {"Upgrade", 7, HeaderId::Upgrade},
+        {"TE", 2, HeaderId::Te},
+        {"Trailer", 7, HeaderId::Trailer},
+        {"Range", 5, HeaderId::Range},
+    };
+    for(const KnownHeader &known : knownHeaders)
+    {
+        if(known.length == name.size() && strncasecmp(known.name, name.data(), name.size()) == 0)
+            return known.id;
+    }
+    return HeaderId::Other;
+}
+
+// 一段数据在原始数据（packet的rawData）中的位置
+struct RawSpan
+{
+    uint32_t offset = 0;
+    uint32_t length = 0;
+
+    RawSpan() {}
+    RawSpan(size_t offset, size_t length) :offset((uint32_t)offset), length((uint32_t)length) {}
+    RawSpan(const std::string &raw, std::string_view part)
+        :offset((uint32_t)(part.data() - raw.data())), length((uint32_t)part.size()) {}
+
+    // raw中这段内容是否与value相同
+    bool same(const std::string &raw, const std::string &value) const
+    {
+        return offset + (size_t)length <= raw.size() && value.size() == length
+            && raw.compare(offset, length, value) == 0;
+    }
+    const char *data(const std::string &raw) const { return raw.data() + offset; }
+};
+
+class HttpHeaders
+{
+public:
+    struct Field
+    {
+        std::string name;
+        std::string value;
+        HeaderId id = HeaderId::Other;
+        // 解析得到的头部在原始数据中的位置，新加的头部rawLine.length为0
+        RawSpan rawLine;
+        RawSpan rawName;
+        RawSpan rawValue;
+
+        // 与原始数据相比没有被修改过
+        bool unchanged(const std::string &raw) const
+        {
+            return rawLine.length > 0 && rawName.same(raw, name) && rawValue.same(raw, value);
+        }
+    };
+
+    // 对象内部直接存放的头部个数
+    static const size_t InlineFields = 16;
+
+private:
+    Field inlineFields[InlineFields];
+    std::vector<Field> moreFields;
+    size_t count = 0;
+
+public:
+    template <class Headers, class Value>
+    class Iterator
+    {
+    private:
+        Headers *headers;
+        size_t index;
+
+    public:
+        Iterator(Headers *headers, size_t index) :headers(headers), index(index) {}
+        Value &operator*() const { return headers->at(index); }
+        Value *operator->() const { return &headers->at(index); }
+        Iterator &operator++() { ++index; return *this; }
+        bool operator==(const Iterator &other) const { return index == other.index; }
+        bool operator!=(const Iterator &other) const { return index != other.index; }
+        size_t getIndex() const { return index; }
+    };
+    typedef Iterator<HttpHeaders, Field> iterator;
+    typedef Iterator<const HttpHeaders, const Field> const_iterator;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    Field &at(size_t i) { return i < InlineFields ? inlineFields[i] : moreFields[i - InlineFields]; }
+    const Field &at(size_t i) const { return i < InlineFields ? inlineFields[i] : moreFields[i - InlineFields]; }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, count); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, count); }
+
+    void clear()
+    {
+        for(size_t i = 0; i < count && i < InlineFields; ++i)
+        {
+            inlineFields[i].name.clear();
+            inlineFields[i].value.clear();
+        }
+        moreFields.clear();
+        count = 0;
+    }
+
+    // 在末尾添加一个头部，不管是否已经有同名头部
+    Field &add(std::string_view name, std::string_view value)
+    {
+        return add(name, value, LookupHeaderId(name));
+    }
+
+    // 第一个同名头部的下标，没有时返回size()
+    size_t indexOf(std::string_view name, size_t from = 0) const
+    {
+        return indexOf(LookupHeaderId(name), name, from);
+    }
+    size_t indexOf(HeaderId id, size_t from = 0) const
+    {
+        for(size_t i = from; i < count; ++i)
+        {
+            if(at(i).id == id)
+                return i;
+        }
+        return count;
+    }
+
+    iterator find(std::string_view name) { return iterator(this, indexOf(name)); }
+    const_iterator find(std::string_view name) const { return const_iterator(this, indexOf(name)); }
+    iterator find(HeaderId id) { return iterator(this, indexOf(id)); }
+    const_iterator find(HeaderId id) const { return const_iterator(this, indexOf(id)); }
+
+    bool has(std::string_view name) const { return indexOf(name) < count; }
+    bool has(HeaderId id) const { return indexOf(id) < count; }
+
+    // 第一个同名头部的值，没有时返回空串
+    std::string get(std::string_view name) const
+    {
+        size_t i = indexOf(name);
+        return i < count ? at(i).value : std::string();
+    }
+    std::string get(HeaderId id) const
+    {
+        size_t i = indexOf(id);
+        return i < count ? at(i).value : std::string();
+    }
+
+    // 所有同名头部的值，按收到的顺序
+    std::vector<std::string> getAll(std::string_view name) const
+    {
+        std::vector<std::string> values;
+        HeaderId id = LookupHeaderId(name);
+        for(size_t i = indexOf(id, name, 0); i < count; i = indexOf(id, name, i + 1))
+            values.push_back(at(i).value);
+        return values;
+    }
+
+    // 设置头部的值：有同名头部时改写第一个并删掉其余的，没有时添加到末尾
+    void set(std::string_view name, std::string_view value)
+    {
+        HeaderId id = LookupHeaderId(name);
+        size_t i = indexOf(id, name, 0);
+        if(i == count)
+        {
+            add(name, value, id);
+            return;
+        }
+        at(i).value.assign(value.data(), value.size());
+        for(size_t j = indexOf(id, name, i + 1); j < count; j = indexOf(id, name, j))
+            eraseAt(j);
+    }
+
+    // 删除所有同名头部，返回删除的个数
+    size_t remove(std::string_view name)
+    {
+        HeaderId id = LookupHeaderId(name);
+        size_t removed = 0;
+        for(size_t i = indexOf(id, name, 0); i < count; i = indexOf(id, name, i))
+        {
+            eraseAt(i);
+            ++removed;
+        }
+        return removed;
+    }
+    size_t erase(std::string_view name) { return remove(name); }
+
+    iterator erase(iterator it)
+    {
+        eraseAt(it.getIndex());
+        return it;
+    }
+
+    // 记录最后添加的头部在原始数据raw中的位置（解析时使用）
+    void setRaw(const std::string &raw, std::string_view line, std::string_view name, std::string_view value)
+    {
+        Field &field = at(count - 1);
+        field.rawLine = RawSpan(raw, line);
+        field.rawName = RawSpan(raw, name);
+        field.rawValue = RawSpan(raw, value);
+    }
+
+    // 忘掉所有头部的原始位置（原始数据改变时），之后全部按字段内容重新拼接
+    void forgetRaw()
+    {
+        for(size_t i = 0; i < count; ++i)
+            at(i).rawLine = RawSpan();
+    }
+
+    // 与原始数据相比，头部是否有改动（修改、添加或删除）
+    bool isModified(const std::string &raw, size_t rawCount) const
+    {
+        if(count != rawCount)
+            return true;
+        for(size_t i = 0; i < count; ++i)
+        {
+            if(!at(i).unchanged(raw))
+                return true;
+        }
+        return false;
+    }
+
+    // 按顺序生成所有头部的iovec：没有修改过的头部指向raw中的原始整行，其余的按字段拼接
+    void fillIovec(const std::string &raw, std::vector<iovec> &iov) const
+    {
+        for(size_t i = 0; i < count; ++i)
+        {
+            const Field &field = at(i);
+            if(field.unchanged(raw))
+            {
+                AppendIovec(iov, field.rawLine.data(raw), field.rawLine.length);
+                continue;
+            }
+            AppendIovec(iov, field.name.data(), field.name.size());
+            AppendIovec(iov, ": ", 2);
+            AppendIovec(iov, field.value.data(), field.value.size());
+            AppendIovec(iov, "\r\n", 2);
+        }
+    }
+
+    // 兼容std::map的写法：返回第一个同名头部的值，没有时添加一个空的头部
+    std::string &operator[](std::string_view name)
+    {
+        HeaderId id = LookupHeaderId(name);
+        size_t i = indexOf(id, name, 0);
+        if(i < count)
+            return at(i).value;
+        return add(name, std::string_view(), id).value;
+    }
+
+private:
+    size_t indexOf(HeaderId id, std::string_view name, size_t from) const
+    {
+        // 常用头部只比较id，其他头部比较名称
+        if(id != HeaderId::Other)
+            return indexOf(id, from);
+        for(size_t i = from; i < count; ++i)
+        {
+            const Field &field = at(i);
+            if(field.id == HeaderId::Other && field.name.size() == name.size()
+                && strncasecmp(field.name.data(), name.data(), name.size()) == 0)
+                return i;
+        }
+        return count;
+    }
+
+    Field &add(std::string_view name, std::string_view value, HeaderId id)
+    {
+        Field *field;
+        if(count < InlineFields)
+            field = &inlineFields[count];
+        else
+        {
+            moreFields.emplace_back();
+            field = &moreFields.back();
+        }
+        ++count;
+        field->name.assign(name.data(), name.size());
+        field->value.assign(value.data(), value.size());
+        field->id = id;
+        field->rawLine = RawSpan();
+        return *field;
+    }
+
+    void eraseAt(size_t i)
+    {
+        for(; i + 1 < count; ++i)
+            at(i) = std::move(at(i + 1));
+        --count;
+        if(count >= InlineFields)
+            moreFields.pop_back();
+        else
+        {
+            inlineFields[count].name.clear();
+            inlineFields[count].value.clear();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,256 @@
+#ifndef HTTP_PARSER_BY_YQ
+#define HTTP_PARSER_BY_YQ
+
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <strings.h>
+#include "Scanner.h"
+
+/* 可增量推进的HTTP/1.1头部解析器
+ *
+ * 直接在接收缓冲区上解析请求行/响应行和各个头部，只记录每个字段在缓冲区中的偏移和长度，
+ * 解析过程中不拷贝数据，也不申请内存。头部没有收完时返回NeedMore，
+ * 之后缓冲区追加了新数据再次调用parse()，会从上次完整解析的那一行继续，已经解析过的行不会重复扫描。
+ *
+ * 记录的是偏移而不是指针，所以两次parse()之间缓冲区可以重新分配（比如std::string扩容），
+ * 只要前面的内容不变即可。取出的string_view指向最近一次传给parse()的buf。
+*/
+class HttpParser
+{
+public:
+    enum class Result { NeedMore, Complete, Error };
+
+    // 头部最大长度，超过视为错误
+    static const size_t MaxHeaderSize = 64 * 1024;
+    // 最多记录的头部个数，超过视为错误
+    static const size_t MaxHeaders = 100;
+
+private:
+    struct Span
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+    struct HeaderSpan
+    {
+        Span name;
+        Span value;
+        Span line;              // 整行，包含行尾的换行符
+    };
+
+    enum class State { StartLine, Headers, Done, Failed };
+
+    bool isResponse = false;
+    State state = State::StartLine;
+    const char *base = nullptr; // 最近一次parse()的buf
+    size_t pos = 0;             // 下一行的起始位置
+    size_t scanned = 0;         // 已经确认没有换行符的位置，下次从这里继续找
+    bool lineHasColon = false;  // 当前行中已经找到了冒号
+    size_t colonOffset = 0;     // 当前行中第一个冒号的位置
+    size_t headerLen = 0;       // 头部长度（包含结尾的空行）
+
+    // 请求：method uri version  响应：version code reason
+    Span startLine[3] = {};
+    Span startLineAll = {};
+    size_t startLineNext = 0;   // 请求行/响应行之后（包含换行符）的位置
+    int statusCode = 0;
+    HeaderSpan headers[MaxHeaders];
+    size_t headerCount = 0;
+
+public:
+    HttpParser(bool isResponse = false)
+    {
+        reset(isResponse);
+    }
+
+    // 开始解析下一个消息
+    void reset(bool isResponse)
+    {
+        this->isResponse = isResponse;
+        this->state = State::StartLine;
+        this->base = nullptr;
+        this->pos = 0;
+        this->scanned = 0;
+        this->lineHasColon = false;
+        this->colonOffset = 0;
+        this->headerLen = 0;
+        this->statusCode = 0;
+        this->headerCount = 0;
+        for(auto &span : startLine)
+            span = {0, 0};
+        this->startLineAll = {0, 0};
+        this->startLineNext = 0;
+    }
+
+    // 在buf上继续解析，buf必须从当前消息的起始位置开始
+    Result parse(const char *buf, size_t len)
+    {
+        base = buf;
+        while(state == State::StartLine || state == State::Headers)
+        {
+            // 找行尾的同时记下第一个冒号，头部行只需要扫描一遍
+            const char *colon = nullptr;
+            const char *lineEnd = FindLineEnd(buf + scanned, len - scanned, lineHasColon ? nullptr : &colon);
+            if(colon)
+            {
+                lineHasColon = true;
+                colonOffset = colon - buf;
+            }
+            if(!lineEnd)
+            {
+                scanned = len;
+                if(len > MaxHeaderSize)
+                    return fail();
+                return Result::NeedMore;
+            }
+            size_t next = lineEnd - buf + 1;
+            if(next > MaxHeaderSize)
+                return fail();
+
+            // 行尾的\r不算在内容里
+            size_t end = next - 1;
+            if(end > pos && buf[end - 1] == '\r')
+                --end;
+
+            bool hasColon = lineHasColon;
+            lineHasColon = false;
+            bool ok = (state == State::StartLine ? parseStartLine(buf, pos, end, next)
+                : parseHeaderLine(buf, pos, end, next, hasColon ? colonOffset : end));
+            if(!ok)
+                return fail();
+            pos = scanned = next;
+            if(state == State::Done)
+                headerLen = next;
+        }
+        return state == State::Done ? Result::Complete : Result::Error;
+    }
+
+    bool isComplete() const { return state == State::Done; }
+    // 头部长度（包含结尾的空行），头部完整之前为0
+    size_t getHeaderLength() const { return headerLen; }
+
+    // 请求行/响应行整行（不含\r\n）
+    std::string_view getStartLine() const { return view(startLineAll); }
+    // 请求行/响应行之后的位置，即第一个头部的起始位置
+    size_t getStartLineEnd() const { return startLineNext; }
+    // 请求行
+    std::string_view getMethod() const { return isResponse ? std::string_view() : view(startLine[0]); }
+    std::string_view getUri() const { return isResponse ? std::string_view() : view(startLine[1]); }
+    std::string_view getVersion() const { return view(isResponse ? startLine[0] : startLine[2]); }
+    // 响应行
+    int getStatusCode() const { return statusCode; }
+    std::string_view getReason() const { return isResponse ? view(startLine[2]) : std::string_view(); }
+
+    // 按收到的顺序取出各个头部
+    size_t getHeaderCount() const { return headerCount; }
+    std::string_view getHeaderName(size_t i) const { return view(headers[i].name); }
+    std::string_view getHeaderValue(size_t i) const { return view(headers[i].value); }
+    // 头部所在的整行，包含行尾的换行符
+    std::string_view getHeaderLine(size_t i) const { return view(headers[i].line); }
+
+    // 按名称查找第一个同名头部（不区分大小写），找不到时返回false
+    bool findHeader(std::string_view name, std::string_view &value) const
+    {
+        for(size_t i = 0; i < headerCount; ++i)
+        {
+            if(headers[i].name.length == name.size()
+                && strncasecmp(base + headers[i].name.offset, name.data(), name.size()) == 0)
+            {
+                value = view(headers[i].value);
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    Result fail()
+    {
+        state = State::Failed;
+        return Result::Error;
+    }
+
+    std::string_view view(const Span &span) const
+    {
+        if(!base)
+            return std::string_view();
+        return std::string_view(base + span.offset, span.length);
+    }
+
+    static Span makeSpan(size_t begin, size_t end)
+    {
+        return {(uint32_t)begin, (uint32_t)(end - begin)};
+    }
+
+    // 请求行：method SP uri SP version
+    // 响应行：version SP code [SP reason]，reason中可以有空格，也可以省略
+    // next为下一行的起始位置
+    bool parseStartLine(const char *buf, size_t begin, size_t end, size_t next)
+    {
+        // 消息之前的空行忽略掉
+        if(begin == end)
+            return true;
+
+        const char *sp1 = (const char *)memchr(buf + begin, ' ', end - begin);
+        if(!sp1 || sp1 == buf + begin)
+            return false;
+        size_t first = sp1 - buf;
+        const char *sp2 = (const char *)memchr(sp1 + 1, ' ', buf + end - sp1 - 1);
+        size_t second = sp2 ? sp2 - buf : end;
+
+        startLine[0] = makeSpan(begin, first);
+        startLine[1] = makeSpan(first + 1, second);
+        startLine[2] = makeSpan(second < end ? second + 1 : end, end);
+        startLineAll = makeSpan(begin, end);
+        startLineNext = next;
+
+        if(isResponse)
+        {
+            if(startLine[1].length != 3)
+                return false;
+            statusCode = 0;
+            for(size_t i = first + 1; i < second; ++i)
+            {
+                if(buf[i] < '0' || buf[i] > '9')
+                    return false;
+                statusCode = statusCode * 10 + (buf[i] - '0');
+            }
+        }
+        else if(!sp2 || startLine[1].length == 0 || startLine[2].length == 0)
+            return false;
+
+        state = State::Headers;
+        return true;
+    }
+
+    // 头部行：name ":" OWS value OWS，空行表示头部结束
+    // colonPos为行内第一个冒号的位置，没有冒号时等于end
+    bool parseHeaderLine(const char *buf, size_t begin, size_t end, size_t next, size_t colonPos)
+    {
+        if(begin == end)
+        {
+            state = State::Done;
+            return true;
+        }
+
+        // 没有冒号的行（比如已废弃的折行）直接忽略
+        if(colonPos >= end || colonPos == begin)
+            return true;
+        if(headerCount >= MaxHeaders)
+            return false;
+
+        size_t nameEnd = colonPos;
+        size_t valueBegin = nameEnd + 1;
+        size_t valueEnd = end;
+        while(valueBegin < valueEnd && (buf[valueBegin] == ' ' || buf[valueBegin] == '\t'))
+            ++valueBegin;
+        while(valueEnd > valueBegin && (buf[valueEnd - 1] == ' ' || buf[valueEnd - 1] == '\t'))
+            --valueEnd;
+
+        headers[headerCount++] = {makeSpan(begin, nameEnd), makeSpan(valueBegin, valueEnd), makeSpan(begin, next)};
+        return true;
+    }
+};
+
+#endif
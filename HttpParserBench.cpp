@@ -0,0 +1,185 @@
+/*
+ * 请求头解析速度对比：原来的parse()（substr + istringstream + SplitStrWithPattern，头部存入std::map）
+ * 与现在的HttpParser
+ *
+ * 用浏览器的请求头作为数据，分别测：
+ * 1. 原来的HttpRequestPacket::parse()（原样复制在下面的OldRequestPacket中）
+ * 2. HttpParser原地解析（只记录偏移，不拷贝），再取出Host，对应HttpFramer判定消息边界时的用法
+ * 3. 现在的HttpRequestPacket::parse()：HttpParser解析后把各字段拷贝到packet中
+ * 输出每秒解析的请求数和相当的字节数。
+ *
+ * 独立的程序，不参与代理服务器的构建，在仓库根目录下：
+ * make parserbench && ./parserbench [轮数]
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <map>
+#include <sstream>
+#include <sys/time.h>
+#include "HttpParser.h"
+#include "HttpRequestPacket.h"
+#include "Utils.h"
+
+static const char RequestHeader[] =
+    "GET /static/js/main.7c3f2a91.chunk.js?v=20241017 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"128\", \"Not;A=Brand\";v=\"24\", \"Google Chrome\";v=\"128\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/128.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Accept: */*\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: script\r\n"
+    "Referer: https://www.example.com/products/list?page=2&sort=price\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Cookie: _ga=GA1.2.1234567890.1700000000; sessionid=8f14e45fceea167a5a36dedd4bea2543; theme=dark\r\n"
+    "If-None-Match: \"5f3a9c2e-1b7d4\"\r\n"
+    "\r\n";
+
+// 原来的请求解析，除了去掉与解析无关的成员函数外与改动之前相同
+struct OldRequestPacket
+{
+    std::string rawData;
+    std::string requestLine;
+    std::string method;
+    std::string uri;
+    std::string version;
+    std::map<std::string, std::string> headers;
+    std::string bodyData;
+    std::string host;
+    int port;
+
+    OldRequestPacket(const std::string &data)
+        :rawData(data)
+    {
+        parse();
+    }
+
+    void parse()
+    {
+        auto reqlineHeaderSplit = rawData.find("\r\n");         // 第一个\r\n切分reqline和header
+        auto headerDataSplit = rawData.find("\r\n\r\n");        // 第一个\r\n\r\n切分header和body
+
+        // 切分请求行
+        requestLine = rawData.substr(0, reqlineHeaderSplit);
+        auto res = SplitStrWithPattern(requestLine, " ");       // 根据空格切请求行
+        this->method = res[0];
+        this->uri = res[1];
+        this->version = res[2];
+
+        // 切分请求头
+        std::string requestHeader = rawData.substr(reqlineHeaderSplit + 2, headerDataSplit - reqlineHeaderSplit - 2);
+        this->headers.clear();
+
+        std::istringstream sin(requestHeader);
+        std::string headerLine;
+        while (getline(sin, headerLine))
+        {
+            if(headerLine.empty())
+                break;
+            // 去掉换行符
+            if(headerLine.back() == '\n')
+                headerLine.pop_back();
+            if(headerLine.back() == '\r')
+                headerLine.pop_back();
+            // 切分行
+            auto res = SplitStrWithPattern(headerLine, ": ");
+            std::string key = res[0];
+            std::string value = res[1];
+            this->headers[key] = value;
+        }
+
+        // 如果Host含有端口号，切开，否则默认80
+        std::string host = this->headers["Host"];
+        size_t colonPos = host.rfind(':');
+        if (colonPos != std::string::npos)
+        {
+            this->host = host.substr(0, colonPos);
+            this->port = std::stoi(host.substr(colonPos + 1));
+        }
+        else
+        {
+            this->host = host;
+            this->port = 80;
+        }
+        // 剩余的为body
+        this->bodyData = rawData.substr(headerDataSplit + 4);
+    }
+};
+
+static long NowUs()
+{
+    timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000L + now.tv_usec;
+}
+
+// 各种解析方式，返回Host的长度，防止循环被优化掉
+static size_t ParseOld(const std::string &data)
+{
+    OldRequestPacket packet(data);
+    return packet.host.size();
+}
+
+static size_t ParseInPlace(const std::string &data)
+{
+    HttpParser parser(false);
+    if(parser.parse(data.data(), data.size()) != HttpParser::Result::Complete)
+        return 0;
+    std::string_view host;
+    parser.findHeader("Host", host);
+    return host.size();
+}
+
+static size_t ParsePacket(const std::string &data)
+{
+    HttpRequestPacket packet(data);
+    return packet.host.size();
+}
+
+// 返回每秒解析的请求数（百万）
+static double Measure(size_t (*parse)(const std::string &), const std::string &data, int rounds)
+{
+    size_t check = 0;
+    long start = NowUs();
+    for(int i = 0; i < rounds; ++i)
+        check += parse(data);
+    long elapsed = NowUs() - start;
+    if(check != (size_t)rounds * strlen("www.example.com"))
+        printf("unexpected result\n");
+    return elapsed > 0 ? (double)rounds / elapsed : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = (argc > 1) ? atoi(argv[1]) : 500000;
+    std::string data = RequestHeader;
+
+    struct
+    {
+        const char *name;
+        size_t (*parse)(const std::string &);
+    } cases[] = {
+        {"old parse()", ParseOld},
+        {"HttpParser", ParseInPlace},
+        {"new parse()", ParsePacket},
+    };
+
+    printf("%zu-byte request header x %d rounds\n", data.size(), rounds);
+    printf("%12s %14s %10s %8s\n", "", "Mrequests/s", "GB/s", "speedup");
+    double oldRate = 0;
+    for(auto &item : cases)
+    {
+        double rate = Measure(item.parse, data, rounds);
+        if(oldRate == 0)
+            oldRate = rate;
+        printf("%12s %14.2f %10.2f %7.1fx\n", item.name, rate, rate * data.size() / 1000, rate / oldRate);
+    }
+    return 0;
+}
@@ -2,10 +2,13 @@
 #define HTTP_REQUEST_PACKET_BY_YQ
 
 #include <string>
-#include <map>
-#include <sstream>
+#include <vector>
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
 #include <sys/socket.h>
+#include "HttpParser.h"
+#include "HttpHeaders.h"
 #include "Utils.h"
 
 /* http请求
@@ -24,11 +27,21 @@ struct HttpRequestPacket
     std::string method;
     std::string uri;
     std::string version;
-    std::map<std::string, std::string> headers;
+    HttpHeaders headers;
     std::string bodyData;
     std::string host;
     int port;
 
+    // 解析时各部分在rawData中的位置。发送时没有被修改过的部分直接使用rawData中的原始字节，
+    // 只有修改过的部分重新拼接，所以只改写了Host等个别头部时不需要重新生成整个消息
+    RawSpan rawMethod;
+    RawSpan rawUri;
+    RawSpan rawVersion;
+    RawSpan rawStartLine;       // 请求行整行（包含换行符），length为0表示没有可用的原始数据
+    RawSpan rawBlankLine;       // 头部结尾的空行
+    RawSpan rawBody;
+    size_t rawHeaderCount = 0;
+
     HttpRequestPacket(const std::string &data, bool autoParse = true)
         :rawData(data)
     {
@@ -37,47 +50,33 @@ struct HttpRequestPacket
     }
 
     // 将rawData内容拆到各个字段
+    // 头部由HttpParser在rawData上原地解析，rawData中头部不完整时只取出已经收到的部分
     void parse()
     {
-        auto reqlineHeaderSplit = rawData.find("\r\n");         // 第一个\r\n切分reqline和header
-        auto headerDataSplit = rawData.find("\r\n\r\n");        // 第一个\r\n\r\n切分header和body
-
-        // 切分请求行
-        requestLine = rawData.substr(0, reqlineHeaderSplit);
-        auto res = SplitStrWithPattern(requestLine, " ");       // 根据空格切请求行
-        this->method = res[0];
-        this->uri = res[1];
-        this->version = res[2];
-
-        // 切分请求头
-        std::string requestHeader = rawData.substr(reqlineHeaderSplit + 2, headerDataSplit - reqlineHeaderSplit - 2);
-        this->headers.clear();
+        HttpParser parser(false);
+        parser.parse(rawData.data(), rawData.size());
+
+        // 请求行
+        requestLine = std::string(parser.getStartLine());
+        this->method = std::string(parser.getMethod());
+        this->uri = std::string(parser.getUri());
+        this->version = std::string(parser.getVersion());
 
-        std::istringstream sin(requestHeader);
-        std::string headerLine;
-        while (getline(sin, headerLine))
+        // 请求头
+        this->headers.clear();
+        for(size_t i = 0; i < parser.getHeaderCount(); ++i)
         {
-            if(headerLine.empty())
-                break;
-            // 去掉换行符
-            if(headerLine.back() == '\n')
-                headerLine.pop_back();
-            if(headerLine.back() == '\r')
-                headerLine.pop_back();
-            // 切分行
-            auto res = SplitStrWithPattern(headerLine, ": ");
-            std::string key = res[0];
-            std::string value = res[1];
-            this->headers[key] = value;
+            this->headers.add(parser.getHeaderName(i), parser.getHeaderValue(i));
+            this->headers.setRaw(rawData, parser.getHeaderLine(i), parser.getHeaderName(i), parser.getHeaderValue(i));
         }
 
         // 如果Host含有端口号，切开，否则默认80
-        std::string host = this->headers["Host"];
+        std::string host = this->headers.get(HeaderId::Host);
         size_t colonPos = host.rfind(':');
         if (colonPos != std::string::npos)
         {
             this->host = host.substr(0, colonPos);
-            this->port = std::stoi(host.substr(colonPos + 1));
+            this->port = atoi(host.c_str() + colonPos + 1);
         }
         else
         {
@@ -85,42 +84,136 @@ struct HttpRequestPacket
             this->port = 80;
         }
         // 剩余的为body
-        this->bodyData = rawData.substr(headerDataSplit + 4);
+        size_t headerLen = parser.getHeaderLength();
+        this->bodyData = (headerLen > 0 ? rawData.substr(headerLen) : std::string());
+
+        // 记下各部分的原始位置，头部不完整时不使用原始数据
+        this->rawMethod = RawSpan(rawData, parser.getMethod());
+        this->rawUri = RawSpan(rawData, parser.getUri());
+        this->rawVersion = RawSpan(rawData, parser.getVersion());
+        this->rawHeaderCount = headers.size();
+        if(headerLen > 0)
+        {
+            size_t lineBegin = parser.getStartLine().data() - rawData.data();
+            size_t lastLineEnd = (headers.empty() ? parser.getStartLineEnd()
+                : headers.at(headers.size() - 1).rawLine.offset + headers.at(headers.size() - 1).rawLine.length);
+            this->rawStartLine = RawSpan(lineBegin, parser.getStartLineEnd() - lineBegin);
+            this->rawBlankLine = RawSpan(lastLineEnd, headerLen - lastLineEnd);
+            this->rawBody = RawSpan(headerLen, rawData.size() - headerLen);
+        }
+        else
+        {
+            forgetRaw();
+            this->rawBody = RawSpan();
+        }
+    }
+
+    // 与解析时相比是否有修改
+    bool isDirty()
+    {
+        return !startLineUnchanged() || headers.isModified(rawData, rawHeaderCount)
+            || !rawBody.same(rawData, bodyData);
+    }
+
+    // 不再使用rawData中的原始字节（rawData被重新生成时），之后全部按字段内容拼接
+    void forgetRaw()
+    {
+        rawStartLine = RawSpan();
+        rawBlankLine = RawSpan();
+        headers.forgetRaw();
+    }
+
+    // 这个请求之后连接能否继续使用（HTTP/1.1默认保持连接，HTTP/1.0默认关闭）
+    bool isKeepAlive()
+    {
+        auto it = headers.find(HeaderId::Connection);
+        if(it != headers.end())
+        {
+            if(strcasestr(it->value.c_str(), "close"))
+                return false;
+            if(strcasestr(it->value.c_str(), "keep-alive"))
+                return true;
+        }
+        return version != "HTTP/1.0";
     }
 
     // 将各字段重新拼接成rawData
     void updateRawData()
     {
-        std::ostringstream rawDataBuilder;
-        // 构造reqline
-        rawDataBuilder << method << " " << uri << " " << version << "\r\n";
-        // 构造header
-        for(auto &item : headers)
-            rawDataBuilder << item.first << ": " << item.second << "\r\n";
-        // 构造body
-        rawDataBuilder << "\r\n" << bodyData;
-        this->rawData = rawDataBuilder.str();
+        std::string data;
+        appendTo(data);
+        this->rawData.swap(data);
+        forgetRaw();
+    }
+
+    // 将各字段拼接后追加到out末尾
+    void appendTo(std::string &out)
+    {
+        std::vector<iovec> iov;
+        fillIovec(iov);
+        size_t len = 0;
+        for(auto &item : iov)
+            len += item.iov_len;
+        out.reserve(out.size() + len);
+        for(auto &item : iov)
+            out.append((const char *)item.iov_base, item.iov_len);
     }
 
     // 发送请求
+    // isModified为true时按各字段发送：没有修改过的部分直接指向rawData中的原始字节，修改过的部分单独成段，
+    // 用sendmsg一次发出，不需要把整个消息（特别是很大的body）重新拷贝拼接；否则直接发送rawData
     bool sendTo(int targetSocket, bool isModified = true)
     {
-        if(isModified)
-            updateRawData();
-        
-        // 如果内容较长一次没发完，分几次发
-        int bytesSent = 0;
-        int sendLen = (int)rawData.size();
-        const char *data = rawData.c_str();
-        while (bytesSent < sendLen)
+        if(!isModified)
         {
-            int bytesWritten = send(targetSocket, data + bytesSent, sendLen - bytesSent, 0);
-            if (bytesWritten <= 0)      // 出现问题
-                return false;
-            bytesSent += bytesWritten;
+            iovec whole = {(void *)rawData.data(), rawData.size()};
+            return SendIovec(targetSocket, &whole, 1);
         }
-        return true;
+
+        std::vector<iovec> iov;
+        fillIovec(iov);
+        return SendIovec(targetSocket, iov.data(), iov.size());
+    }
+
+private:
+    bool startLineUnchanged()
+    {
+        return rawStartLine.length > 0 && rawMethod.same(rawData, method) && rawUri.same(rawData, uri)
+            && rawVersion.same(rawData, version);
+    }
+
+    // 生成整个消息的iovec，相邻的原始字节会合并成一段，完全没有修改时就是rawData一整段
+    // 请求行的各部分都是已有的字符串，不需要临时生成内容
+    void fillIovec(std::vector<iovec> &iov)
+    {
+        iov.reserve(8 + headers.size() * 4);
+        if(startLineUnchanged())
+            AppendIovec(iov, rawStartLine.data(rawData), rawStartLine.length);
+        else
+        {
+            AppendIovec(iov, method.data(), method.size());
+            AppendIovec(iov, " ", 1);
+            AppendIovec(iov, uri.data(), uri.size());
+            AppendIovec(iov, " ", 1);
+            AppendIovec(iov, version.data(), version.size());
+            AppendIovec(iov, "\r\n", 2);
+        }
+        headers.fillIovec(rawData, iov);
+        if(rawBlankLine.length > 0)
+            AppendIovec(iov, rawBlankLine.data(rawData), rawBlankLine.length);
+        else
+            AppendIovec(iov, "\r\n", 2);
+        // body没有修改时使用rawData中的原始字节，这样可以和前面的原始头部合并成一段
+        if(rawBody.same(rawData, bodyData))
+            AppendIovec(iov, rawBody.data(rawData), rawBody.length);
+        else
+            AppendIovec(iov, bodyData.data(), bodyData.size());
     }
 };
 
+// 数据包布局标记：包含这个头文件编译的插件会导出这个符号，值是编译时HttpRequestPacket的大小，
+// 加载没有导出GetPluginInfo的第1版插件时用它确认插件是按当前的数据包定义编译的（见PluginApi.h）
+// weak让代理服务器和插件的多个源文件都可以包含这个头文件
+extern "C" __attribute__((weak, visibility("default"))) const unsigned int PluginRequestPacketLayout = sizeof(HttpRequestPacket);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,52 @@
+/*
+ * 已转发、等待响应的请求
+ *
+ * 客户端可以不等响应就在同一个连接上连续发送多个请求（HTTP/1.1流水线），后端按请求的顺序返回响应。
+ * 两种引擎都为每个连接按顺序记下已转发的请求，收到响应时与队头的请求配对：
+ * HEAD请求的响应没有body、插件按路径筛选响应、重定向时改写Location用的原Host、是否存入缓存、日志中的请求耗时都由此得到。
+ * 同一个连接上等待响应的请求超过MaxPipelineDepth个时，暂停处理后面的请求，等前面的响应发出后再继续。
+*/
+
+#ifndef PENDING_REQUEST_BY_YQ
+#define PENDING_REQUEST_BY_YQ
+
+#include <string>
+#include <sys/time.h>
+#include "HttpRequestPacket.h"
+#include "ResponseCache.h"
+
+// 每个连接最多同时等待响应的请求数
+const size_t MaxPipelineDepth = 16;
+
+// 请求格式错误（包括长度有歧义、可能造成请求走私的请求）时回复客户端，然后关闭连接
+// 前面还有请求在等响应时不能插在它们前面，直接关闭
+const char BadRequestResponse[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+struct PendingRequest
+{
+    bool head = false;              // HEAD请求，响应没有body
+    bool acceptChunked = true;      // 客户端能接收chunked编码的响应（HTTP/1.1），插件改写body时使用
+    std::string requestLine;        // 请求行，日志中使用
+    std::string uri;                // 请求的URI，插件按路径筛选响应时使用
+    std::string clientHost;         // 改写前的Host，重定向时把Location改回来
+    CacheRequest cache;             // 与缓存有关的信息
+    timeval startTime;              // 转发的时间
+
+    // 在改写Host之前调用
+    PendingRequest(const HttpRequestPacket &packet, CacheRequest &&cache)
+        :head(packet.method == "HEAD"), acceptChunked(packet.version != "HTTP/1.0"), requestLine(packet.requestLine),
+        uri(packet.uri), clientHost(packet.headers.get(HeaderId::Host)), cache(std::move(cache))
+    {
+        gettimeofday(&startTime, NULL);
+    }
+
+    // 从转发到现在经过的毫秒数
+    long elapsedMs() const
+    {
+        timeval now;
+        gettimeofday(&now, NULL);
+        return (now.tv_sec - startTime.tv_sec) * 1000 + (now.tv_usec - startTime.tv_usec) / 1000;
+    }
+};
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * 插件接口（ABI）
+ *
+ * 每个插件是plugins目录中的一个so，导出以下extern "C"函数（除Init外都可以不导出）：
+ *
+ *     bool Init(const char *configFile);                      加载时调用，返回false表示不加载
+ *     void Shutdown();                                        卸载时调用
+ *     bool ClientRequest(HttpRequestPacket *packet);          转发请求之前调用，返回false时不再调用后面的插件
+ *     bool ServerResponse(HttpResponsePacket *packet);        转发响应之前调用，返回false时不再调用后面的插件
+ *     bool WantRequestBody(HttpRequestPacket *packet);        收到请求头时调用，返回是否需要完整的请求body
+ *     bool WantResponseBody(HttpResponsePacket *packet);      收到响应头时调用，返回是否需要完整的响应body
+ *     const PluginInfo* GetPluginInfo();                      声明插件的接口版本和需要处理的内容
+ *     void OnBodyChunk(void **context, const char *data, size_t length, std::string *out, bool last);
+ *                                                             流式过滤响应body，见下面的说明
+ *     void ObserveRequest(const HttpRequestPacket *packet);   异步观察插件，见下面的说明
+ *     void ObserveResponse(const HttpResponsePacket *packet, const char *uri, long elapsedMs);
+ *
+ * 第1版插件（没有导出GetPluginInfo）只导出Init/ClientRequest/ServerResponse等函数，处理所有请求和响应，
+ * 没有导出WantRequestBody/WantResponseBody时视为总是需要完整的body。HttpRequestPacket/HttpResponsePacket的内存布局
+ * 和最初的版本已经不同，两个头文件因此会在插件中留下布局标记（PluginRequestPacketLayout/PluginResponsePacketLayout，
+ * 值是编译时数据包的大小）：只有带着与代理服务器一致的标记的第1版插件才会加载，按旧的头文件编译、没有标记的不加载
+ * （也不调用Init），重新编译即可，源码不需要修改。
+ *
+ * 第2版插件在PluginInfo中还要填上编译时两个数据包类的大小，版本与PLUGIN_API_VERSION或者大小与代理服务器不一致时同样不加载。
+ * 插件在PluginInfo中声明需要什么，代理服务器据此决定是否调用插件、是否需要收齐body：
+ *   - capabilities：只声明了HEADERS的插件只拿到头部（流式转发时bodyData为空），不会让body改为完整接收；
+ *     声明了BODY时收齐body后再调用，这时如果还导出了WantXxxBody，由它进一步决定，没有导出时视为总是需要
+ *   - paths：只处理URI以这些前缀开头的请求以及它们的响应
+ *   - contentTypes：只处理Content-Type以这些前缀开头的响应
+ * 没有插件关心的请求/响应不调用任何插件，仍然可以流式转发和零拷贝。
+ *
+ * 声明了PLUGIN_RESPONSE_BODY_FILTER的插件导出OnBodyChunk，不需要把整个body收进内存就能改写响应body：
+ *   - data/length是收到的一段body，已经去掉了chunked分块；过滤的结果追加到out，可以比输入长或短，也可以暂时不输出
+ *   - last为true表示body结束（这时length可能为0），插件应当输出剩余的内容
+ *   - *context在第一次调用时为NULL，插件可以在其中保存跨段的状态（比如跨段的待匹配内容），last时负责释放
+ * 多个过滤插件按优先级串联。代理服务器自动处理长度：流式转发时去掉Content-Length，按chunked发给客户端；
+ * 客户端是HTTP/1.0时，或者响应本来就需要完整接收时，把整个body作为一段（last为true）交给插件，再重新设置Content-Length。
+ *
+ * 声明了PLUGIN_ASYNC_OBSERVER的插件导出ObserveRequest/ObserveResponse，只读取、不修改请求和响应（日志、统计、镜像等）：
+ *   - 在后台线程中调用，参数是转发出去的请求/响应的只读快照（流式转发时没有body），调用结束后不能再使用
+ *   - ObserveResponse的uri是对应请求的URI，elapsedMs是从转发请求到收到响应头的毫秒数
+ *   - 调用时机不确定，后台线程不止一个时不保证顺序；后台处理不过来时快照会被丢弃
+ *   - 可能在多个线程中同时调用，插件自己保证线程安全
+ * paths和contentTypes同样适用。
+ *
+ * 插件可以热更新（见Plugins.h）：新版本先Init，换上之后旧版本在最后一个使用它的请求结束时才Shutdown，
+ * 两个版本会短暂地同时存在；Shutdown可能在任意一个线程中调用。
+*/
+
+#ifndef PLUGIN_API_BY_YQ
+#define PLUGIN_API_BY_YQ
+
+// 当前的接口版本
+#define PLUGIN_API_VERSION 2
+
+// 插件需要处理的内容，可以组合使用
+enum PluginCapability : unsigned int
+{
+    PLUGIN_REQUEST_HEADERS = 1 << 0,        // 查看/修改请求头
+    PLUGIN_REQUEST_BODY = 1 << 1,           // 查看/修改完整的请求body
+    PLUGIN_RESPONSE_HEADERS = 1 << 2,       // 查看/修改响应头
+    PLUGIN_RESPONSE_BODY = 1 << 3,          // 查看/修改完整的响应body
+    PLUGIN_RESPONSE_BODY_FILTER = 1 << 4,   // 用OnBodyChunk逐段改写响应body
+    PLUGIN_ASYNC_OBSERVER = 1 << 5,         // 在后台线程中只读观察请求/响应
+};
+
+struct PluginInfo
+{
+    int apiVersion;                 // 填PLUGIN_API_VERSION
+    unsigned int requestSize;       // 填sizeof(HttpRequestPacket)
+    unsigned int responseSize;      // 填sizeof(HttpResponsePacket)
+    const char *name;               // 插件名，日志中使用
+    unsigned int capabilities;      // PluginCapability的组合
+    const char *paths;              // 逗号分隔的URI前缀，NULL或空字符串表示所有请求
+    const char *contentTypes;       // 逗号分隔的响应Content-Type前缀，NULL或空字符串表示所有响应
+};
+
+#endif
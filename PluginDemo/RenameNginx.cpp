@@ -2,18 +2,26 @@
 #include <string>
 #include "../HttpRequestPacket.h"
 #include "../HttpResponsePacket.h"
+#include "../PluginApi.h"
 using namespace std;
 
-// string替换
-std::string& ReplaceStr(std::string& str, const std::string& oldValue, const std::string& newValue) 
+const string OldText = "nginx news";
+const string NewText = "Proxy Server has Modified this page!";
+
+// 插件信息：修改请求头，逐段改写html响应的body，其他响应不会调用插件，可以直接流式转发
+static const PluginInfo pluginInfo = {
+    PLUGIN_API_VERSION,
+    sizeof(HttpRequestPacket),
+    sizeof(HttpResponsePacket),
+    "RenameNginx",
+    PLUGIN_REQUEST_HEADERS | PLUGIN_RESPONSE_HEADERS | PLUGIN_RESPONSE_BODY_FILTER,
+    NULL,
+    "text/html",
+};
+
+extern "C" const PluginInfo* GetPluginInfo()
 {
-    for (std::string::size_type pos(0); pos != std::string::npos; pos += newValue.length()) {
-        if ((pos = str.find(oldValue, pos)) != std::string::npos)
-            str.replace(pos, oldValue.length(), newValue);
-        else
-            break;
-    }
-    return str;
+    return &pluginInfo;
 }
 
 // 插件加载时调用
@@ -39,16 +47,36 @@ extern "C" bool ClientRequest(HttpRequestPacket *packet)
     return true;
 }
 
-// 有服务端响应到达时调用
+// 有html响应到达时调用，body由OnBodyChunk处理
 extern "C" bool ServerResponse(HttpResponsePacket *packet)
 {
     cout << "[INFO][RenameNginx] Get server response: " << packet->responseLine << endl;
+    return true;
+}
+
+// html响应的body每到达一段调用一次，把其中的"nginx news"替换掉
+// 要找的内容可能被分在两段中，每段末尾不足以判断的几个字节留在context中，和下一段一起处理
+extern "C" void OnBodyChunk(void **context, const char *data, size_t length, std::string *out, bool last)
+{
+    if (*context == NULL)
+        *context = new string();
+    string &pending = *(string *)*context;
+    pending.append(data, length);
 
-    // 如果响应是200，且Content-Type是html，则修改其中内容
-    if(packet->code == 200 && packet->headers["Content-Type"].find("text/html") != std::string::npos)
+    size_t pos = 0;
+    for (size_t found = pending.find(OldText); found != string::npos; found = pending.find(OldText, pos))
     {
-        ReplaceStr(packet->bodyData, "nginx news", "Proxy Server has Modified this page!");
-        cout << "[INFO][RenameNginx] Replace \"nginx news\" -> \"Proxy Server has Modified this page!\"" << endl;
+        out->append(pending, pos, found - pos);
+        out->append(NewText);
+        pos = found + OldText.size();
     }
-    return true;
-}
\ No newline at end of file
+    size_t keep = last ? 0 : min(pending.size() - pos, OldText.size() - 1);
+    out->append(pending, pos, pending.size() - pos - keep);
+    pending.erase(0, pending.size() - keep);
+
+    if (last)
+    {
+        delete (string *)*context;
+        *context = NULL;
+    }
+}
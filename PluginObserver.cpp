@@ -0,0 +1,94 @@
+#include "PluginObserver.h"
+#include "Stats.h"
+using namespace std;
+
+PluginObserver pluginObserver;
+
+// 后台线程函数
+void* funcInPluginObserver(void* data)
+{
+    ((PluginObserver *)data)->run();
+    return NULL;
+}
+
+bool PluginObserver::start(int threads, size_t maxQueued, Logger::LogLevel logLevel)
+{
+    locker.lock();
+    // 已经启动时（例如重新加载配置）不再修改，工作线程正在使用这些设置
+    if(started)
+    {
+        locker.unlock();
+        return true;
+    }
+    logger.setLogLevel(logLevel);
+    logger.setPrefix("PluginObserver");
+    this->maxQueued = maxQueued;
+    stopping = false;
+    for(int i=0; i<threads; ++i)
+    {
+        pthread_t threadId;
+        if(pthread_create(&threadId, NULL, funcInPluginObserver, this) != 0)
+            break;
+        pthread_detach(threadId);
+        ++runningThreads;
+    }
+    int startedThreads = runningThreads;
+    started = (startedThreads > 0);
+    locker.unlock();
+
+    if(startedThreads == 0)
+        logger.warn("Fail to start observer threads, async observer plugins will not be called.");
+    else
+        logger.info("%d observer threads started.", startedThreads);
+    return startedThreads > 0;
+}
+
+bool PluginObserver::submit(function<void()> task)
+{
+    locker.lock();
+    if(!started || stopping || tasks.size() >= maxQueued)
+    {
+        locker.unlock();
+        ++proxyStats.observerDropped;
+        return false;
+    }
+    tasks.push_back(std::move(task));
+    queueCond.notifyOne();
+    locker.unlock();
+    ++proxyStats.observerSubmitted;
+    return true;
+}
+
+void PluginObserver::stop()
+{
+    locker.lock();
+    stopping = true;
+    queueCond.notifyAll();
+    while(runningThreads > 0)
+        exitCond.wait(locker, 1);
+    started = false;
+    locker.unlock();
+}
+
+void PluginObserver::run()
+{
+    locker.lock();
+    while(true)
+    {
+        while(tasks.empty() && !stopping)
+            queueCond.wait(locker, 60);
+        // 停止时也要先把已经提交的任务执行完
+        if(tasks.empty())
+            break;
+        function<void()> task = std::move(tasks.front());
+        tasks.pop_front();
+        locker.unlock();
+
+        task();
+
+        locker.lock();
+    }
+    --runningThreads;
+    exitCond.notifyAll();
+    locker.unlock();
+}
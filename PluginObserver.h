@@ -0,0 +1,56 @@
+/*
+ * 异步观察插件的后台执行器
+ *
+ * 记录日志、统计分析、流量镜像这类插件只读取请求/响应，不需要在转发之前完成。
+ * 声明了PLUGIN_ASYNC_OBSERVER的插件不在连接的线程中调用：请求/响应转发出去时复制一份只读的快照，
+ * 用shared_ptr交给这里的后台线程，由它们依次调用各个观察插件，同一份快照被所有插件共用，
+ * 最后一个插件处理完后自动释放。转发本身不等待插件，插件再慢也不会增加客户端的延迟。
+ *
+ * 队列中等待的任务超过maxQueued个时丢弃新的任务（计入统计信息），插件处理不过来时不会占用无限的内存。
+ * 卸载插件之前调用stop()，等已经提交的任务全部执行完、后台线程退出后才能dlclose。
+*/
+
+#ifndef PLUGIN_OBSERVER_BY_YQ
+#define PLUGIN_OBSERVER_BY_YQ
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <pthread.h>
+#include "ThreadPool/mutex.h"
+#include "ThreadPool/condition_var.h"
+#include "Logger.h"
+
+class PluginObserver
+{
+private:
+    // 线程函数设友元以便访问私有成员
+    friend void* funcInPluginObserver(void* data);
+
+    std::deque<std::function<void()>> tasks;
+    size_t maxQueued = 0;
+    int runningThreads = 0;
+    std::atomic<bool> started{false};     // 重新加载插件时可能在其他线程中启动
+    bool stopping = false;
+    Mutex locker;
+    ConditionVar queueCond;
+    ConditionVar exitCond;      // stop时等待线程退出
+    Logger logger;
+
+public:
+    // 启动threads个后台线程
+    bool start(int threads, size_t maxQueued, Logger::LogLevel logLevel);
+    // 提交一个任务，没有启动或队列已满时返回false
+    bool submit(std::function<void()> task);
+    // 执行完已经提交的任务后停止所有后台线程
+    void stop();
+    bool isStarted() const { return started; }
+
+private:
+    void run();
+};
+
+// 全局的观察插件执行器
+extern PluginObserver pluginObserver;
+
+#endif
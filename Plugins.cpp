@@ -4,11 +4,25 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <strings.h>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "HttpRequestPacket.h"
 #include "HttpResponsePacket.h"
 #include "Logger.h"
+#include "Utils.h"
+#include "Config.h"
+#include "PluginApi.h"
+#include "HttpFramer.h"
+#include "PluginObserver.h"
+#include "ThreadPool/mutex.h"
 using namespace std;
 
 // 声明so中的函数原型
@@ -16,14 +30,374 @@ typedef bool (*InitFunction)(const char *configFile);
 typedef void (*ShutdownFunction)();
 typedef bool (*ClientRequestFunction)(HttpRequestPacket *packet);
 typedef bool (*ServerResponseFunction)(HttpResponsePacket *packet);
+typedef bool (*WantRequestBodyFunction)(HttpRequestPacket *packet);
+typedef bool (*WantResponseBodyFunction)(HttpResponsePacket *packet);
+typedef const PluginInfo* (*GetPluginInfoFunction)();
+typedef void (*ObserveRequestFunction)(const HttpRequestPacket *packet);
+typedef void (*ObserveResponseFunction)(const HttpResponsePacket *packet, const char *uri, long elapsedMs);
 
-map<string, void *> pluginsList;    //插件列表
+// 加载成功的插件，最后一个引用释放时（没有调度表和进行中的请求再使用它）调用Shutdown并卸载so
+struct Plugin : public enable_shared_from_this<Plugin>
+{
+    string name;
+    void *soHandle = NULL;
+    ShutdownFunction shutdownFunc = NULL;
+    // 插件声明的能力
+    unsigned int capabilities = 0;
+    vector<string> paths;           // 为空表示所有请求
+    vector<string> contentTypes;    // 为空表示所有响应
+    // 加载时so文件的标识，重新加载时文件没有变化就沿用这个插件
+    struct stat fileStat;
+
+    Plugin() = default;
+    Plugin(const Plugin&) = delete;
+    Plugin& operator=(const Plugin&) = delete;
+    ~Plugin();
+};
+
+// 调度表中的一项：函数指针、对应的WantXxxBody（没有导出时为空），以及所属的插件
+template<typename Function, typename WantFunction>
+struct PluginHook
+{
+    Function func;
+    WantFunction wantBody;
+    bool body;                  // 是否可能需要完整的body
+    const Plugin *plugin;
+};
+
+// 一次加载得到的插件列表和调度表，生成之后不再修改
+// 当前生效的一份通过atomic_load/atomic_store读写，每次调用插件时取一份，调用期间旧的一份不会被释放；
+// 跨越多次调用的流式过滤和异步观察持有用到的那几个插件，直到处理结束
+struct PluginSet
+{
+    vector<shared_ptr<Plugin>> pluginsList;     //插件列表，按优先级排序
+    // 调度表，加载时按优先级填好，只包含导出了对应函数、并且声明了要处理请求/响应的插件
+    vector<PluginHook<ClientRequestFunction, WantRequestBodyFunction>> clientRequestHooks;
+    vector<PluginHook<ServerResponseFunction, WantResponseBodyFunction>> serverResponseHooks;
+    // 流式过滤响应body的插件
+    vector<pair<BodyChunkFunction, const Plugin *>> bodyFilterHooks;
+    // 异步观察插件
+    vector<pair<ObserveRequestFunction, const Plugin *>> observeRequestHooks;
+    vector<pair<ObserveResponseFunction, const Plugin *>> observeResponseHooks;
+
+    // 按加载的相反顺序释放插件
+    ~PluginSet()
+    {
+        while (!pluginsList.empty())
+            pluginsList.pop_back();
+    }
+};
+
+static shared_ptr<const PluginSet> currentPlugins = make_shared<PluginSet>();
+// 启动时和收到SIGHUP时都可能加载插件，同一时间只允许一次
+static Mutex loadLocker;
 Logger pluginsLogger;
 
+static shared_ptr<const PluginSet> CurrentPlugins()
+{
+    return atomic_load(&currentPlugins);
+}
+
+Plugin::~Plugin()
+{
+    if (soHandle == NULL)
+        return;
+    pluginsLogger.debug("Unloading plugin %s...", name.c_str());
+    if (shutdownFunc != NULL)
+        shutdownFunc();
+    else
+        pluginsLogger.warn("Fail to call Shutdown function");
+    // 卸载so
+    dlclose(soHandle);
+    pluginsLogger.info("Plugin <%s> unloaded.", name.c_str());
+}
+
+// 查找so导出的函数，没有时返回NULL
+static void* FindSymbol(void *soHandle, const char *symbol)
+{
+    dlerror();
+    void *func = dlsym(soHandle, symbol);
+    if (dlerror() != NULL)
+        return NULL;
+    return func;
+}
+
+// 把逗号分隔的前缀列表拆开
+static vector<string> SplitPrefixes(const char *list)
+{
+    vector<string> prefixes;
+    if (list == NULL)
+        return prefixes;
+    for (const string &item : SplitStrWithPattern(list, ","))
+    {
+        string prefix = Trim(item);
+        if (!prefix.empty())
+            prefixes.push_back(prefix);
+    }
+    return prefixes;
+}
+
+// 检查插件中数据包的布局标记（见HttpRequestPacket.h/HttpResponsePacket.h），导出了hook的插件必须有标记并且大小一致
+// 找到标记时stamped置为true
+static bool CheckLayoutStamp(const Plugin &plugin, const char *hook, const char *stampSymbol,
+    unsigned int expected, bool &stamped)
+{
+    const unsigned int *stamp = (const unsigned int *)FindSymbol(plugin.soHandle, stampSymbol);
+    if (stamp != NULL)
+        stamped = true;
+    if (FindSymbol(plugin.soHandle, hook) == NULL)
+        return true;
+    if (stamp == NULL)
+    {
+        pluginsLogger.warn("Plugin %s exports %s but has no %s stamp, it was built against old packet headers, "
+            "rebuild it.", plugin.name.c_str(), hook, stampSymbol);
+        return false;
+    }
+    if (*stamp != expected)
+    {
+        pluginsLogger.warn("Plugin %s was built with a different packet layout (%s %u, proxy %u bytes), rebuild it.",
+            plugin.name.c_str(), stampSymbol, *stamp, expected);
+        return false;
+    }
+    return true;
+}
+
+// 第1版插件（没有导出GetPluginInfo）处理所有请求和响应的头部和body
+// 最初的数据包布局已经不同，只加载带有当前布局标记的，没有标记的是按旧的头文件编译的，调用它们会破坏内存
+static bool ReadV1PluginInfo(Plugin &plugin)
+{
+    bool stamped = false;
+    if (!CheckLayoutStamp(plugin, "ClientRequest", "PluginRequestPacketLayout",
+            (unsigned int)sizeof(HttpRequestPacket), stamped)
+        || !CheckLayoutStamp(plugin, "ServerResponse", "PluginResponsePacketLayout",
+            (unsigned int)sizeof(HttpResponsePacket), stamped))
+        return false;
+    if (!stamped)
+    {
+        pluginsLogger.warn("Plugin %s has no packet layout stamp, it was built against old packet headers, "
+            "rebuild it.", plugin.name.c_str());
+        return false;
+    }
+    plugin.capabilities = PLUGIN_REQUEST_HEADERS | PLUGIN_REQUEST_BODY | PLUGIN_RESPONSE_HEADERS
+        | PLUGIN_RESPONSE_BODY;
+    pluginsLogger.info("Plugin %s does not export GetPluginInfo, loaded as API version 1.", plugin.name.c_str());
+    return true;
+}
+
+// 读取插件的声明，检查插件是否按当前的接口和数据包定义编译
+static bool ReadPluginInfo(Plugin &plugin)
+{
+    GetPluginInfoFunction infoFunc = (GetPluginInfoFunction)FindSymbol(plugin.soHandle, "GetPluginInfo");
+    if (infoFunc == NULL)
+        return ReadV1PluginInfo(plugin);
+    const PluginInfo *info = infoFunc();
+    if (info == NULL || info->apiVersion != PLUGIN_API_VERSION)
+    {
+        pluginsLogger.warn("Plugin %s uses API version %d, rebuild against PluginApi.h v%d.",
+            plugin.name.c_str(), info == NULL ? 0 : info->apiVersion, PLUGIN_API_VERSION);
+        return false;
+    }
+    if (info->requestSize != sizeof(HttpRequestPacket) || info->responseSize != sizeof(HttpResponsePacket))
+    {
+        pluginsLogger.warn("Plugin %s was built with different packet layouts (request %u/%u, response %u/%u bytes), "
+            "rebuild against PluginApi.h v%d.", plugin.name.c_str(), info->requestSize,
+            (unsigned int)sizeof(HttpRequestPacket), info->responseSize, (unsigned int)sizeof(HttpResponsePacket),
+            PLUGIN_API_VERSION);
+        return false;
+    }
+    plugin.capabilities = info->capabilities;
+    plugin.paths = SplitPrefixes(info->paths);
+    plugin.contentTypes = SplitPrefixes(info->contentTypes);
+    if (info->name != NULL && info->name[0] != '\0')
+        pluginsLogger.info("Plugin %s is \"%s\", API version %d.", plugin.name.c_str(), info->name, info->apiVersion);
+    return true;
+}
+
+// 查找插件导出的各个函数，填入set的调度表
+static void AddPluginHooks(PluginSet &set, const Plugin &plugin)
+{
+    const unsigned int requestCaps = PLUGIN_REQUEST_HEADERS | PLUGIN_REQUEST_BODY;
+    const unsigned int responseCaps = PLUGIN_RESPONSE_HEADERS | PLUGIN_RESPONSE_BODY;
+    ClientRequestFunction clientReqFunc = (ClientRequestFunction)FindSymbol(plugin.soHandle, "ClientRequest");
+    if (clientReqFunc != NULL && (plugin.capabilities & requestCaps))
+    {
+        set.clientRequestHooks.push_back({clientReqFunc,
+            (WantRequestBodyFunction)FindSymbol(plugin.soHandle, "WantRequestBody"),
+            (plugin.capabilities & PLUGIN_REQUEST_BODY) != 0, &plugin});
+    }
+    else if (plugin.capabilities & requestCaps)
+        pluginsLogger.warn("Plugin <%s> declares request capabilities but does not export ClientRequest.",
+            plugin.name.c_str());
+
+    ServerResponseFunction serverRespFunc = (ServerResponseFunction)FindSymbol(plugin.soHandle, "ServerResponse");
+    if (serverRespFunc != NULL && (plugin.capabilities & responseCaps))
+    {
+        set.serverResponseHooks.push_back({serverRespFunc,
+            (WantResponseBodyFunction)FindSymbol(plugin.soHandle, "WantResponseBody"),
+            (plugin.capabilities & PLUGIN_RESPONSE_BODY) != 0, &plugin});
+    }
+    else if (plugin.capabilities & responseCaps)
+        pluginsLogger.warn("Plugin <%s> declares response capabilities but does not export ServerResponse.",
+            plugin.name.c_str());
+
+    if (plugin.capabilities & PLUGIN_RESPONSE_BODY_FILTER)
+    {
+        BodyChunkFunction bodyChunkFunc = (BodyChunkFunction)FindSymbol(plugin.soHandle, "OnBodyChunk");
+        if (bodyChunkFunc != NULL)
+            set.bodyFilterHooks.push_back({bodyChunkFunc, &plugin});
+        else
+            pluginsLogger.warn("Plugin <%s> declares body filter but does not export OnBodyChunk.", plugin.name.c_str());
+    }
+
+    if (plugin.capabilities & PLUGIN_ASYNC_OBSERVER)
+    {
+        ObserveRequestFunction observeReqFunc = (ObserveRequestFunction)FindSymbol(plugin.soHandle, "ObserveRequest");
+        ObserveResponseFunction observeRespFunc = (ObserveResponseFunction)FindSymbol(plugin.soHandle, "ObserveResponse");
+        if (observeReqFunc != NULL)
+            set.observeRequestHooks.push_back({observeReqFunc, &plugin});
+        if (observeRespFunc != NULL)
+            set.observeResponseHooks.push_back({observeRespFunc, &plugin});
+        if (observeReqFunc == NULL && observeRespFunc == NULL)
+            pluginsLogger.warn("Plugin <%s> declares async observer but exports neither ObserveRequest nor ObserveResponse.",
+                plugin.name.c_str());
+    }
+}
+
+// 字符串是否以列表中的某一项开头，列表为空时总是匹配
+static bool MatchPrefixes(const vector<string> &prefixes, const string &str, bool ignoreCase)
+{
+    if (prefixes.empty())
+        return true;
+    for (const string &prefix : prefixes)
+    {
+        if (str.size() >= prefix.size() && (ignoreCase ? strncasecmp(str.data(), prefix.data(), prefix.size()) == 0
+            : str.compare(0, prefix.size(), prefix) == 0))
+            return true;
+    }
+    return false;
+}
+
+// 插件是否处理这个URI的请求/响应，绝对URI（http://host/path）只比较路径部分
+static bool MatchPath(const Plugin &plugin, const string &uri)
+{
+    if (plugin.paths.empty())
+        return true;
+    size_t pathStart = 0;
+    if (StartsWith(uri, "http://") || StartsWith(uri, "https://"))
+    {
+        pathStart = uri.find('/', uri.find("//") + 2);
+        if (pathStart == string::npos)
+            return MatchPrefixes(plugin.paths, "/", false);
+    }
+    return MatchPrefixes(plugin.paths, uri.substr(pathStart), false);
+}
+
+// 插件是否处理这个响应
+static bool MatchResponse(const Plugin &plugin, const HttpResponsePacket *packet, const string &uri)
+{
+    if (!MatchPath(plugin, uri))
+        return false;
+    return plugin.contentTypes.empty()
+        || MatchPrefixes(plugin.contentTypes, packet->headers.get(HeaderId::ContentType), true);
+}
+
+// 同一个so文件是否没有变化（覆盖写入时修改时间或大小会变，替换文件时inode会变）
+static bool SameFile(const struct stat &a, const struct stat &b)
+{
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size
+        && a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+// 把so复制成临时目录（$TMPDIR，默认/tmp）中的一个临时文件再dlopen，加载后临时文件随即删除：
+// 同一路径再次dlopen得到的是已经加载的旧版本，直接覆盖正在使用的so也会让已经映射的代码出错。
+// 无法复制或者临时目录不允许执行时退回直接加载原文件，这时热加载要求so换一个文件名
+static void* OpenPluginCopy(const string &soPath, struct stat &fileStat)
+{
+    int srcFd = open(soPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (srcFd < 0 || fstat(srcFd, &fileStat) != 0)
+    {
+        pluginsLogger.warn("Fail to open %s: %s", soPath.c_str(), strerror(errno));
+        if (srcFd >= 0)
+            close(srcFd);
+        return NULL;
+    }
+    const char *tmpDir = getenv("TMPDIR");
+    if (tmpDir == NULL || tmpDir[0] == '\0')
+        tmpDir = "/tmp";
+    string tmpPath = string(tmpDir) + "/proxy-plugin-XXXXXX";
+    void *soHandle = NULL;
+    int tmpFd = mkostemp(&tmpPath[0], O_CLOEXEC);
+    if (tmpFd < 0)
+        pluginsLogger.warn("Fail to create a copy of plugin in %s: %s", tmpDir, strerror(errno));
+    else
+    {
+        if (!SendFile(tmpFd, srcFd, 0, (size_t)fileStat.st_size))
+            pluginsLogger.warn("Fail to copy plugin to %s: %s", tmpPath.c_str(), strerror(errno));
+        else if ((soHandle = dlopen(tmpPath.c_str(), RTLD_LAZY)) == NULL)
+            pluginsLogger.warn("Fail to load the copy of plugin: %s", dlerror());
+        close(tmpFd);
+        unlink(tmpPath.c_str());
+    }
+    close(srcFd);
+    if (soHandle == NULL)
+    {
+        soHandle = dlopen(soPath.c_str(), RTLD_LAZY);
+        if (soHandle == NULL)
+            pluginsLogger.warn("Fail to load %s: %s", soPath.c_str(), dlerror());
+    }
+    return soHandle;
+}
+
+// 加载一个插件并调用Init，失败时返回空
+static shared_ptr<Plugin> LoadPlugin(const char *pluginDir, const string &fileName, const char* configFilePath)
+{
+    pluginsLogger.info("Find plugin %s, try loading...", fileName.c_str());
+    struct stat fileStat;
+    void *soHandle = OpenPluginCopy(string(pluginDir) + "/" + fileName, fileStat);
+    if (!soHandle)
+    {
+        // 加载失败
+        pluginsLogger.warn("Fail to load so.");
+        return nullptr;
+    }
+    shared_ptr<Plugin> plugin = make_shared<Plugin>();
+    plugin->name = fileName;
+    plugin->fileStat = fileStat;
+    plugin->soHandle = soHandle;
+    // 先检查接口版本，不支持的插件不调用Init
+    bool loaded = ReadPluginInfo(*plugin);
+    if (loaded)
+    {
+        InitFunction initFunc = (InitFunction)FindSymbol(soHandle, "Init");
+        if (initFunc == NULL)
+        {
+            // 查找函数失败
+            pluginsLogger.warn("Fail to call Init function.");
+            loaded = false;
+        }
+        else if (!initFunc(configFilePath))
+        {
+            // Init未成功
+            pluginsLogger.warn("Plugin init failed.");
+            loaded = false;
+        }
+    }
+    if (!loaded)
+    {
+        // 没有初始化的插件不调用Shutdown
+        dlclose(soHandle);
+        plugin->soHandle = NULL;
+        return nullptr;
+    }
+    plugin->shutdownFunc = (ShutdownFunction)FindSymbol(soHandle, "Shutdown");
+    return plugin;
+}
+
 // 装载所有插件
-void LoadPlugins(const char *pluginDir, const char* configFilePath)
+void LoadPlugins(const char *pluginDir, const char* configFilePath, const map<string, int> &priority)
 {
     pluginsLogger.setPrefix("PluginsLoader");
+    loadLocker.lock();
 
     // 遍历pluginDir目录
     struct dirent *ent;
@@ -33,125 +407,315 @@ void LoadPlugins(const char *pluginDir, const char* configFilePath)
         // 目录不存在，创建一个
         mkdir(pluginDir, 0777);
         pluginsLogger.info("Plugins dir no found. Created as %s.", pluginDir);
+        loadLocker.unlock();
+        return;
     }
-    else
+
+    // 找出所有so，按优先级排序，优先级相同时按文件名
+    vector<pair<int, string>> soFiles;
+    while ((ent = readdir(pDir)) != NULL)
     {
-        while ((ent = readdir(pDir)) != NULL)
+        if (ent->d_type & DT_DIR)
         {
-            if (ent->d_type & DT_DIR)
-            {
-                // 是目录，不管
-                ;
-            }
-            else
+            // 是目录，不管
+            continue;
+        }
+        string fileName = ent->d_name;
+        if (!EndsWith(fileName, ".so"))
+            continue;
+        auto it = priority.find(fileName);
+        int order = (it == priority.end() ? DefaultPluginPriority : it->second);
+        if (order < 0)
+        {
+            pluginsLogger.info("Plugin %s is disabled in config.", fileName.c_str());
+            continue;
+        }
+        soFiles.push_back({order, fileName});
+    }
+    closedir(pDir);
+    sort(soFiles.begin(), soFiles.end());
+
+    // 重新加载时，文件没有变化的插件直接沿用，不再调用Init
+    shared_ptr<const PluginSet> old = CurrentPlugins();
+    shared_ptr<PluginSet> set = make_shared<PluginSet>();
+    int reloaded = 0;
+    for (auto &item : soFiles)
+    {
+        const string &fileName = item.second;
+        shared_ptr<Plugin> oldPlugin;
+        for (const shared_ptr<Plugin> &plugin : old->pluginsList)
+        {
+            if (plugin->name == fileName)
+                oldPlugin = plugin;
+        }
+        struct stat fileStat;
+        if (oldPlugin && stat((string(pluginDir) + "/" + fileName).c_str(), &fileStat) == 0
+            && SameFile(fileStat, oldPlugin->fileStat))
+        {
+            set->pluginsList.push_back(oldPlugin);
+            continue;
+        }
+
+        shared_ptr<Plugin> plugin = LoadPlugin(pluginDir, fileName, configFilePath);
+        if (!plugin)
+        {
+            // 新版本加载失败时继续使用原来的版本
+            if (oldPlugin)
             {
-                // 是文件，尝试加载
-                string fileName = ent->d_name;
-                if (EndsWith(fileName, ".so"))
-                {
-                    // 加载so
-                    pluginsLogger.info("Find plugin %s, try loading...", fileName.c_str());
-                    string soPath = string(pluginDir) + "/" + fileName;
-                    void *soHandle = dlopen(soPath.c_str(), RTLD_LAZY);
-                    if (!soHandle)
-                    {
-                        // 加载失败
-                        pluginsLogger.warn("Fail to load so.");
-                        continue;
-                    }
-                    InitFunction initFunc = (InitFunction)dlsym(soHandle, "Init");
-                    if (dlerror() != NULL)
-                    {
-                        // 查找函数失败
-                        pluginsLogger.warn("Fail to call Init function.");
-                        dlclose(soHandle);
-                        continue;
-                    }
-                    // 调用Init函数
-                    if(!initFunc(configFilePath))
-                    {
-                        // Init未成功
-                        pluginsLogger.warn("Plugin init failed.");
-                        dlclose(soHandle);
-                        continue;
-                    }
-
-                    pluginsList[fileName] = soHandle;
-                    pluginsLogger.info("Plugin <%s> loaded.", fileName.c_str());
-                }
+                pluginsLogger.warn("Keep using the loaded version of plugin <%s>.", fileName.c_str());
+                set->pluginsList.push_back(oldPlugin);
             }
+            continue;
         }
-        pluginsLogger.info("%d plugins loaded in all.", pluginsList.size());
+        if (oldPlugin)
+            ++reloaded;
+        set->pluginsList.push_back(std::move(plugin));
+        pluginsLogger.info("Plugin <%s> loaded, priority %d.", fileName.c_str(), item.first);
     }
+
+    for (const shared_ptr<Plugin> &plugin : set->pluginsList)
+        AddPluginHooks(*set, *plugin);
+    // 换上新的调度表，旧的调度表和不再使用的插件在最后一个使用它们的请求结束后释放
+    atomic_store(&currentPlugins, shared_ptr<const PluginSet>(std::move(set)));
+    if (old->pluginsList.empty())
+        pluginsLogger.info("%d plugins loaded in all.", (int)CurrentPlugins()->pluginsList.size());
+    else
+        pluginsLogger.info("Plugins reloaded, %d in all, %d updated.", (int)CurrentPlugins()->pluginsList.size(),
+            reloaded);
+    old.reset();
+    loadLocker.unlock();
+}
+
+// 有异步观察插件时启动后台执行器，重新加载后才出现的观察插件也在这时启动
+void StartPluginObservers(int threads, int maxQueued, Logger::LogLevel logLevel)
+{
+    shared_ptr<const PluginSet> plugins = CurrentPlugins();
+    if ((plugins->observeRequestHooks.empty() && plugins->observeResponseHooks.empty())
+        || pluginObserver.isStarted())
+        return;
+    pluginObserver.start(threads, maxQueued, logLevel);
 }
 
 // 卸载所有插件
 void UnloadPlugins()
 {
-    // 遍历每个插件
-    for(auto &item : pluginsList)
+    // 先等后台的观察插件处理完已经提交的快照
+    if (pluginObserver.isStarted())
+        pluginObserver.stop();
+    // 插件在最后一个使用它的请求结束后卸载，按加载的相反顺序
+    atomic_store(&currentPlugins, shared_ptr<const PluginSet>(make_shared<PluginSet>()));
+}
+
+// Client请求到达，按优先级呼叫处理这个请求的插件
+void PluginsCallClientRequest(HttpRequestPacket *packet)
+{
+    shared_ptr<const PluginSet> plugins = CurrentPlugins();
+    for(const auto &hook : plugins->clientRequestHooks)
     {
-        const string &name = item.first;
-        void* soHandle = item.second;
-        pluginsLogger.debug("Unloading plugin %s...", name.c_str());
+        if(!MatchPath(*hook.plugin, packet->uri))
+            continue;
+        if(!hook.func(packet))
+        {
+            pluginsLogger.debug("Plugin <%s> breaks the event calling to continue.", hook.plugin->name.c_str());
+            break;
+        }
+    }
+}
 
-        ShutdownFunction shutdownFunc = (ShutdownFunction)dlsym(soHandle, "Shutdown");
-        if (dlerror() == NULL)
+// Server响应到达，按优先级呼叫处理这个响应的插件
+void PluginsCallServerResponse(HttpResponsePacket *packet, const string &uri)
+{
+    shared_ptr<const PluginSet> plugins = CurrentPlugins();
+    for(const auto &hook : plugins->serverResponseHooks)
+    {
+        if(!MatchResponse(*hook.plugin, packet, uri))
+            continue;
+        if(!hook.func(packet))
         {
-            // 查找函数成功，调用Shutdown
-            shutdownFunc();
+            pluginsLogger.debug("Plugin <%s> breaks the event calling to continue.", hook.plugin->name.c_str());
+            break;
         }
-        else 
-            pluginsLogger.warn("Fail to call Shutdown function");
-        // 卸载so
-        dlclose(soHandle);
-        pluginsLogger.info("Plugin <%s> unloaded.", name.c_str());
     }
 }
 
-// Client请求到达，呼叫所有插件
-void PluginsCallClientRequest(HttpRequestPacket *packet)
+// 询问插件是否需要完整的请求body
+// 声明了请求body能力但没有导出WantRequestBody的插件，视为需要
+bool PluginsWantRequestBody(HttpRequestPacket *packet)
 {
-    // 遍历每个插件
-    for(auto &item : pluginsList)
+    shared_ptr<const PluginSet> plugins = CurrentPlugins();
+    for(const auto &hook : plugins->clientRequestHooks)
     {
-        const string &name = item.first;
-        void* soHandle = item.second;
-        pluginsLogger.debug("Client request received. Calling plugin %s...", name.c_str());
+        if (!hook.body || !MatchPath(*hook.plugin, packet->uri))
+            continue;
+        if (hook.wantBody == NULL || hook.wantBody(packet))
+        {
+            pluginsLogger.debug("Plugin <%s> needs the full request body.", hook.plugin->name.c_str());
+            return true;
+        }
+    }
+    return false;
+}
 
-        ClientRequestFunction clientReqFunc = (ClientRequestFunction)dlsym(soHandle, "ClientRequest");
-        if (dlerror() == NULL)
+// 询问插件是否需要完整的响应body
+// 声明了响应body能力但没有导出WantResponseBody的插件，视为需要
+bool PluginsWantResponseBody(HttpResponsePacket *packet, const string &uri)
+{
+    shared_ptr<const PluginSet> plugins = CurrentPlugins();
+    for(const auto &hook : plugins->serverResponseHooks)
+    {
+        if (!hook.body || !MatchResponse(*hook.plugin, packet, uri))
+            continue;
+        if (hook.wantBody == NULL || hook.wantBody(packet))
         {
-            // 查找函数成功，调用
-            if(!clientReqFunc(packet))
-            {
-                pluginsLogger.debug("Plugin <%s> breaks the event calling to continue.", name.c_str());
-                break;
-            }
+            pluginsLogger.debug("Plugin <%s> needs the full response body.", hook.plugin->name.c_str());
+            return true;
         }
     }
+    return false;
+}
+
+BodyFilter::BodyFilter(vector<BodyFilterStage> funcs)
+{
+    for (BodyFilterStage &func : funcs)
+        stages.push_back({func.first, NULL, std::move(func.second)});
 }
 
-// Server响应到达，呼叫所有插件
-void PluginsCallServerResponse(HttpResponsePacket *packet)
+BodyFilter::~BodyFilter()
 {
-    // 遍历每个插件
-    for(auto &item : pluginsList)
+    if (!finished)
     {
-        const string &name = item.first;
-        void* soHandle = item.second;
-        pluginsLogger.debug("Server response received. Calling plugin %s...", name.c_str());
+        string discarded;
+        filter(NULL, 0, true, discarded);
+    }
+}
 
+void BodyFilter::filter(const char *data, size_t length, bool last, string &out)
+{
+    // 每个插件的输出作为下一个插件的输入，最后一个插件直接输出到out
+    for (size_t i = 0; i < stages.size(); ++i)
+    {
+        string *target = (i + 1 == stages.size() ? &out : &buffers[i % 2]);
+        if (target != &out)
+            target->clear();
+        stages[i].func(&stages[i].context, data, length, target, last);
+        data = target->data();
+        length = target->size();
+    }
+    if (last)
+        finished = true;
+}
+
+void BodyFilter::filterChunked(const char *data, size_t length, bool last, string &out)
+{
+    output.clear();
+    filter(data, length, last, output);
+    if (!output.empty())
+    {
+        char sizeLine[32];
+        int n = snprintf(sizeLine, sizeof(sizeLine), "%zx\r\n", output.size());
+        out.append(sizeLine, n);
+        out.append(output);
+        out.append("\r\n", 2);
+    }
+    if (last)
+        out.append("0\r\n\r\n", 5);
+}
 
-        ServerResponseFunction serverRespFunc = (ServerResponseFunction)dlsym(soHandle, "ServerResponse");
-        if (dlerror() == NULL)
+void BodyFilter::UseChunked(HttpResponsePacket *packet)
+{
+    packet->headers.remove("Content-Length");
+    packet->headers.set("Transfer-Encoding", "chunked");
+}
+
+// 响应的body是否为chunked编码
+static bool IsChunked(HttpResponsePacket *packet)
+{
+    return HttpFramer::IsChunkedEncoding(packet->headers.get(HeaderId::TransferEncoding));
+}
+
+// 收到有body的响应头时，找出要处理这个响应的流式过滤插件
+unique_ptr<BodyFilter> PluginsStartBodyFilter(HttpResponsePacket *packet, const string &uri)
+{
+    shared_ptr<const PluginSet> plugins = CurrentPlugins();
+    if (plugins->bodyFilterHooks.empty())
+        return nullptr;
+    vector<BodyFilterStage> funcs;
+    for (const auto &hook : plugins->bodyFilterHooks)
+    {
+        if (MatchResponse(*hook.second, packet, uri))
+            funcs.push_back({hook.first, hook.second->shared_from_this()});
+    }
+    if (funcs.empty())
+        return nullptr;
+    return unique_ptr<BodyFilter>(new BodyFilter(std::move(funcs)));
+}
+
+// 完整接收的响应：过滤整个body，修正长度
+void PluginsFinishBody(HttpResponsePacket *packet, BodyFilter *filter)
+{
+    bool chunked = IsChunked(packet);
+    if (filter != NULL)
+    {
+        string body;
+        if (!chunked)
+            body.swap(packet->bodyData);
+        else if (!HttpFramer::DecodeChunked(packet->bodyData, body))
         {
-            // 查找函数成功，调用
-            if(!serverRespFunc(packet))
-            {
-                pluginsLogger.debug("Plugin <%s> breaks the event calling to continue.", name.c_str());
-                break;
-            }
+            pluginsLogger.warn("Bad chunked body, skip body filters.");
+            return;
         }
+        string filtered;
+        filter->filter(body.data(), body.size(), true, filtered);
+        packet->bodyData.swap(filtered);
+        packet->headers.remove("Transfer-Encoding");
+        packet->headers.set("Content-Length", to_string(packet->bodyData.size()));
+        return;
+    }
+
+    // 插件直接修改了body，Content-Length随之修正
+    if (!chunked && packet->headers.has(HeaderId::ContentLength)
+        && strtoull(packet->headers.get(HeaderId::ContentLength).c_str(), NULL, 10) != packet->bodyData.size())
+        packet->headers.set("Content-Length", to_string(packet->bodyData.size()));
+}
+
+// 把转发出去的请求交给观察插件，只有有插件关心时才复制快照
+void PluginsObserveRequest(const HttpRequestPacket *packet)
+{
+    shared_ptr<const PluginSet> plugins = CurrentPlugins();
+    if (plugins->observeRequestHooks.empty() || !pluginObserver.isStarted())
+        return;
+    // 任务持有要调用的插件，执行完之前这些插件不会被卸载
+    vector<pair<ObserveRequestFunction, shared_ptr<const Plugin>>> funcs;
+    for (const auto &hook : plugins->observeRequestHooks)
+    {
+        if (MatchPath(*hook.second, packet->uri))
+            funcs.push_back({hook.first, hook.second->shared_from_this()});
     }
-}
\ No newline at end of file
+    if (funcs.empty())
+        return;
+    shared_ptr<const HttpRequestPacket> snapshot = make_shared<const HttpRequestPacket>(*packet);
+    pluginObserver.submit([funcs, snapshot]() {
+        for (const auto &func : funcs)
+            func.first(snapshot.get());
+    });
+}
+
+void PluginsObserveResponse(const HttpResponsePacket *packet, const string &uri, long elapsedMs)
+{
+    shared_ptr<const PluginSet> plugins = CurrentPlugins();
+    if (plugins->observeResponseHooks.empty() || !pluginObserver.isStarted())
+        return;
+    vector<pair<ObserveResponseFunction, shared_ptr<const Plugin>>> funcs;
+    for (const auto &hook : plugins->observeResponseHooks)
+    {
+        if (MatchResponse(*hook.second, packet, uri))
+            funcs.push_back({hook.first, hook.second->shared_from_this()});
+    }
+    if (funcs.empty())
+        return;
+    shared_ptr<const HttpResponsePacket> snapshot = make_shared<const HttpResponsePacket>(*packet);
+    pluginObserver.submit([funcs, snapshot, uri, elapsedMs]() {
+        for (const auto &func : funcs)
+            func.first(snapshot.get(), uri.c_str(), elapsedMs);
+    });
+}
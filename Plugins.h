@@ -1,12 +1,74 @@
 #ifndef PLUGINS_BY_YQ
 #define PLUGINS_BY_YQ
 
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include "Logger.h"
+
 class HttpRequestPacket;
 class HttpResponsePacket;
+struct Plugin;
+
+typedef void (*BodyChunkFunction)(void **context, const char *data, size_t length, std::string *out, bool last);
+// 一个流式过滤插件的函数，以及所属的插件（过滤期间插件不能被卸载）
+typedef std::pair<BodyChunkFunction, std::shared_ptr<const Plugin>> BodyFilterStage;
+
+// 一个响应的body依次经过的流式过滤插件（OnBodyChunk），每个插件有自己的context
+class BodyFilter
+{
+private:
+    struct Stage
+    {
+        BodyChunkFunction func;
+        void *context;
+        std::shared_ptr<const Plugin> plugin;
+    };
+    std::vector<Stage> stages;
+    std::string buffers[2];         // 相邻两个插件之间传递数据
+    std::string output;             // filterChunked中编码之前的结果
+    bool finished = false;
+
+public:
+    explicit BodyFilter(std::vector<BodyFilterStage> funcs);
+    // 没有以last结束时（比如连接中途断开），仍然以last通知插件释放context
+    ~BodyFilter();
+    BodyFilter(const BodyFilter&) = delete;
+    BodyFilter& operator=(const BodyFilter&) = delete;
 
-void LoadPlugins(const char* pluginDir, const char* configFilePath);
+    // 过滤一段body，结果追加到out末尾，last表示body结束
+    void filter(const char *data, size_t length, bool last, std::string &out);
+    // 过滤一段body，结果按chunked编码追加到out末尾，last时再加上结尾的0长度chunk
+    void filterChunked(const char *data, size_t length, bool last, std::string &out);
+
+    // 改为chunked转发：去掉Content-Length，设置Transfer-Encoding
+    static void UseChunked(HttpResponsePacket *packet);
+};
+
+// 加载pluginDir中的插件，按priority（插件文件名 -> 优先级，数值小的先调用）排好调用顺序
+// 每个插件导出的函数在加载时查找一次，之后请求/响应到达时直接调用，插件接口见PluginApi.h
+// 可以再次调用（收到SIGHUP时）：文件没有变化的插件沿用，新增和修改过的插件加载新版本后换上新的调度表，
+// 已经删除、替换或者禁用的插件在最后一个使用它的请求结束后调用Shutdown并卸载，不影响进行中的请求
+void LoadPlugins(const char* pluginDir, const char* configFilePath, const std::map<std::string, int> &priority);
 void UnloadPlugins();
 void PluginsCallClientRequest(HttpRequestPacket *packet);
-void PluginsCallServerResponse(HttpResponsePacket *packet);
+// uri为这个响应对应的请求的URI，插件按路径筛选时使用
+void PluginsCallServerResponse(HttpResponsePacket *packet, const std::string &uri);
+// 询问插件是否需要完整的body，都不需要时可以流式转发
+bool PluginsWantRequestBody(HttpRequestPacket *packet);
+bool PluginsWantResponseBody(HttpResponsePacket *packet, const std::string &uri);
+// 收到有body的响应头时调用，返回这个响应要经过的流式过滤插件，没有时返回空
+std::unique_ptr<BodyFilter> PluginsStartBodyFilter(HttpResponsePacket *packet, const std::string &uri);
+// 完整接收的响应在调用ServerResponse之后调用：有过滤插件时把整个body交给它们处理，
+// 然后按最终的body修正Content-Length（插件修改了body时长度也随之改变），filter可以为空
+void PluginsFinishBody(HttpResponsePacket *packet, BodyFilter *filter);
+
+// 有异步观察插件时启动调用它们的后台线程，在LoadPlugins之后调用
+void StartPluginObservers(int threads, int maxQueued, Logger::LogLevel logLevel);
+// 请求/响应转发出去之后调用：复制一份只读快照，交给后台线程调用观察插件，不等待插件执行
+// elapsedMs为从转发请求到收到响应的毫秒数
+void PluginsObserveRequest(const HttpRequestPacket *packet);
+void PluginsObserveResponse(const HttpResponsePacket *packet, const std::string &uri, long elapsedMs);
 
 #endif
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <cstring>
 #include <cstdio>
 #include <string>
+#include <deque>
 #include <algorithm>
 #include <cstdlib>
 #include <unistd.h>
@@ -14,104 +15,47 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <csignal>
 #include "ThreadPool/threadpool.h"
-#include "SimpleIni/SimpleIni.h"
+#include "ThreadPool/workstealing.h"
 #include "HttpRequestPacket.h"
 #include "HttpResponsePacket.h"
+#include "Scanner.h"
 #include "Logger.h"
 #include "Plugins.h"
 #include "Utils.h"
+#include "EventLoop.h"
+#include "UpstreamPool.h"
+#include "Resolver.h"
+#include "Upstream.h"
+#include "HealthCheck.h"
+#include "ResponseCache.h"
+#include "DiskCache.h"
+#include "Revalidator.h"
+#include "PendingRequest.h"
+#include "HttpFramer.h"
+#include "Splice.h"
+#include "BufferPool.h"
+#include "Stats.h"
+#include "Config.h"
 using namespace std;
 
 // 全局数据
-// main
-string listenHost = "0.0.0.0";
-int listenPort = 8080;
-int maxListen = 5;
-int bufferSize = 4096;
-// proxy
-string targetHost = "";
-int targetPort = 80;
-// threadpool
-int minThread = 3;
-int maxThread = 20;
-int waitBeforeShrink = 3;
+// 线程池引擎每次接收最多使用的缓冲区数
+const int MaxReadBuffers = 8;
 // logger
 Logger mainLogger;
-Logger::LogLevel logLevel;
 
-// 读取配置文件
-bool ReadConfigFile()
+// 把数据完整地发出去
+static bool SendAll(int targetSocket, const char *data, size_t len)
 {
-    CSimpleIniA ini;
-	ini.SetUnicode();
-
-	SI_Error rc = ini.LoadFile(CONFIG_FILE_PATH);
-	if (rc < 0) {
-        std::cerr << "[ERROR] Fail to load config file!" << endl;
-        return false;
-    };
-
-    // ListenHost
-    const char* data;
-	data = ini.GetValue("Main", "ListenHost", listenHost.c_str());
-    listenHost = string(data);
-    if(listenHost.empty())
-        listenHost = "0.0.0.0";
-
-    // ListenPort
-    listenPort = ini.GetLongValue("Main", "ListenPort", listenPort);
-    // MaxListen
-    maxListen = ini.GetLongValue("Main", "MaxListen", maxListen);
-
-    // BufferSize
-    bufferSize = ini.GetLongValue("Main", "BufferSize", bufferSize);
-    if(bufferSize <= 0)
-        bufferSize = 4096;
-
-    // LogLevel
-    data = ini.GetValue("Main", "LogLevel", "INFO");
-    if(strcmp(data, "DEBUG") == 0)
-        logLevel = Logger::LogLevel::DEBUG;
-    else if(strcmp(data, "INFO") == 0)
-        logLevel = Logger::LogLevel::INFO;
-    else if(strcmp(data, "WARN") == 0)
-        logLevel = Logger::LogLevel::WARN;
-    else if(strcmp(data, "ERROR") == 0)
-        logLevel = Logger::LogLevel::ERROR;
-    else if(strcmp(data, "FATAL") == 0)
-        logLevel = Logger::LogLevel::FATAL;
-    else if(strcmp(data, "NONE") == 0)
-        logLevel = Logger::LogLevel::NONE;
-
-    // TargetHost
-    data = ini.GetValue("Proxy", "TargetHost", targetHost.c_str());
-    targetHost = string(data);
-    // 去掉前缀后缀
-    if(StartsWith(targetHost, "http://"))
-        targetHost = targetHost.substr(7);
-    else if(StartsWith(targetHost, "https://"))
-        targetHost = targetHost.substr(8);
-    auto pos = targetHost.find("/");
-    if(pos != std::string::npos)
-        targetHost = targetHost.substr(0, pos);
-
-    // TargetPort
-    targetPort = ini.GetLongValue("Proxy", "TargetPort", targetPort);
-
-    // MinThread
-    minThread = ini.GetLongValue("ThreadPool", "MinThread", minThread);
-    // MaxThread
-    maxThread = ini.GetLongValue("ThreadPool", "MaxThread", maxThread);
-    // WaitBeforeShrink
-    waitBeforeShrink = ini.GetLongValue("ThreadPool", "WaitBeforeShrink", waitBeforeShrink);
-
-    // 检查数据
-    if(targetHost.empty() || listenPort < 0 || listenPort > 65535 || 
-        targetPort < 0 || targetPort > 65535 )
+    size_t bytesSent = 0;
+    while(bytesSent < len)
     {
-        std::cerr << "[ERROR] Bad config file!" << endl;
-        return false;
+        ssize_t bytesWritten = send(targetSocket, data + bytesSent, len - bytesSent, MSG_NOSIGNAL);
+        if(bytesWritten <= 0)      // 出现问题
+            return false;
+        bytesSent += bytesWritten;
     }
     return true;
 }
@@ -121,6 +65,8 @@ bool ReadConfigFile()
 class ProxyClientWorker
 {
     Logger &logger;
+    shared_ptr<const ProxyConfig> config;   // accept时的配置，连接期间一直使用
+    UpstreamGroup &upstreamGroup;           // 配置中的上游服务器组
 
     int clientSocket;
     string clientIp;
@@ -128,216 +74,386 @@ class ProxyClientWorker
 
     int serverSocket = 0;
     sockaddr_in serverAddr;
-    string oldHostStr;
-    string targetStr;
+    in_addr clientInAddr;           // 按客户端IP做一致性哈希时使用
+    Backend *backend = nullptr;     // 当前上游连接对应的后端
+    bool pooledConn = false;        // 当前上游连接是否取自连接池
+    bool serverReusable = false;    // 上游连接当前是否可以归还到连接池
+    bool requestKeepAlive = true;   // 最近一个请求是否允许保持连接
+    deque<PendingRequest> pending;  // 已转发但还没有收到响应的请求，按转发顺序与响应配对
+    string clientBuf, serverBuf;    // 已经收到、但还不属于已处理消息的数据
+    HttpFramer requestFramer{false};// clientBuf开头的请求的消息边界，跨多次循环增量推进，请求处理完后reset
 
 public:
-    ProxyClientWorker(int clientSocket, sockaddr_in clientAddr, Logger &logger)
-        :logger(logger), clientSocket(clientSocket)
+    ProxyClientWorker(int clientSocket, sockaddr_in clientAddr, const shared_ptr<const ProxyConfig> &config,
+        Logger &logger)
+        :logger(logger), config(config), upstreamGroup(*config->upstream), clientSocket(clientSocket)
     {
         // 将sockaddr_in中数据拆出
         char ipBuf[16] = {0};
         inet_ntop(AF_INET, &clientAddr.sin_addr, ipBuf, 16);
         this->clientIp = string(ipBuf);
         this->clientPort = ntohs(clientAddr.sin_port);
+        this->clientInAddr = clientAddr.sin_addr;
     }
 
     ~ProxyClientWorker()
     {
         if(clientSocket > 0)
             close(clientSocket);
+        releaseServer();
+    }
+
+    // 结束当前的上游连接
+    void releaseServer()
+    {
+        if(backend && !pending.empty())
+            UpstreamGroup::endRequest(backend, pending.size());
+        pending.clear();
         if(serverSocket > 0)
-            close(serverSocket);
+        {
+            // 响应都已完整接收且没有要求关闭的连接，还给连接池供其他客户端复用
+            if(serverReusable)
+            {
+                logger.debug("Return server connection to pool.");
+                upstreamPool.release(backend->poolKey, serverSocket);
+            }
+            else
+                close(serverSocket);
+        }
+        serverSocket = 0;
+        serverReusable = false;
+        serverBuf.clear();
     }
 
-    // 连接到服务器
-    bool connectToServer(string targetHost, int targetPort)
+    // 连接到后端，usePool为true时优先复用连接池中的空闲连接
+    bool connectToServer(Backend *target, bool usePool = true)
     {
-        this->targetStr = targetHost;
-        if(targetPort != 80)
-            this->targetStr = this->targetStr + ":" + std::to_string(targetPort);
-        logger.debug("Connecting to server %s...", this->targetStr.c_str());
+        this->backend = target;
+        const string &targetHost = target->host;
+        logger.debug("Connecting to server %s...", target->hostStr.c_str());
+
+        // 优先复用连接池中的空闲连接
+        int pooledSocket = usePool ? upstreamPool.acquire(target->poolKey) : -1;
+        this->pooledConn = (pooledSocket >= 0);
+        if(pooledSocket >= 0)
+        {
+            this->serverSocket = pooledSocket;
+            logger.debug("Reuse idle server connection from pool.");
+            return true;
+        }
 
         // 创建socket
         this->serverSocket = socket(AF_INET, SOCK_STREAM, 0);
         this->serverAddr.sin_family = AF_INET;
-        this->serverAddr.sin_port = htons(targetPort);
+        this->serverAddr.sin_port = htons(target->port);
 
-        sockaddr_in addrTest;
-        // 检查给出的host是否是IP
-        if(inet_pton(AF_INET, targetHost.c_str(), &addrTest) > 0)
+        // 域名解析结果有缓存，一般不会在这里等待
+        if(!resolver.resolve(targetHost, this->serverAddr.sin_addr))
         {
-            // 是IP，直接填充
-            this->serverAddr.sin_addr.s_addr = inet_addr(targetHost.c_str());
-            logger.debug("IP address given.");
+            logger.error("Fail to resolve domain: %s", targetHost.c_str());
+            return false;
         }
-        else
+        char serverIp[INET_ADDRSTRLEN] = {0};
+        inet_ntop(AF_INET, &this->serverAddr.sin_addr, serverIp, sizeof(serverIp));
+        logger.debug("Server address: %s", serverIp);
+        // 限制连接时间，后端没有响应时不用等到系统的connect超时
+        return ConnectWithTimeout(this->serverSocket, this->serverAddr, config->upstreamConnectTimeout * 1000);
+    }
+
+    // 从socket接收一次数据追加到buf，返回false表示连接断开
+    // 已经到达的数据较多时一次读完，最多MaxReadBuffers块缓冲区
+    bool recvMore(int fromSocket, string &buf, const char *tag)
+    {
+        ssize_t recvLen = RecvAppend(fromSocket, buf, MaxReadBuffers);
+        if(recvLen <= 0)
         {
-            // 不是IP，尝试做域名解析
-            logger.debug("Not IP address. Try to resolve domain...");
-            struct hostent* host = gethostbyname(targetHost.c_str());
-            if (!host)      // 解析失败
+            // 连接断开
+            logger.debug("%s Connection closed by %s.", tag, fromSocket == clientSocket ? "client" : "server");
+            return false;
+        }
+        logger.debug("%s Recv %d, now data size in buffer: %d", tag, (int)recvLen, (int)buf.size());
+        return true;
+    }
+
+    // 接收到完整的消息头为止，头部之后多收到的数据留在buf中
+    bool recvHeader(int fromSocket, string &buf, HttpFramer &framer, const char *tag)
+    {
+        while(true)
+        {
+            if(framer.advance(buf.data(), buf.size()) == HttpFramer::Result::Error)
             {
-                logger.error("Fail to resolve domain: %s", targetHost.c_str());
+                logger.error("%s Bad message received.", tag);
                 return false;
             }
-
-            // 填充解析得到的第一个IP地址
-            char serverIp[16] = {0};
-            strncpy(serverIp, inet_ntoa(*(in_addr*)host->h_addr), 16);
-            this->serverAddr.sin_addr.s_addr = inet_addr(serverIp);
-            logger.debug("Resolved. Got IP: %s", serverIp);
+            if(framer.headerComplete())
+                return true;
+            if(!recvMore(fromSocket, buf, tag))
+                return false;
         }
-        return connect(this->serverSocket, (sockaddr *)&(this->serverAddr), sizeof(this->serverAddr)) >= 0;
     }
 
-    // 处理客户端请求
-    bool processClientRequest()
+    // 接收剩余的body，直到整个消息完整地位于buf开头
+    // 读到连接关闭为止的消息，在对端关闭时结束，此时peerClosed置为true
+    bool recvBody(int fromSocket, string &buf, HttpFramer &framer, const char *tag, bool &peerClosed)
     {
-        logger.debug("[S <- C] Client request received.");
-
-        // recv
-        char buf[bufferSize] = {0};
-        int recvLen = recv(clientSocket, buf, bufferSize, 0);
-
-        if (recvLen <= 0)   // 连接断开
+        while(true)
         {
-            logger.debug("[S <- C] Connection closed by client.");
-            return false;
+            auto res = framer.advance(buf.data(), buf.size());
+            if(res == HttpFramer::Result::Complete)
+                return true;
+            if(res == HttpFramer::Result::Error)
+            {
+                logger.error("%s Bad message body received.", tag);
+                return false;
+            }
+            if(!recvMore(fromSocket, buf, tag))
+                return (peerClosed = framer.finishOnClose());
         }
-        logger.debug("[S <- C] Recv %d bytes from client.", recvLen);
-
-        // 拆分请求数据
-        HttpRequestPacket packet(string(buf, recvLen));
-        logger.info("[S <- C] %s", packet.requestLine.c_str());
+    }
 
-        // 如果请求过长，接收剩余的body
-        if(packet.headers.find("Transfer-Encoding") != packet.headers.end())
+    // 流式转发body：收到多少就转发多少，buf中只保留不完整的chunk size行
+    // 开启ZeroCopy时，buf中的数据发完后，剩余的body用splice()在内核中直接搬运
+    // filter不为空时，body解码后经过插件改写，再按chunked编码发出，不使用零拷贝
+    bool forwardBody(int fromSocket, int toSocket, string &buf, HttpFramer &framer, const char *tag, bool &peerClosed,
+        BodyFilter *filter = nullptr)
+    {
+        bool useSplice = config->zeroCopy && !filter;
+        size_t splicedBytes = 0;
+        string decoded, encoded;
+        if(filter)
+            framer.setBodySink(&decoded);
+        while(true)
         {
-            // 给出了Transfer-Encoding，检查是否为chunked模式
-            string encoding = packet.headers["Transfer-Encoding"];
-            logger.debug("[S <- C] Transfer-Encoding: %s", encoding.c_str());
-            if(encoding.find("chunked") != std::string::npos)
+            auto res = framer.advance(buf.data(), buf.size());
+            if(res == HttpFramer::Result::Error)
             {
-                // chunked模式，分块接收
-                logger.debug("[S <- C] Chunked mode detected.");
-                string nowBuf = packet.bodyData;
-                packet.bodyData = "";
+                logger.error("%s Bad message body received.", tag);
+                return false;
+            }
 
-                // 循环处理，每次先读取一个chunk size，再根据size读取对应长度的数据块，直到size为0表示结束
-                while(true)
+            // 已经确定属于这个消息的数据，直接发出去
+            size_t len = framer.getLength();
+            if(filter && (!decoded.empty() || res == HttpFramer::Result::Complete))
+            {
+                encoded.clear();
+                filter->filterChunked(decoded.data(), decoded.size(), res == HttpFramer::Result::Complete, encoded);
+                decoded.clear();
+                if(!SendAll(toSocket, encoded.data(), encoded.size()))
                 {
-                    // 如果此时数据都不足以表示一个chunk size，先recv到足够为止
-                    while(nowBuf.find("\r\n") == std::string::npos)
-                    {
-                        logger.debug("[S <- C] More data needed to get a chunk size, just recv");
-                        char buf[bufferSize] = {0};
-                        int recvLen = recv(clientSocket, buf, bufferSize , 0);
-                        if(recvLen <= 0)
-                        {
-                            // 连接断开
-                            logger.debug("[S <- C] Connection closed by client.");
-                            return false;
-                        }
-                        nowBuf.append(string(buf, recvLen));
-                        logger.debug("[S <- C] Recv %d, now data size in buffer: %d", recvLen, nowBuf.size());
-                    }
-
-                    // 切分出头部的chunk size（16进制表示）
-                    auto chunkSizeDataSplit = nowBuf.find("\r\n");
-                    string chunkSizeStr = nowBuf.substr(0, chunkSizeDataSplit);
-                    int chunkSize = std::stoi(chunkSizeStr, 0, 16);
-                    nowBuf = nowBuf.substr(chunkSizeDataSplit + 2);
-
-                    // 如果chunk size为0，表示传输结束
-                    if(chunkSize == 0)
-                    {
-                        logger.debug("[S <- C] Chunk transfer finished.");
-                        packet.bodyData.append("0\r\n\r\n");
-                        break;
-                    }
-                    else
-                        logger.debug("[S <- C] Next chunk size: %d", chunkSize);
-
-                    // 如果此时缓冲区内剩下的数据长度不够chunk size + 2，继续接收
-                    while((int)nowBuf.size() < chunkSize + 2)
-                    {
-                        logger.debug("[S <- C] More data needed to get next chunk, just recv");                        
-                        char buf[bufferSize] = {0};
-                        int recvLen = recv(clientSocket, buf, bufferSize , 0);
-                        if(recvLen <= 0)
-                        {
-                            // 连接断开
-                            logger.debug("[S <- C] Connection closed by client.");
-                            return false;
-                        }
-                        nowBuf.append(string(buf, recvLen));
-                        logger.debug("[S <- C] Recv %d, now data size in buffer: %d", recvLen, nowBuf.size());
-                    }
-
-                    // 切分出这一块chunk的数据，放入bodyData
-                    // 跳过\r\n，继续下一次循环
-                    packet.bodyData.append(chunkSizeStr + "\r\n");
-                    packet.bodyData.append(nowBuf.substr(0, chunkSize));
-                    packet.bodyData.append("\r\n");
-
-                    nowBuf = nowBuf.substr(chunkSize + 2);
-                    logger.debug("[S <- C] Recv chunk: %d bytes", chunkSize);      
+                    logger.error("%s Fail to forward body data.", tag);
+                    return false;
                 }
             }
-        }
-        else if(packet.headers.find("Content-Length") != packet.headers.end())
-        {
-            // 非chunked模式，不过有Content-Length，检查长度是否完整
-            string contentLength = packet.headers["Content-Length"];
-            if(isNumeric(contentLength))
+            else if(len > 0 && !filter)
+            {
+                if(!SendAll(toSocket, buf.data(), len))
+                {
+                    logger.error("%s Fail to forward body data.", tag);
+                    return false;
+                }
+                proxyStats.copiedBodyBytes += len;
+            }
+            if(len > 0)
+            {
+                buf.erase(0, len);
+                framer.discard(len);
+            }
+            if(res == HttpFramer::Result::Complete)
             {
-                int receivedLen = packet.bodyData.size();
-                int realLen = std::stoi(contentLength);
-                logger.debug("[S <- C] Content-Length: %d, Received: %d", realLen, receivedLen);
+                if(splicedBytes > 0)
+                    logger.debug("%s %llu body bytes relayed by splice().", tag, (unsigned long long)splicedBytes);
+                return true;
+            }
 
-                if(realLen > receivedLen)
+            // 固定长度的body、chunk数据、读到关闭为止的body都可以零拷贝搬运，chunk size行仍然走recv
+            size_t bodyRemains = framer.getBodyRemains();
+            if(useSplice && buf.empty() && bodyRemains > 0)
+            {
+                ssize_t moved = SpliceRelay(fromSocket, toSocket, bodyRemains);
+                if(moved > 0)
+                {
+                    framer.skipBody(moved);
+                    splicedBytes += moved;
+                    continue;
+                }
+                if(moved == 0)
+                {
+                    logger.debug("%s Connection closed by %s.", tag, fromSocket == clientSocket ? "client" : "server");
+                    return (peerClosed = framer.finishOnClose());
+                }
+                if(moved != SpliceUnavailable)
+                {
+                    logger.error("%s Fail to forward body data.", tag);
+                    return false;
+                }
+                logger.debug("%s splice() unavailable, fallback to recv/send.", tag);
+                useSplice = false;
+            }
+            if(!recvMore(fromSocket, buf, tag))
+            {
+                peerClosed = framer.finishOnClose();
+                // 读到连接关闭为止的body在这里结束，过滤插件输出剩余的内容
+                if(peerClosed && filter)
                 {
-                    // content-length还有剩余，接收剩余的body
-                    int remains = realLen - receivedLen;
-                    logger.debug("[S <- C] More bytes remain to recv: %d", remains);
-                    // 循环接收，每次将接收到的数据添到bodyData后面，直到remains为0
-                    while(remains > 0)
-                    {
-                        memset(buf, 0, bufferSize);
-                        int toRecv = bufferSize < remains ? bufferSize : remains;
-                        int recvLen = recv(clientSocket, buf, toRecv , 0);
-                        if(recvLen <= 0)
-                        {
-                            // 连接断开
-                            logger.debug("[S <- C] Connection closed by client.");
-                            return false;
-                        }
-                        packet.bodyData = packet.bodyData + buf;
-                        remains -= recvLen;
-                        logger.debug("[S <- C] Recved %d, remain %d", recvLen, remains);
-                    }
+                    encoded.clear();
+                    filter->filterChunked(decoded.data(), decoded.size(), true, encoded);
+                    return SendAll(toSocket, encoded.data(), encoded.size());
                 }
+                return peerClosed;
+            }
+        }
+    }
+
+    // 发送请求到服务器。池中取出的连接可能恰好被服务器关闭了，此时换一个新连接重发
+    bool sendToServer(HttpRequestPacket &packet)
+    {
+        serverReusable = false;
+        bool sent = packet.sendTo(serverSocket, true);
+        if(!sent && pooledConn && pending.empty())
+        {
+            logger.debug("[S <- C] Pooled server connection is stale, reconnecting...");
+            close(serverSocket);
+            serverSocket = 0;
+            sent = connectToServer(backend, false) && packet.sendTo(serverSocket, true);
+        }
+        pooledConn = false;
+        if(!sent)
+            upstreamGroup.reportFailure(backend, "send failed");
+        return sent;
+    }
+
+    // 为请求选择后端，需要时换一个上游连接
+    // 上一个请求的响应还没有收完时，只能继续发给同一个后端
+    bool selectBackend(HttpRequestPacket &packet)
+    {
+        if(serverSocket > 0 && !pending.empty())
+            return true;
+        // 连接失败时换一个后端再试，每个后端最多试一次
+        size_t attempts = upstreamGroup.getBackends().size();
+        for(size_t n = 0; n < attempts; ++n)
+        {
+            Backend *target = upstreamGroup.select(clientInAddr, packet.uri);
+            if(serverSocket > 0 && target == backend)
+                return true;
+            releaseServer();
+            if(connectToServer(target))
+            {
+                logger.debug("Connected to server %s.", target->hostStr.c_str());
+                return true;
+            }
+            logger.error("Failed to connect to server %s.", target->hostStr.c_str());
+            upstreamGroup.reportFailure(target, "connect failed");
+            close(serverSocket);
+            serverSocket = 0;
+        }
+        return false;
+    }
+
+    // 用缓存中的响应回复客户端
+    bool replyFromCache(const CacheRequest &cacheReq, const CachedResponse &cached)
+    {
+        string head;
+        bool withBody = cached.buildResponse(cacheReq, time(NULL), head);
+        logger.info("[S -> C] %s (cache hit)", head.substr(0, head.find('\r')).c_str());
+        // body在磁盘缓存中时，响应头之后用sendfile直接从slab文件发送
+        bool fromFile = withBody && cached.bodyFd >= 0;
+        iovec iov[2] = {{(void *)head.data(), head.size()},
+            {(void *)cached.bodyData(), withBody && !fromFile ? cached.bodySize() : 0}};
+        if(!SendIovec(clientSocket, iov, 2)
+            || (fromFile && !SendFile(clientSocket, cached.bodyFd, cached.bodyOffset, cached.bodySize())))
+        {
+            logger.error("[S -> C] Fail to send data to client.");
+            return false;
+        }
+        return true;
+    }
+
+    // 处理客户端请求
+    bool processClientRequest()
+    {
+        logger.debug("[S <- C] Client request received.");
+
+        // 接收完整的请求头，mainLoop中已经推进过的部分不会重新扫描
+        HttpFramer &framer = requestFramer;
+        if(!recvHeader(clientSocket, clientBuf, framer, "[S <- C]"))
+        {
+            if(framer.isFailed() && pending.empty())
+                SendAll(clientSocket, BadRequestResponse, strlen(BadRequestResponse));
+            return false;
+        }
+        size_t headerLen = framer.getHeaderLength();
+        HttpRequestPacket packet(clientBuf.substr(0, headerLen));
+
+        // 没有插件需要完整的body时，先转发请求头，body收到多少转发多少
+        bool streaming = config->streamBody && framer.getBodyMode() != HttpFramer::BodyMode::None
+            && !PluginsWantRequestBody(&packet);
+        bool peerClosed = false;
+        if(!streaming)
+        {
+            // 接收完整的请求
+            if(!recvBody(clientSocket, clientBuf, framer, "[S <- C]", peerClosed))
+                return false;
+            size_t len = framer.getLength();
+            packet = HttpRequestPacket(clientBuf.substr(0, len));
+            clientBuf.erase(0, len);
+            framer.reset(false);
+            logger.debug("[S <- C] Finished recv from client");
+        }
+        else
+        {
+            clientBuf.erase(0, headerLen);
+            framer.discard(headerLen);
+        }
+        logger.info("[S <- C] %s", packet.requestLine.c_str());
+
+        // 缓存中有新鲜的响应时直接回复，不经过上游和插件；前面的请求还在等响应时不能插队
+        CacheRequest cacheReq;
+        responseCache.prepare(packet, cacheReq);
+        if(!streaming && pending.empty())
+        {
+            shared_ptr<const CachedResponse> cached = responseCache.lookup(cacheReq);
+            // 其他请求正在获取同一个响应时，等它完成后再查一次
+            if(!cached && responseCache.joinFetch(cacheReq))
+            {
+                responseCache.waitFetch(cacheReq);
+                cached = responseCache.lookup(cacheReq);
             }
+            if(cached)
+                return replyFromCache(cacheReq, *cached) && packet.isKeepAlive();
         }
-        // 接收完毕
-        logger.debug("[S <- C] Finished recv from client");
+
+        if(!selectBackend(packet))
+            return false;
 
         // 重写headers里的Host
-        oldHostStr = packet.headers["Host"];
-        packet.headers["Host"] = targetStr;
-        logger.debug("[S <- C] Rewrite Host: %s -> %s", oldHostStr.c_str(), targetStr.c_str());
+        PendingRequest request(packet, std::move(cacheReq));
+        packet.headers["Host"] = backend->hostStr;
+        logger.debug("[S <- C] Rewrite Host: %s -> %s", request.clientHost.c_str(), backend->hostStr.c_str());
 
         // 调用插件
         PluginsCallClientRequest(&packet);
 
         // send
         logger.debug("[S <- C] Send request to server.");
-        if(!packet.sendTo(serverSocket, true))
+        if(!sendToServer(packet))
         {
             logger.error("[S <- C] Fail to send data to target server.");
             return false;
         }
+        PluginsObserveRequest(&packet);
+        if(streaming)
+        {
+            logger.debug("[S <- C] Streaming request body to server.");
+            if(!forwardBody(clientSocket, serverSocket, clientBuf, framer, "[S <- C]", peerClosed))
+                return false;
+            framer.reset(false);
+        }
+        if(!pending.empty())
+            ++proxyStats.pipelinedRequests;
+        ++proxyStats.forwardedRequests;
+        pending.push_back(std::move(request));
+        UpstreamGroup::beginRequest(backend);
+        requestKeepAlive = packet.isKeepAlive();
         return true;
     }
 
@@ -345,145 +461,74 @@ public:
     bool processServerResponse()
     {
         logger.debug("[S -> C] Server response received.");
+        serverReusable = false;
 
-        // recv
-        char buf[bufferSize] = {0};
-        int recvLen = recv(serverSocket, buf, bufferSize, 0);
-
-        if (recvLen <= 0)   // 连接断开
+        // 响应与最早转发、还没有收到响应的请求配对，HEAD请求的响应没有body
+        PendingRequest *request = pending.empty() ? nullptr : &pending.front();
+        const string requestUri = request ? request->uri : string();
+        HttpFramer framer(true, request && request->head);
+        if(!recvHeader(serverSocket, serverBuf, framer, "[S -> C]"))
         {
-            logger.debug("[S -> C] Connection closed by server.");
+            if(request)
+                upstreamGroup.reportFailure(backend, "no response");
             return false;
         }
-        logger.debug("[S -> C] Recv %d bytes from server.", recvLen);
-
-        // 拆分响应数据
-        HttpResponsePacket packet(string(buf, recvLen));
-        logger.info("[S -> C] %s", packet.responseLine.c_str());
-
-        // 如果响应过长，接收剩余的body
-        if(packet.headers.find("Transfer-Encoding") != packet.headers.end())
+        size_t headerLen = framer.getHeaderLength();
+        HttpResponsePacket packet(serverBuf.substr(0, headerLen));
+
+        // 没有插件需要完整的body、响应也不需要存入缓存时，先转发响应头，body收到多少转发多少
+        bool lengthKnown = framer.getBodyMode() != HttpFramer::BodyMode::UntilClose;
+        CacheRequest *cacheReq = request ? &request->cache : nullptr;
+        bool toCache = cacheReq && responseCache.wantResponse(*cacheReq, packet, lengthKnown);
+        // 不能缓存的响应，马上让等待同一个响应的请求各自转发
+        if(cacheReq && !toCache && packet.code >= 200)
+            cacheReq->fetch.reset();
+        // 有插件要逐段改写body时，客户端不支持chunked就只能收完整个响应，改写后重新设置长度
+        bool hasBody = framer.getBodyMode() != HttpFramer::BodyMode::None;
+        unique_ptr<BodyFilter> bodyFilter = hasBody ? PluginsStartBodyFilter(&packet, requestUri) : nullptr;
+        bool streaming = config->streamBody && hasBody && !toCache && !PluginsWantResponseBody(&packet, requestUri)
+            && !(bodyFilter && !(request && request->acceptChunked));
+        bool peerClosed = false;
+        if(!streaming)
         {
-            // 给出了Transfer-Encoding，检查是否为chunked模式
-            string encoding = packet.headers["Transfer-Encoding"];
-            logger.debug("[S -> C] Transfer-Encoding: %s", encoding.c_str());
-            if(encoding.find("chunked") != std::string::npos)
-            {
-                // chunked模式，分块接收
-                logger.debug("[S -> C] Chunked mode detected.");
-                string nowBuf = packet.bodyData;
-                packet.bodyData = "";
-
-                // 循环处理，每次先读取一个chunk size，再根据size读取对应长度的数据块，直到size为0表示结束
-                while(true)
-                {
-                    // 如果此时数据都不足以表示一个chunk size，先recv到足够为止
-                    while(nowBuf.find("\r\n") == std::string::npos)
-                    {
-                        logger.debug("[S -> C] More data needed to get a chunk size, just recv");
-                        char buf[bufferSize] = {0};
-                        int recvLen = recv(serverSocket, buf, bufferSize , 0);
-                        if(recvLen <= 0)
-                        {
-                            // 连接断开
-                            logger.debug("[S -> C] Connection closed by server.");
-                            return false;
-                        }
-                        nowBuf.append(string(buf, recvLen));
-                        logger.debug("[S -> C] Recv %d, now data size in buffer: %d", recvLen, nowBuf.size());
-                    }
-
-                    // 切分出头部的chunk size（16进制表示）
-                    auto chunkSizeDataSplit = nowBuf.find("\r\n");
-                    string chunkSizeStr = nowBuf.substr(0, chunkSizeDataSplit);
-                    int chunkSize = std::stoi(chunkSizeStr, 0, 16);
-                    nowBuf = nowBuf.substr(chunkSizeDataSplit + 2);
-
-                    // 如果chunk size为0，表示传输结束
-                    if(chunkSize == 0)
-                    {
-                        logger.debug("[S -> C] Chunk transfer finished.");
-                        packet.bodyData.append("0\r\n\r\n");
-                        break;
-                    }
-                    else
-                        logger.debug("[S -> C] Next chunk size: %d", chunkSize);
-
-                    // 如果此时缓冲区内剩下的数据长度不够chunk size + 2，继续接收
-                    while((int)nowBuf.size() < chunkSize + 2)
-                    {
-                        logger.debug("[S -> C] More data needed to get next chunk, just recv");                        
-                        char buf[bufferSize] = {0};
-                        int recvLen = recv(serverSocket, buf, bufferSize , 0);
-                        if(recvLen <= 0)
-                        {
-                            // 连接断开
-                            logger.debug("[S -> C] Connection closed by server.");
-                            return false;
-                        }
-                        nowBuf.append(string(buf, recvLen));
-                        logger.debug("[S -> C] Recv %d, now data size in buffer: %d", recvLen, nowBuf.size());
-                    }
-
-                    // 切分出这一块chunk的数据，放入bodyData
-                    // 跳过\r\n，继续下一次循环
-                    packet.bodyData.append(chunkSizeStr + "\r\n");
-                    packet.bodyData.append(nowBuf.substr(0, chunkSize));
-                    packet.bodyData.append("\r\n");
-
-                    nowBuf = nowBuf.substr(chunkSize + 2);
-                    logger.debug("[S -> C] Recv chunk: %d bytes", chunkSize);
-                }
-            }
+            // 接收完整的响应
+            if(!recvBody(serverSocket, serverBuf, framer, "[S -> C]", peerClosed))
+                return false;
+            size_t len = framer.getLength();
+            packet = HttpResponsePacket(serverBuf.substr(0, len));
+            serverBuf.erase(0, len);
+            logger.debug("[S -> C] Finished recv from server");
         }
-        else if(packet.headers.find("Content-Length") != packet.headers.end())
+        else
         {
-            // 非chunked模式，不过有Content-Length，检查长度是否完整
-            string contentLength = packet.headers["Content-Length"];
-            if(isNumeric(contentLength))
-            {
-                int receivedLen = packet.bodyData.size();
-                int realLen = std::stoi(contentLength);
-                logger.debug("[S -> C] Content-Length: %d, Received: %d", realLen, receivedLen);
-
-                if(realLen > receivedLen)
-                {
-                    // content-length还有剩余，接收剩余的body
-                    int remains = realLen - receivedLen;
-                    logger.debug("[S -> C] More bytes remain to recv: %d", remains);
-                    // 循环接收，每次将接收到的数据添到bodyData后面，直到remains为0
-                    while(remains > 0)
-                    {
-                        memset(buf, 0, bufferSize);
-                        int toRecv = bufferSize < remains ? bufferSize : remains;
-                        int recvLen = recv(serverSocket, buf, toRecv , 0);
-                        if(recvLen <= 0)
-                        {
-                            // 连接断开
-                            logger.debug("[S -> C] Connection closed by server.");
-                            return false;
-                        }
-                        packet.bodyData.append(string(buf, recvLen));
-                        remains -= recvLen;
-                        logger.debug("[S -> C] Recved %d, remain %d", recvLen, remains);
-                    }
-                }
-            }
+            serverBuf.erase(0, headerLen);
+            framer.discard(headerLen);
         }
-        // 接收完毕
-        logger.debug("[S -> C] Finished recv from server");
+        if(request)
+            logger.info("[S -> C] %s (%s, %ld ms)", packet.responseLine.c_str(), request->requestLine.c_str(),
+                request->elapsedMs());
+        else
+            logger.info("[S -> C] %s", packet.responseLine.c_str());
 
         // 处理301和302
-        // （改写Location为之前存的oldHostStr）
-        if(packet.code == 301 || packet.code == 302)
+        // （改写Location为对应请求原来的Host）
+        if((packet.code == 301 || packet.code == 302) && request)
         {
-            ReplaceStr(packet.headers["Location"], targetHost, oldHostStr);
-            logger.debug("[S -> C] %d redirect, rewrite Location: %s -> %s", packet.code, targetHost, oldHostStr);
+            ReplaceStr(packet.headers["Location"], backend->host, request->clientHost);
+            logger.debug("[S -> C] %d redirect, rewrite Location: %s -> %s", packet.code,
+                backend->host.c_str(), request->clientHost.c_str());
         }
 
+        // 判断连接能否复用要在插件修改之前
+        bool keepAlive = packet.isKeepAlive();
+
         // 调用插件
-        PluginsCallServerResponse(&packet);
-        
+        PluginsCallServerResponse(&packet, requestUri);
+        if(!streaming && hasBody)
+            PluginsFinishBody(&packet, bodyFilter.get());
+        else if(bodyFilter)
+            BodyFilter::UseChunked(&packet);
+
         // send
         logger.debug("[S -> C] Send response to client.");
         if(!packet.sendTo(clientSocket, true))
@@ -491,7 +536,28 @@ public:
             logger.error("[S -> C] Fail to send data to client.");
             return false;
         }
-        return true;
+        PluginsObserveResponse(&packet, requestUri, request ? request->elapsedMs() : 0);
+        if(toCache)
+            responseCache.store(*cacheReq, packet);
+        if(streaming)
+        {
+            logger.debug("[S -> C] Streaming response body to client.");
+            if(!forwardBody(serverSocket, clientSocket, serverBuf, framer, "[S -> C]", peerClosed, bodyFilter.get()))
+                return false;
+        }
+
+        // 1xx临时响应之后，同一个请求还会有最终响应（101切换协议除外，它就是最终响应）
+        if(request && (packet.code < 100 || packet.code >= 200 || packet.code == 101))
+        {
+            pending.pop_front();
+            UpstreamGroup::endRequest(backend);
+            upstreamGroup.reportSuccess(backend);
+        }
+        // 没有body长度的响应要读到连接关闭为止，连接不能复用
+        serverReusable = (pending.empty() && lengthKnown && requestKeepAlive && keepAlive);
+
+        // 服务器已经关闭了连接，响应发完后结束
+        return !peerClosed;
     }
 
     // 循环监听
@@ -499,10 +565,29 @@ public:
     {
         while (true)
         {
+            // 上次多收到的数据先处理掉：流水线发来的完整请求马上转发，已经收到的响应马上发回
+            // 等待响应的请求太多时先不处理后面的请求
+            bool acceptRequest = pending.size() < MaxPipelineDepth;
+            if(acceptRequest && hasCompleteHeader())
+            {
+                if(!processClientRequest())
+                    break;
+                continue;
+            }
+            if(!serverBuf.empty())
+            {
+                if(!processServerResponse())
+                    break;
+                continue;
+            }
+
+            // 上游连接在收到第一个请求、选好后端之后才建立
             fd_set readFds;
             FD_ZERO(&readFds);
-            FD_SET(clientSocket, &readFds);
-            FD_SET(serverSocket, &readFds);
+            if(acceptRequest)
+                FD_SET(clientSocket, &readFds);
+            if(serverSocket > 0)
+                FD_SET(serverSocket, &readFds);
 
             int maxFd = std::max(clientSocket, serverSocket) + 1;
             if (select(maxFd, &readFds, nullptr, nullptr, nullptr) < 0)
@@ -518,8 +603,17 @@ public:
                     break;
             }
 
-            if (FD_ISSET(serverSocket, &readFds))
+            if (serverSocket > 0 && FD_ISSET(serverSocket, &readFds))
             {
+                // 没有等待中的响应时服务器关闭了连接，下一个请求再重新连接
+                char c;
+                if(pending.empty() && recv(serverSocket, &c, 1, MSG_PEEK) <= 0)
+                {
+                    logger.debug("Idle server connection closed by server.");
+                    serverReusable = false;
+                    releaseServer();
+                    continue;
+                }
                 // server -> client
                 if(!processServerResponse())
                     break;
@@ -527,6 +621,16 @@ public:
         }
     }
 
+    // clientBuf开头是否已经有一个完整的请求头（或者已经可以判定是错误的请求）
+    // requestFramer只推进上次之后新收到的数据，请求头分几次到达时不会从头重新扫描
+    bool hasCompleteHeader()
+    {
+        if(clientBuf.empty())
+            return false;
+        return requestFramer.advance(clientBuf.data(), clientBuf.size()) != HttpFramer::Result::NeedMore
+            || requestFramer.headerComplete();
+    }
+
     // 获取客户端地址字符串
     string getClientAddr()
     {
@@ -539,6 +643,7 @@ struct ClientThreadData
 {
     int clientSocket;
     sockaddr_in clientAddr;
+    shared_ptr<const ProxyConfig> config;
 };
 
 // 工作线程
@@ -550,20 +655,14 @@ void ClientThreadFunc(void *data)
 
     // 创建logger
     Logger logger;
-    logger.setLogLevel(logLevel);
+    logger.setLogLevel(threadData->config->logLevel);
 
     // 初始化worker
-    ProxyClientWorker worker(clientSocket, clientAddr, logger);
+    ProxyClientWorker worker(clientSocket, clientAddr, threadData->config, logger);
     logger.setPrefix(worker.getClientAddr());
 
-    // 连接到服务器
+    // 上游连接在收到第一个请求时按负载均衡策略建立
     logger.info("New connection received.");
-    if(!worker.connectToServer(targetHost, targetPort))
-    {
-        logger.error("Failed to connect to target server.");
-        return;
-    }
-    logger.info("Connected to server.");
 
     // 循环监听
     worker.mainLoop();
@@ -572,12 +671,77 @@ void ClientThreadFunc(void *data)
     delete threadData;
 }
 
+// 循环监听客户端，每个连接作为一个任务交给线程池
+template<typename Pool>
+void AcceptClients(int listenSocket, Pool &threadPool)
+{
+    while (true)
+    {
+        sockaddr_in clientAddr;
+        socklen_t addrLen = sizeof(clientAddr);
+        int clientSocket = accept(listenSocket, (sockaddr *)&clientAddr, &addrLen);
+        if (clientSocket < 0)
+        {
+            mainLogger.error("Fail to recv connection from client");
+            continue;
+        }
+        // 连接取得当前的配置，之后重新加载配置不影响这个连接
+        ClientThreadData *threadData = new ClientThreadData{clientSocket, clientAddr, CurrentConfig()};
+
+        // 插入任务到线程池，任务队列已满时拒绝连接
+        if(!threadPool.addTask(ClientThreadFunc, threadData))
+        {
+            mainLogger.warn("Task queue is full, connection refused.");
+            close(clientSocket);
+            delete threadData;
+        }
+    }
+}
+
+// 收到SIGHUP重新读取配置之后调用：重新扫描插件目录，加载新增和修改过的插件
+static void OnConfigReloaded(const ProxyConfig &config)
+{
+    LoadPlugins(PLUGINS_DIR, CONFIG_FILE_PATH, config.pluginPriority);
+    StartPluginObservers(config.observerThreads, config.observerMaxQueued, config.logLevel);
+}
+
 int main(int argc, char *argv[])
 {
     // 读配置文件
-    if(!ReadConfigFile())
+    shared_ptr<ProxyConfig> loaded = make_shared<ProxyConfig>();
+    string configError;
+    if(!LoadConfig(CONFIG_FILE_PATH, *loaded, configError))
+    {
+        std::cerr << "[ERROR] " << configError << endl;
         return 1;
+    }
+    PublishConfig(loaded);
+    const ProxyConfig &config = *loaded;
+    Logger::LogLevel logLevel = config.logLevel;
     mainLogger.setLogLevel(logLevel);
+    // 在创建其他线程之前启动，收到SIGHUP时重新加载配置和插件
+    StartConfigReloader(CONFIG_FILE_PATH, logLevel, OnConfigReloaded);
+    BufferPool::init(config.bufferSize);
+    healthChecker.init(config.healthCheckEnable, config.healthCheckInterval, config.healthCheckTimeout,
+        config.healthCheckPath, config.healthCheckExpectStatus, config.healthCheckRise, config.healthCheckFall, logLevel);
+    // 磁盘缓存打不开时只用内存缓存
+    if(!diskCache.init(config.cacheEnable && config.cacheDiskEnable, config.cacheDiskPath,
+        (size_t)config.cacheDiskSize << 20, (size_t)config.cacheDiskSlabSize << 20,
+        (size_t)config.cacheDiskMaxObjectSize << 20, logLevel))
+        mainLogger.warn("Disk cache disabled.");
+    // 没有后台验证线程时不使用过期的响应
+    int cacheStaleTime = config.cacheStaleTime;
+    revalidator.init(logLevel);
+    if(config.cacheEnable && cacheStaleTime > 0 && !revalidator.start())
+        cacheStaleTime = 0;
+    responseCache.init(config.cacheEnable, (size_t)config.cacheMaxSize << 20, (size_t)config.cacheMaxObjectSize << 10,
+        config.cacheShards, cacheStaleTime, config.cacheCollapse, logLevel);
+    upstreamPool.init(config.poolEnable, config.poolMaxIdle, config.poolMaxPerHost, config.poolIdleTimeout);
+    resolver.init(config.resolverCacheTtl, config.resolverNegativeTtl, config.resolverTimeout, logLevel);
+    resolver.start();
+
+    // splice()写到已关闭的socket时会触发SIGPIPE，忽略掉，由返回值处理错误
+    signal(SIGPIPE, SIG_IGN);
 
     // 创建套接字监听
     int listenSocket = socket(AF_INET, SOCK_STREAM, 0);
@@ -585,48 +749,69 @@ int main(int argc, char *argv[])
     // 设置REUSERADDR，方便崩溃后快速重启
     int on = 1;
     setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    // 每个事件循环各自监听时，所有监听socket都需要设置SO_REUSEPORT
+    if(config.engineMode == EngineMode::EventLoop && config.reusePort)
+        setsockopt(listenSocket, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
 
     // 填充地址，绑定
     sockaddr_in listenAddr;
     listenAddr.sin_family = AF_INET;
-    listenAddr.sin_port = htons(listenPort);
-    listenAddr.sin_addr.s_addr = inet_addr(listenHost.c_str());
+    listenAddr.sin_port = htons(config.listenPort);
+    listenAddr.sin_addr.s_addr = inet_addr(config.listenHost.c_str());
     if (bind(listenSocket, (sockaddr *)&listenAddr, sizeof(listenAddr)) < 0)
     {
-        mainLogger.error("Failed to bind to port %d", listenPort);
+        mainLogger.error("Failed to bind to port %d", config.listenPort);
         return 2;
     }
-    if (listen(listenSocket, 5) < 0)
+    if (listen(listenSocket, config.maxListen) < 0)
     {
-        mainLogger.error("Failed to listen on port %d", listenPort);
+        mainLogger.error("Failed to listen on port %d", config.listenPort);
         return 3;
     }
 
-    // 创建线程池
-    ThreadPool threadPool(minThread, maxThread, waitBeforeShrink);
-
     // 加载插件
-    LoadPlugins(PLUGINS_DIR, CONFIG_FILE_PATH);
-
-    mainLogger.info("Reverse proxy for %s:%d", targetHost.c_str(), targetPort);
-    mainLogger.info("Proxy started at %s:%d", (listenHost == "0.0.0.0" ? "localhost" : listenHost.c_str()),
-        listenPort);
-
-    // 循环监听客户端
-    while (true)
+    LoadPlugins(PLUGINS_DIR, CONFIG_FILE_PATH, config.pluginPriority);
+    StartPluginObservers(config.observerThreads, config.observerMaxQueued, logLevel);
+    StartStatsReporter(config.statsInterval, logLevel);
+    // 预先解析后端地址，之后的连接直接使用缓存
+    UpstreamGroup &upstreamGroup = *config.upstream;
+    for(Backend *backend : upstreamGroup.getBackends())
     {
-        sockaddr_in clientAddr;
-        socklen_t addrLen = sizeof(clientAddr);
-        int clientSocket = accept(listenSocket, (sockaddr *)&clientAddr, &addrLen);
-        if (clientSocket < 0)
-        {
-            mainLogger.error("Fail to recv connection from client");
-            continue;
-        }
-        ClientThreadData *threadData = new ClientThreadData{clientSocket, clientAddr};
+        resolver.prewarm(backend->host);
+        mainLogger.info("Reverse proxy for %s:%d, weight %d", backend->host.c_str(), backend->port, backend->weight);
+    }
+    if(upstreamGroup.getBackends().size() > 1)
+        mainLogger.info("Load balancing policy: %s", upstreamGroup.getPolicyName());
+    healthChecker.start();
+    mainLogger.info("Proxy started at %s:%d", (config.listenHost == "0.0.0.0" ? "localhost" : config.listenHost.c_str()),
+        config.listenPort);
+    mainLogger.debug("Delimiter scanner: %s", GetScanner().name);
+
+    if(config.engineMode == EngineMode::EventLoop)
+    {
+        // 事件循环模式
+        mainLogger.info("Engine: EventLoop, %d loop threads", config.loopThreads);
+        EventLoopOptions options{config.loopThreads, logLevel,
+            config.reusePort, config.pinCpu, listenAddr, config.maxListen};
+        RunEventLoops(listenSocket, options);
+
+        close(listenSocket);
+        UnloadPlugins();
+        return 4;
+    }
 
-        // 插入任务到线程池
-        threadPool.addTask(ClientThreadFunc, threadData);
+    // 线程池模式
+    if(config.workStealing)
+    {
+        mainLogger.info("Engine: ThreadPool (work stealing)");
+        WorkStealingPool threadPool(config.minThread, config.maxThread, config.waitBeforeShrink);
+        AcceptClients(listenSocket, threadPool);
+    }
+    else
+    {
+        mainLogger.info("Engine: ThreadPool");
+        ThreadPool threadPool(config.minThread, config.maxThread, config.waitBeforeShrink);
+        AcceptClients(listenSocket, threadPool);
     }
 
     close(listenSocket);
@@ -0,0 +1,196 @@
+#include "Resolver.h"
+#include <cstring>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "Stats.h"
+using namespace std;
+
+Resolver resolver;
+
+static string AddrToStr(const in_addr &addr)
+{
+    char buf[INET_ADDRSTRLEN] = {0};
+    inet_ntop(AF_INET, &addr, buf, sizeof(buf));
+    return buf;
+}
+
+// 后台解析线程函数
+void* funcInResolver(void* data)
+{
+    ((Resolver *)data)->run();
+    return NULL;
+}
+
+void Resolver::init(int cacheTtl, int negativeTtl, int timeout, Logger::LogLevel logLevel)
+{
+    this->cacheTtl = cacheTtl > 0 ? cacheTtl : 1;
+    this->negativeTtl = negativeTtl > 0 ? negativeTtl : 0;
+    this->timeout = timeout > 0 ? timeout : 1;
+    logger.setLogLevel(logLevel);
+    logger.setPrefix("Resolver");
+}
+
+bool Resolver::start()
+{
+    pthread_t threadId;
+    if(pthread_create(&threadId, NULL, funcInResolver, this) != 0)
+    {
+        logger.warn("Fail to start resolver thread, resolving synchronously.");
+        return false;
+    }
+    pthread_detach(threadId);
+    started = true;
+    return true;
+}
+
+bool Resolver::prewarm(const string &host)
+{
+    in_addr addr;
+    if(inet_pton(AF_INET, host.c_str(), &addr) > 0)
+        return true;
+
+    vector<in_addr> addrs;
+    bool ok = lookup(host, addrs);
+    locker.lock();
+    store(host, addrs, ok);
+    locker.unlock();
+    if(ok)
+        logger.info("%s resolved, %d address(es), first: %s", host.c_str(), (int)addrs.size(),
+            AddrToStr(addrs[0]).c_str());
+    else
+        logger.warn("Fail to resolve domain: %s", host.c_str());
+    return ok;
+}
+
+bool Resolver::resolve(const string &host, in_addr &addr, bool wait)
+{
+    // 本身就是IP，不需要解析
+    if(inet_pton(AF_INET, host.c_str(), &addr) > 0)
+        return true;
+
+    time_t now = time(NULL);
+    locker.lock();
+    Entry &entry = cache[host];
+    if(!entry.addrs.empty())
+    {
+        // 有缓存的地址就直接用，快过期或已过期时让后台刷新
+        if(now >= entry.expires - cacheTtl / 4)
+            enqueue(host, entry);
+        addr = entry.addrs[entry.next++ % entry.addrs.size()];
+        locker.unlock();
+        ++proxyStats.dnsCacheHits;
+        return true;
+    }
+    if(entry.failed && now < entry.expires)
+    {
+        // 最近解析失败过，暂时不再重试
+        locker.unlock();
+        ++proxyStats.dnsCacheHits;
+        return false;
+    }
+    ++proxyStats.dnsCacheMisses;
+
+    if(!started)
+    {
+        // 没有后台线程时只能同步解析
+        locker.unlock();
+        vector<in_addr> addrs;
+        bool ok = lookup(host, addrs);
+        locker.lock();
+        store(host, addrs, ok);
+        if(ok)
+            addr = addrs[0];
+        locker.unlock();
+        return ok;
+    }
+
+    enqueue(host, entry);
+    if(!wait)
+    {
+        locker.unlock();
+        return false;
+    }
+
+    // 等待后台线程解析完成
+    time_t deadline = now + timeout;
+    while(entry.pending && time(NULL) < deadline)
+        doneCond.wait(locker, 1);
+    bool ok = !entry.addrs.empty();
+    if(ok)
+        addr = entry.addrs[entry.next++ % entry.addrs.size()];
+    locker.unlock();
+    return ok;
+}
+
+void Resolver::enqueue(const string &host, Entry &entry)
+{
+    if(entry.pending)
+        return;
+    entry.pending = true;
+    queue.push_back(host);
+    queueCond.notifyOne();
+}
+
+void Resolver::store(const string &host, const vector<in_addr> &addrs, bool ok)
+{
+    Entry &entry = cache[host];
+    time_t now = time(NULL);
+    entry.pending = false;
+    entry.failed = !ok;
+    if(ok)
+    {
+        entry.addrs = addrs;
+        entry.resolvedAt = now;
+        entry.expires = now + cacheTtl;
+    }
+    else if(entry.addrs.empty())
+        entry.expires = now + negativeTtl;
+    else
+    {
+        // 刷新失败时继续使用旧地址，稍后再试
+        entry.expires = now + negativeTtl + cacheTtl / 4;
+    }
+}
+
+bool Resolver::lookup(const string &host, vector<in_addr> &addrs)
+{
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *result = NULL;
+    if(getaddrinfo(host.c_str(), NULL, &hints, &result) != 0 || !result)
+        return false;
+    for(addrinfo *item = result; item; item = item->ai_next)
+        addrs.push_back(((sockaddr_in *)item->ai_addr)->sin_addr);
+    freeaddrinfo(result);
+    return !addrs.empty();
+}
+
+void Resolver::run()
+{
+    while(true)
+    {
+        locker.lock();
+        while(queue.empty())
+            queueCond.wait(locker, 60);
+        string host = queue.front();
+        queue.pop_front();
+        locker.unlock();
+
+        logger.debug("Resolving %s...", host.c_str());
+        vector<in_addr> addrs;
+        bool ok = lookup(host, addrs);
+        if(ok)
+            logger.debug("%s resolved, %d address(es), first: %s", host.c_str(), (int)addrs.size(),
+                AddrToStr(addrs[0]).c_str());
+        else
+            logger.warn("Fail to resolve domain: %s", host.c_str());
+
+        locker.lock();
+        store(host, addrs, ok);
+        doneCond.notifyAll();
+        locker.unlock();
+    }
+}
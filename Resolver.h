@@ -0,0 +1,84 @@
+/*
+ * 带缓存的域名解析
+ *
+ * 之前每个新连接都要调用一次gethostbyname（阻塞、不可重入，而且只取第一个地址）。
+ * 现在解析结果缓存在进程内，解析本身交给一个后台线程用getaddrinfo完成：
+ *
+ *   缓存命中             直接返回，多个地址时轮流使用
+ *   快过期（超过3/4 TTL） 仍然返回缓存的地址，同时让后台线程刷新
+ *   已过期               继续使用旧地址（解析失败时也不会丢掉），同时让后台线程刷新
+ *   解析失败             在NegativeTtl秒内直接返回失败，不重复解析
+ *   没有缓存             交给后台线程解析，最多等待Timeout秒（事件循环中不等待）
+ *
+ * 启动时会预先解析目标地址，正常工作时处理连接的线程不会因为域名解析而阻塞。
+ * getaddrinfo不提供记录的TTL，所以缓存时间由配置中的CacheTtl决定。
+*/
+
+#ifndef RESOLVER_BY_YQ
+#define RESOLVER_BY_YQ
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <ctime>
+#include <pthread.h>
+#include <netinet/in.h>
+#include "ThreadPool/mutex.h"
+#include "ThreadPool/condition_var.h"
+#include "Logger.h"
+
+class Resolver
+{
+private:
+    // 线程函数设友元以便访问私有成员
+    friend void* funcInResolver(void* data);
+
+    struct Entry
+    {
+        std::vector<in_addr> addrs;
+        time_t resolvedAt = 0;
+        time_t expires = 0;         // 超过这个时间需要重新解析
+        bool failed = false;        // 最近一次解析失败
+        bool pending = false;       // 已经在等待后台线程解析
+        unsigned next = 0;          // 下一次使用的地址
+    };
+
+    int cacheTtl = 60;
+    int negativeTtl = 5;
+    int timeout = 5;
+
+    std::map<std::string, Entry> cache;
+    std::deque<std::string> queue;
+    Mutex locker;
+    ConditionVar queueCond;         // 通知后台线程有新的解析任务
+    ConditionVar doneCond;          // 通知等待的线程解析完成
+    Logger logger;
+    bool started = false;
+
+public:
+    // 设置参数，在start之前调用
+    void init(int cacheTtl, int negativeTtl, int timeout, Logger::LogLevel logLevel);
+    // 启动后台解析线程
+    bool start();
+    // 同步解析并放入缓存（启动时预先解析用）
+    bool prewarm(const std::string &host);
+
+    // 解析host，结果放到addr中，失败返回false
+    // wait为false时，没有缓存就立即返回false（解析仍会在后台进行）
+    bool resolve(const std::string &host, in_addr &addr, bool wait = true);
+
+private:
+    void run();
+    // 调用getaddrinfo得到所有IPv4地址
+    static bool lookup(const std::string &host, std::vector<in_addr> &addrs);
+    // 保存解析结果，调用前需要持有locker
+    void store(const std::string &host, const std::vector<in_addr> &addrs, bool ok);
+    // 加入后台解析队列，调用前需要持有locker
+    void enqueue(const std::string &host, Entry &entry);
+};
+
+// 全局共享的解析器
+extern Resolver resolver;
+
+#endif
@@ -0,0 +1,443 @@
+#include "ResponseCache.h"
+#include <cstring>
+#include <strings.h>
+#include "HttpRequestPacket.h"
+#include "HttpResponsePacket.h"
+#include "Upstream.h"
+#include "DiskCache.h"
+#include "Revalidator.h"
+#include "Stats.h"
+using namespace std;
+
+ResponseCache responseCache;
+
+// 所有同名头部的值用逗号连起来（Cache-Control、Vary可能分成多行）
+static string JoinHeader(const HttpHeaders &headers, const char *name)
+{
+    string joined;
+    for(const string &value : headers.getAll(name))
+    {
+        if(!joined.empty())
+            joined += ",";
+        joined += value;
+    }
+    return joined;
+}
+
+// 按逗号拆开，去掉两边的空白
+static vector<string> SplitList(const string &str)
+{
+    vector<string> items;
+    size_t begin = 0;
+    while(begin <= str.size())
+    {
+        size_t end = str.find(',', begin);
+        if(end == string::npos)
+            end = str.size();
+        size_t first = str.find_first_not_of(" \t", begin);
+        if(first != string::npos && first < end)
+        {
+            size_t last = str.find_last_not_of(" \t", end - 1);
+            items.push_back(str.substr(first, last - first + 1));
+        }
+        begin = end + 1;
+    }
+    return items;
+}
+
+// Cache-Control中是否有某个指令，有值时放到value中（没有值或值不是数字时为-1）
+static bool FindDirective(const string &cacheControl, const char *name, long *value = nullptr)
+{
+    size_t nameLen = strlen(name);
+    for(const string &item : SplitList(cacheControl))
+    {
+        if(item.size() < nameLen || strncasecmp(item.c_str(), name, nameLen) != 0)
+            continue;
+        if(item.size() == nameLen)
+        {
+            if(value)
+                *value = -1;
+            return true;
+        }
+        if(item[nameLen] != '=')
+            continue;
+        if(value)
+        {
+            const char *num = item.c_str() + nameLen + 1;
+            if(*num == '"')
+                ++num;
+            *value = isdigit((unsigned char)*num) ? atol(num) : -1;
+        }
+        return true;
+    }
+    return false;
+}
+
+// 解析HTTP日期（RFC 1123格式），失败时返回-1
+static time_t ParseHttpDate(const string &str)
+{
+    tm tmValue;
+    memset(&tmValue, 0, sizeof(tmValue));
+    const char *end = strptime(str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tmValue);
+    if(!end)
+        return -1;
+    return timegm(&tmValue);
+}
+
+string MakeVariantKey(const string &baseKey, const vector<string> &varyNames, const HttpHeaders &headers)
+{
+    string key = baseKey;
+    for(const string &name : varyNames)
+    {
+        key += '\n';
+        key += name;
+        key += ':';
+        key += JoinHeader(headers, name.c_str());
+    }
+    return key;
+}
+
+bool CachedResponse::buildResponse(const CacheRequest &request, time_t now, string &out) const
+{
+    // 条件请求：ETag相符或没有修改过时回复304
+    bool notModified = false;
+    string ifNoneMatch = JoinHeader(request.headers, "If-None-Match");
+    if(!ifNoneMatch.empty())
+    {
+        if(!etag.empty())
+        {
+            for(const string &tag : SplitList(ifNoneMatch))
+            {
+                // 弱比较：忽略W/前缀
+                string a = (tag.compare(0, 2, "W/") == 0 ? tag.substr(2) : tag);
+                string b = (etag.compare(0, 2, "W/") == 0 ? etag.substr(2) : etag);
+                if(tag == "*" || a == b)
+                {
+                    notModified = true;
+                    break;
+                }
+            }
+        }
+    }
+    else if(lastModified > 0)
+    {
+        time_t since = ParseHttpDate(request.headers.get(HeaderId::IfModifiedSince));
+        notModified = (since >= lastModified);
+    }
+
+    long age = ageAtStore + (now - storedAt);
+    out = notModified ? notModifiedHead : head;
+    out += "Age: " + to_string(age) + "\r\n\r\n";
+    return !notModified && !request.head;
+}
+
+ResponseCache::~ResponseCache()
+{
+    for(Shard *shard : shards)
+        delete shard;
+}
+
+void ResponseCache::init(bool enabled, size_t maxSize, size_t maxObjectSize, int shardCount, int staleTime,
+    bool collapse, Logger::LogLevel logLevel)
+{
+    this->staleTime = staleTime > 0 ? staleTime : 0;
+    this->collapse = collapse;
+    this->enabled = enabled && (maxSize > 0 || diskCache.isEnabled());
+    this->maxSize = maxSize;
+    this->maxObjectSize = maxObjectSize;
+    if(shardCount <= 0)
+        shardCount = 1;
+    for(int i = 0; i < shardCount; ++i)
+        shards.push_back(new Shard());
+    shardMaxSize = maxSize / shardCount;
+    logger.setLogLevel(logLevel);
+    logger.setPrefix("Cache");
+}
+
+ResponseCache::Shard &ResponseCache::getShard(const string &baseKey)
+{
+    return *shards[HashBytes(baseKey.data(), baseKey.size()) % shards.size()];
+}
+
+void ResponseCache::prepare(const HttpRequestPacket &packet, CacheRequest &request) const
+{
+    request.lookup = request.store = false;
+    if(!enabled || (packet.method != "GET" && packet.method != "HEAD"))
+        return;
+    if(packet.headers.has("Authorization"))
+        return;
+    string cacheControl = JoinHeader(packet.headers, "Cache-Control");
+    if(FindDirective(cacheControl, "no-store"))
+        return;
+
+    // HEAD请求可以用GET的缓存回复，但HEAD的响应没有body，不存入缓存
+    request.head = (packet.method == "HEAD");
+    request.key = "GET " + packet.headers.get(HeaderId::Host) + " " + packet.uri;
+    request.uri = packet.uri;
+    request.headers = packet.headers;
+    request.store = !request.head;
+
+    // 客户端要求重新验证时不使用缓存，拿到的新响应仍然可以存入
+    long maxAge = -1;
+    bool noCache = FindDirective(cacheControl, "no-cache")
+        || (FindDirective(cacheControl, "max-age", &maxAge) && maxAge == 0)
+        || strcasestr(packet.headers.get(HeaderId::Pragma).c_str(), "no-cache");
+    request.lookup = !noCache;
+}
+
+shared_ptr<const CachedResponse> ResponseCache::lookup(const CacheRequest &request)
+{
+    if(!request.lookup)
+        return nullptr;
+
+    time_t now = time(NULL);
+    Shard &shard = getShard(request.key);
+    shard.locker.lock();
+    shared_ptr<const CachedResponse> entry;
+    auto vary = shard.varyNames.find(request.key);
+    if(vary != shard.varyNames.end())
+    {
+        auto it = shard.index.find(MakeVariantKey(request.key, vary->second.first, request.headers));
+        if(it != shard.index.end())
+        {
+            if(now < (*it->second)->expires + staleTime)
+            {
+                // 移到LRU头部
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                entry = *it->second;
+            }
+            else
+                removeEntry(shard, it->second);
+        }
+    }
+    shard.locker.unlock();
+
+    if(!entry && diskCache.isEnabled())
+    {
+        vector<string> varyNames;
+        shared_ptr<CachedResponse> diskEntry = diskCache.lookup(request, now, staleTime, varyNames);
+        if(diskEntry)
+        {
+            ++proxyStats.cacheDiskHits;
+            // 放得进内存的响应读进来，下次直接在内存中命中
+            if(diskEntry->mappedLength <= maxObjectSize)
+            {
+                diskEntry->body.assign(diskEntry->mappedBody, diskEntry->mappedLength);
+                diskEntry->mappedBody = nullptr;
+                diskEntry->mappedLength = 0;
+                diskEntry->bodyFd = -1;
+                diskEntry->pin.reset();
+                insert(diskEntry, varyNames);
+            }
+            entry = diskEntry;
+        }
+    }
+
+    if(entry)
+    {
+        ++proxyStats.cacheHits;
+        if(now >= entry->expires)
+        {
+            ++proxyStats.cacheStaleHits;
+            revalidator.enqueue(request, entry);
+        }
+    }
+    else
+        ++proxyStats.cacheMisses;
+    return entry;
+}
+
+bool ResponseCache::joinFetch(CacheRequest &request, function<void()> callback)
+{
+    if(!collapse || !request.store)
+        return false;
+
+    fetchLocker.lock();
+    auto it = fetches.find(request.key);
+    if(it != fetches.end() && request.lookup)
+    {
+        if(callback)
+            it->second.push_back(std::move(callback));
+        fetchLocker.unlock();
+        ++proxyStats.cacheCollapsed;
+        return true;
+    }
+    if(it == fetches.end())
+    {
+        fetches[request.key];
+        // CacheRequest被丢弃时（收到响应、不能缓存或连接断开）结束获取
+        string key = request.key;
+        request.fetch = shared_ptr<void>(nullptr, [this, key](void *) { endFetch(key); });
+    }
+    fetchLocker.unlock();
+    return false;
+}
+
+void ResponseCache::waitFetch(const CacheRequest &request)
+{
+    time_t deadline = time(NULL) + FetchWaitSeconds;
+    fetchLocker.lock();
+    while(fetches.count(request.key) > 0)
+    {
+        time_t now = time(NULL);
+        if(now >= deadline)
+            break;
+        fetchCond.wait(fetchLocker, deadline - now);
+    }
+    fetchLocker.unlock();
+}
+
+void ResponseCache::endFetch(const string &key)
+{
+    vector<function<void()>> callbacks;
+    fetchLocker.lock();
+    auto it = fetches.find(key);
+    if(it != fetches.end())
+    {
+        callbacks.swap(it->second);
+        fetches.erase(it);
+    }
+    fetchCond.notifyAll();
+    fetchLocker.unlock();
+    for(auto &callback : callbacks)
+        callback();
+}
+
+long ResponseCache::freshnessLifetime(const HttpResponsePacket &packet, time_t now) const
+{
+    switch(packet.code)
+    {
+    case 200: case 203: case 204: case 300: case 301: case 308: case 404: case 410:
+        break;
+    default:
+        return -1;
+    }
+    if(packet.headers.has(HeaderId::SetCookie))
+        return -1;
+    string vary = JoinHeader(packet.headers, "Vary");
+    if(vary.find('*') != string::npos)
+        return -1;
+
+    string cacheControl = JoinHeader(packet.headers, "Cache-Control");
+    if(FindDirective(cacheControl, "no-store") || FindDirective(cacheControl, "no-cache")
+        || FindDirective(cacheControl, "private"))
+        return -1;
+
+    // 新鲜期：s-maxage优先，其次max-age，最后是Expires - Date
+    long value = -1;
+    if(FindDirective(cacheControl, "s-maxage", &value) && value >= 0)
+        return value;
+    if(FindDirective(cacheControl, "max-age", &value) && value >= 0)
+        return value;
+    string expires = packet.headers.get(HeaderId::Expires);
+    if(!expires.empty())
+    {
+        time_t expiresAt = ParseHttpDate(expires);
+        if(expiresAt < 0)
+            return 0;       // 无效的Expires表示已经过期
+        time_t date = ParseHttpDate(packet.headers.get(HeaderId::Date));
+        return expiresAt - (date >= 0 ? date : now);
+    }
+    return -1;
+}
+
+size_t ResponseCache::storeLimit() const
+{
+    return diskCache.isEnabled() ? max(maxObjectSize, diskCache.getMaxObjectSize()) : maxObjectSize;
+}
+
+bool ResponseCache::wantResponse(const CacheRequest &request, const HttpResponsePacket &packet, bool lengthKnown) const
+{
+    if(!request.store || !lengthKnown || freshnessLifetime(packet, time(NULL)) <= 0)
+        return false;
+    string length = packet.headers.get(HeaderId::ContentLength);
+    return length.empty() || strtoull(length.c_str(), nullptr, 10) <= storeLimit();
+}
+
+void ResponseCache::store(const CacheRequest &request, const HttpResponsePacket &packet)
+{
+    if(!request.store || packet.bodyData.size() > storeLimit())
+        return;
+    time_t now = time(NULL);
+    long lifetime = freshnessLifetime(packet, now);
+    long age = atol(packet.headers.get(HeaderId::Age).c_str());
+    if(lifetime <= 0 || age < 0 || age >= lifetime)
+        return;
+
+    auto entry = make_shared<CachedResponse>();
+    entry->baseKey = request.key;
+    entry->storedAt = now;
+    entry->ageAtStore = age;
+    entry->expires = now + (lifetime - age);
+    entry->etag = packet.headers.get(HeaderId::ETag);
+    string lastModified = packet.headers.get(HeaderId::LastModified);
+    entry->lastModified = lastModified.empty() ? 0 : max((time_t)0, ParseHttpDate(lastModified));
+    entry->body = packet.bodyData;
+
+    // 逐跳头部和Age不保存，回复时按当前情况生成
+    entry->head = packet.version + " " + to_string(packet.code) + " " + packet.message + "\r\n";
+    entry->notModifiedHead = packet.version + " 304 Not Modified\r\n";
+    for(const HttpHeaders::Field &field : packet.headers)
+    {
+        switch(field.id)
+        {
+        case HeaderId::Connection: case HeaderId::KeepAlive: case HeaderId::ProxyConnection: case HeaderId::Age:
+            continue;
+        case HeaderId::ETag: case HeaderId::CacheControl: case HeaderId::Expires: case HeaderId::Date:
+        case HeaderId::LastModified: case HeaderId::Vary:
+            entry->notModifiedHead += field.name + ": " + field.value + "\r\n";
+            break;
+        default:
+            break;
+        }
+        entry->head += field.name + ": " + field.value + "\r\n";
+    }
+
+    vector<string> varyNames = SplitList(JoinHeader(packet.headers, "Vary"));
+    entry->key = MakeVariantKey(request.key, varyNames, request.headers);
+    insert(entry, varyNames);
+    diskCache.store(*entry, varyNames);
+    logger.debug("Stored %s, %d bytes, fresh for %ld seconds.", request.key.c_str(), (int)entry->size(),
+        lifetime - age);
+}
+
+void ResponseCache::insert(const shared_ptr<const CachedResponse> &entry, const vector<string> &varyNames)
+{
+    if(entry->size() > maxObjectSize || entry->size() > shardMaxSize)
+        return;
+
+    Shard &shard = getShard(entry->baseKey);
+    shard.locker.lock();
+    auto old = shard.index.find(entry->key);
+    if(old != shard.index.end())
+        removeEntry(shard, old->second);
+    // Vary变了时，之前按旧Vary存的条目再也查不到，等LRU淘汰
+    auto &vary = shard.varyNames[entry->baseKey];
+    vary.first = varyNames;
+    ++vary.second;
+    shard.lru.push_front(entry);
+    shard.index[entry->key] = shard.lru.begin();
+    shard.bytes += entry->size();
+    evict(shard);
+    shard.locker.unlock();
+}
+
+void ResponseCache::removeEntry(Shard &shard, list<shared_ptr<const CachedResponse>>::iterator it)
+{
+    const CachedResponse &entry = **it;
+    shard.bytes -= entry.size();
+    shard.index.erase(entry.key);
+    auto vary = shard.varyNames.find(entry.baseKey);
+    if(vary != shard.varyNames.end() && --vary->second.second <= 0)
+        shard.varyNames.erase(vary);
+    shard.lru.erase(it);
+}
+
+void ResponseCache::evict(Shard &shard)
+{
+    while(shard.bytes > shardMaxSize && !shard.lru.empty())
+    {
+        removeEntry(shard, prev(shard.lru.end()));
+        ++proxyStats.cacheEvictions;
+    }
+}
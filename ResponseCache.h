@@ -0,0 +1,158 @@
+/*
+ * 内存响应缓存
+ *
+ * 相同的GET请求（比如静态资源）不必每次都转发给后端。响应按 方法+Host+URI 保存，
+ * 响应带有Vary时再加上请求中对应头部的值，命中新鲜的缓存时直接回复客户端，不经过上游连接和插件。
+ *
+ * 能否缓存：
+ *   请求   只缓存GET（HEAD可以用GET的缓存回复）；带Authorization或Cache-Control: no-store的请求不缓存；
+ *          Cache-Control: no-cache/max-age=0或Pragma: no-cache的请求不使用缓存，但响应仍可以存入
+ *   响应   状态码200/203/204/300/301/308/404/410，有明确的新鲜期（s-maxage、max-age或Expires），
+ *          不带no-store/no-cache/private、Set-Cookie、Vary: *，长度已知且不超过MaxObjectSize
+ *
+ * 缓存分为若干个分片，按key的哈希选择分片，每个分片有自己的锁和LRU链表，总大小超过MaxSize时淘汰最久没用过的响应。
+ * 命中时返回引用计数的共享对象，发送时不持有锁。
+ * 开启磁盘缓存时，内存中没有的响应再到磁盘缓存中查找（见DiskCache.h），小的响应命中后放回内存。
+ *
+ * 过期之后的StaleTime秒内仍然用旧的响应回复，同时交给后台线程重新验证（见Revalidator.h）。
+ * 开启Collapse时，同一个响应同时只有一个请求转发给后端，其他未命中的请求等它完成后再查缓存，
+ * 而不是各自向后端请求（响应不能缓存时，等待的请求在收到响应头时就被唤醒，各自转发）。
+ * 请求带If-None-Match/If-Modified-Since且与缓存的ETag/Last-Modified相符时回复304。
+*/
+
+#ifndef RESPONSE_CACHE_BY_YQ
+#define RESPONSE_CACHE_BY_YQ
+
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <functional>
+#include <ctime>
+#include <sys/types.h>
+#include "ThreadPool/mutex.h"
+#include "ThreadPool/condition_var.h"
+#include "HttpHeaders.h"
+#include "Logger.h"
+
+struct HttpRequestPacket;
+struct HttpResponsePacket;
+
+// 等待其他请求获取同一个响应的最长时间（秒），超时后自己转发
+const int FetchWaitSeconds = 10;
+
+// 请求中与缓存有关的信息，转发请求时生成，收到对应的响应后用来决定能否存入缓存
+struct CacheRequest
+{
+    bool lookup = false;        // 可以用缓存中的响应回复
+    bool store = false;         // 响应可以存入缓存
+    bool head = false;          // HEAD请求，回复时不带body
+    std::string key;            // 方法+Host+URI
+    std::string uri;
+    HttpHeaders headers;        // 请求头，Vary和条件请求使用
+    std::shared_ptr<void> fetch;    // 由这个请求负责向后端获取响应时持有，释放时唤醒等待的请求
+};
+
+// 缓存中的一个响应
+struct CachedResponse
+{
+    std::string key;            // 包括Vary部分的完整key
+    std::string baseKey;
+    std::string head;           // 响应行和头部，不含Age、逐跳头部和结尾的空行
+    std::string notModifiedHead;// 304响应的响应行和头部
+    std::string body;           // 原样保存的body（chunked时包含分块格式）
+    // 从磁盘缓存命中时body为空，内容在slab文件bodyFd的bodyOffset处，同时映射在mappedBody；
+    // pin持有期间所在的slab不会被覆盖
+    int bodyFd = -1;
+    off_t bodyOffset = 0;
+    const char *mappedBody = nullptr;
+    size_t mappedLength = 0;
+    std::shared_ptr<void> pin;
+    std::string etag;
+    time_t lastModified = 0;
+    time_t storedAt = 0;
+    time_t expires = 0;         // 新鲜期的结束时间
+    long ageAtStore = 0;        // 存入时响应已有的Age
+
+    size_t size() const { return key.size() + head.size() + notModifiedHead.size() + body.size(); }
+    const char *bodyData() const { return mappedBody ? mappedBody : body.data(); }
+    size_t bodySize() const { return mappedBody ? mappedLength : body.size(); }
+
+    // 生成回复给请求的响应头部（包括Age和结尾的空行），返回是否需要接着发送body
+    bool buildResponse(const CacheRequest &request, time_t now, std::string &out) const;
+};
+
+class ResponseCache
+{
+private:
+    struct Shard
+    {
+        Mutex locker;
+        std::list<std::shared_ptr<const CachedResponse>> lru;      // 头部为最近使用的
+        std::unordered_map<std::string, std::list<std::shared_ptr<const CachedResponse>>::iterator> index;
+        // 每个基础key最近一次响应的Vary头部名称，以及使用它的缓存条目数
+        std::unordered_map<std::string, std::pair<std::vector<std::string>, int>> varyNames;
+        size_t bytes = 0;
+    };
+
+    bool enabled = false;
+    size_t maxSize = 64 << 20;
+    size_t maxObjectSize = 1 << 20;
+    std::vector<Shard *> shards;
+    size_t shardMaxSize = 0;
+    int staleTime = 0;
+    bool collapse = true;
+
+    // 正在向后端获取的响应（按基础key），以及事件循环中等待它的连接的回调
+    Mutex fetchLocker;
+    ConditionVar fetchCond;
+    std::unordered_map<std::string, std::vector<std::function<void()>>> fetches;
+    Logger logger;
+
+public:
+    ~ResponseCache();
+
+    // 设置参数，在开始工作之前调用
+    void init(bool enabled, size_t maxSize, size_t maxObjectSize, int shardCount, int staleTime, bool collapse,
+        Logger::LogLevel logLevel);
+    bool isEnabled() const { return enabled; }
+
+    // 根据请求填好CacheRequest（在改写Host之前调用）
+    void prepare(const HttpRequestPacket &packet, CacheRequest &request) const;
+    // 查找新鲜的缓存，没有时返回空；过期不超过StaleTime的响应也返回，同时交给后台重新验证
+    std::shared_ptr<const CachedResponse> lookup(const CacheRequest &request);
+    // 缓存未命中后调用。已经有请求在获取同一个响应时返回true：给了callback时，那个请求完成后
+    // 在完成它的线程中调用callback；没有给callback时，调用方用waitFetch等待。
+    // 返回false时由这个请求去获取（可以缓存时设置request.fetch）
+    bool joinFetch(CacheRequest &request, std::function<void()> callback = nullptr);
+    // 阻塞等待同一个响应的获取完成，最多等待FetchWaitSeconds秒
+    void waitFetch(const CacheRequest &request);
+    // 收到响应头时判断响应是否可能存入缓存，是的话需要完整接收body而不是流式转发
+    bool wantResponse(const CacheRequest &request, const HttpResponsePacket &packet, bool lengthKnown) const;
+    // 保存完整的响应（插件处理之后、发给客户端的内容），不能缓存时什么都不做
+    void store(const CacheRequest &request, const HttpResponsePacket &packet);
+
+private:
+    Shard &getShard(const std::string &baseKey);
+    // 获取结束（request.fetch释放时），唤醒等待的请求
+    void endFetch(const std::string &key);
+    // 放入内存缓存，太大时什么都不做
+    void insert(const std::shared_ptr<const CachedResponse> &entry, const std::vector<std::string> &varyNames);
+    // 能存入缓存的响应大小上限，开启磁盘缓存时为两者中较大的一个
+    size_t storeLimit() const;
+    // 响应的新鲜期（秒），不能缓存时返回-1
+    long freshnessLifetime(const HttpResponsePacket &packet, time_t now) const;
+    // 从LRU尾部淘汰，直到分片大小不超过上限，调用前需要持有分片的locker
+    void evict(Shard &shard);
+    void removeEntry(Shard &shard, std::list<std::shared_ptr<const CachedResponse>>::iterator it);
+};
+
+// 全局共享的响应缓存
+extern ResponseCache responseCache;
+
+// 生成包括Vary部分的完整key
+std::string MakeVariantKey(const std::string &baseKey, const std::vector<std::string> &varyNames,
+    const HttpHeaders &headers);
+
+#endif
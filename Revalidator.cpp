@@ -0,0 +1,219 @@
+#include "Revalidator.h"
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "HttpRequestPacket.h"
+#include "HttpResponsePacket.h"
+#include "HttpFramer.h"
+#include "Upstream.h"
+#include "Config.h"
+#include "Resolver.h"
+#include "Plugins.h"
+#include "Stats.h"
+#include "Utils.h"
+#include "BufferPool.h"
+using namespace std;
+
+Revalidator revalidator;
+
+// 后台验证线程函数
+void* funcInRevalidator(void* data)
+{
+    ((Revalidator *)data)->run();
+    return NULL;
+}
+
+// 格式化为HTTP日期（RFC 1123格式）
+static string FormatHttpDate(time_t t)
+{
+    tm tmValue;
+    gmtime_r(&t, &tmValue);
+    char buf[64];
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tmValue);
+    return buf;
+}
+
+void Revalidator::init(Logger::LogLevel logLevel)
+{
+    logger.setLogLevel(logLevel);
+    logger.setPrefix("Revalidate");
+}
+
+bool Revalidator::start()
+{
+    pthread_t threadId;
+    if(pthread_create(&threadId, NULL, funcInRevalidator, this) != 0)
+    {
+        logger.warn("Fail to start revalidation thread, stale responses will not be served.");
+        return false;
+    }
+    pthread_detach(threadId);
+    started = true;
+    return true;
+}
+
+void Revalidator::enqueue(const CacheRequest &request, const shared_ptr<const CachedResponse> &entry)
+{
+    if(!started)
+        return;
+    locker.lock();
+    if(queuedKeys.insert(entry->key).second)
+    {
+        Task task;
+        task.request.store = true;
+        task.request.key = request.key;
+        task.request.uri = request.uri;
+        task.request.headers = request.headers;
+        task.entry = entry;
+        tasks.push_back(std::move(task));
+        queueCond.notifyOne();
+    }
+    locker.unlock();
+}
+
+void Revalidator::run()
+{
+    while(true)
+    {
+        locker.lock();
+        while(tasks.empty())
+            queueCond.wait(locker, 60);
+        Task task = std::move(tasks.front());
+        tasks.pop_front();
+        locker.unlock();
+
+        revalidate(task);
+
+        locker.lock();
+        queuedKeys.erase(task.entry->key);
+        locker.unlock();
+    }
+}
+
+void Revalidator::revalidate(const Task &task)
+{
+    const CachedResponse &entry = *task.entry;
+    // 按当前配置选择后端，持有配置直到验证结束
+    shared_ptr<const ProxyConfig> config = CurrentConfig();
+    UpstreamGroup &upstreamGroup = *config->upstream;
+    in_addr anyAddr;
+    anyAddr.s_addr = htonl(INADDR_ANY);
+    Backend *backend = upstreamGroup.select(anyAddr, task.request.uri);
+
+    // 按原请求的头部生成GET请求（Vary的头部需要一致），去掉逐跳头部和原有的条件
+    string raw = "GET " + task.request.uri + " HTTP/1.1\r\n";
+    for(const HttpHeaders::Field &field : task.request.headers)
+    {
+        switch(field.id)
+        {
+        case HeaderId::Host: case HeaderId::Connection: case HeaderId::KeepAlive: case HeaderId::ProxyConnection:
+        case HeaderId::IfNoneMatch: case HeaderId::IfModifiedSince: case HeaderId::Range:
+        case HeaderId::ContentLength: case HeaderId::TransferEncoding: case HeaderId::Te: case HeaderId::Upgrade:
+            continue;
+        default:
+            break;
+        }
+        if(strcasecmp(field.name.c_str(), "If-Match") == 0 || strcasecmp(field.name.c_str(), "If-Unmodified-Since") == 0
+            || strcasecmp(field.name.c_str(), "If-Range") == 0)
+            continue;
+        raw += field.name + ": " + field.value + "\r\n";
+    }
+    raw += "Host: " + backend->hostStr + "\r\n";
+    if(!entry.etag.empty())
+        raw += "If-None-Match: " + entry.etag + "\r\n";
+    if(entry.lastModified > 0)
+        raw += "If-Modified-Since: " + FormatHttpDate(entry.lastModified) + "\r\n";
+    raw += "Connection: close\r\n\r\n";
+    HttpRequestPacket request(raw);
+    PluginsCallClientRequest(&request);
+
+    UpstreamGroup::beginRequest(backend);
+    string data;
+    bool ok = fetch(backend, max(config->upstreamConnectTimeout, 1), request, data);
+    UpstreamGroup::endRequest(backend);
+    if(!ok)
+    {
+        upstreamGroup.reportFailure(backend, "revalidation failed");
+        logger.warn("Fail to revalidate %s, serving stale response.", task.request.key.c_str());
+        return;
+    }
+    upstreamGroup.reportSuccess(backend);
+
+    HttpResponsePacket response(data);
+    if(response.code == 304)
+    {
+        // 用304中的头部更新旧响应，作为新的响应重新存入
+        HttpResponsePacket stored(entry.head + "\r\n" + string(entry.bodyData(), entry.bodySize()));
+        const char *names[] = {"Cache-Control", "Expires", "Date", "ETag", "Last-Modified"};
+        for(const char *name : names)
+        {
+            if(response.headers.has(name))
+                stored.headers.set(name, response.headers.get(name));
+        }
+        responseCache.store(task.request, stored);
+        ++proxyStats.cacheRevalidated;
+        logger.debug("%s not modified.", task.request.key.c_str());
+    }
+    else
+    {
+        PluginsCallServerResponse(&response, task.request.uri);
+        unique_ptr<BodyFilter> bodyFilter = PluginsStartBodyFilter(&response, task.request.uri);
+        PluginsFinishBody(&response, bodyFilter.get());
+        responseCache.store(task.request, response);
+        logger.debug("%s refreshed, status %d.", task.request.key.c_str(), response.code);
+    }
+}
+
+bool Revalidator::fetch(Backend *backend, int timeout, HttpRequestPacket &request, string &response)
+{
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(backend->port);
+    if(!resolver.resolve(backend->host, addr.sin_addr))
+        return false;
+
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(sock < 0)
+        return false;
+    if(!ConnectWithTimeout(sock, addr, timeout * 1000))
+    {
+        close(sock);
+        return false;
+    }
+    timeval tv = {timeout, 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if(!request.sendTo(sock))
+    {
+        close(sock);
+        return false;
+    }
+
+    // 接收完整的响应
+    HttpFramer framer(true);
+    bool complete = false;
+    while(true)
+    {
+        auto res = framer.advance(response.data(), response.size());
+        if(res == HttpFramer::Result::Error)
+            break;
+        if(res == HttpFramer::Result::Complete)
+        {
+            complete = true;
+            break;
+        }
+        ssize_t recvLen = RecvAppend(sock, response, 4);
+        if(recvLen <= 0)
+        {
+            complete = (recvLen == 0 && framer.finishOnClose());
+            break;
+        }
+    }
+    close(sock);
+    if(complete)
+        response.resize(framer.getLength());
+    return complete;
+}
@@ -0,0 +1,66 @@
+/*
+ * 过期缓存的后台重新验证
+ *
+ * 缓存条目过期后的StaleTime秒内，请求仍然直接用旧的响应回复，同时把条目交给后台线程向后端重新验证：
+ * 带上If-None-Match/If-Modified-Since发一个GET请求（Connection: close），
+ *
+ *   304      响应没有变化，用304中的Cache-Control/Expires/Date等头部更新旧响应，重新计算新鲜期
+ *   其他     当作新的响应，可以缓存时替换旧响应（与正常转发一样经过插件）
+ *   失败     旧响应继续使用，直到超过StaleTime
+ *
+ * 同一个条目同时只会有一个验证任务，客户端的请求不会因为验证而等待。
+*/
+
+#ifndef REVALIDATOR_BY_YQ
+#define REVALIDATOR_BY_YQ
+
+#include <string>
+#include <deque>
+#include <memory>
+#include <unordered_set>
+#include <pthread.h>
+#include "ThreadPool/mutex.h"
+#include "ThreadPool/condition_var.h"
+#include "ResponseCache.h"
+#include "Logger.h"
+
+struct Backend;
+
+class Revalidator
+{
+private:
+    // 线程函数设友元以便访问私有成员
+    friend void* funcInRevalidator(void* data);
+
+    struct Task
+    {
+        CacheRequest request;
+        std::shared_ptr<const CachedResponse> entry;
+    };
+
+    std::deque<Task> tasks;
+    std::unordered_set<std::string> queuedKeys;     // 已在队列中或正在验证的条目
+    Mutex locker;
+    ConditionVar queueCond;
+    Logger logger;
+    bool started = false;
+
+public:
+    // 设置参数，在start之前调用
+    void init(Logger::LogLevel logLevel);
+    // 启动后台验证线程
+    bool start();
+    // 把过期的缓存条目交给后台验证，同一个条目已经在队列中时忽略
+    void enqueue(const CacheRequest &request, const std::shared_ptr<const CachedResponse> &entry);
+
+private:
+    void run();
+    void revalidate(const Task &task);
+    // 向backend发送请求并接收完整的响应，连接和收发都限时timeout秒，失败时返回false
+    bool fetch(Backend *backend, int timeout, HttpRequestPacket &request, std::string &response);
+};
+
+// 全局的后台验证线程
+extern Revalidator revalidator;
+
+#endif
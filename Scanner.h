@@ -0,0 +1,229 @@
+#ifndef SCANNER_BY_YQ
+#define SCANNER_BY_YQ
+
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCANNER_X86_BY_YQ
+#endif
+
+/* HTTP分隔符扫描
+ *
+ * 头部和chunk size行的解析大部分时间都花在找\r\n和冒号上。
+ * x86上一次比较16（SSE2）或32（AVX2）个字节，用movemask得到匹配位置，其他平台使用逐字节的实现。
+ * 具体使用哪个实现在第一次调用时根据CPU支持的指令集决定。
+ * FindCrlf只找一个字符，libc的memchr本身就是向量化的，实测（ScannerBench.cpp）不比SSE2/AVX2版本慢，
+ * 因此在所有CPU上都使用基于memchr的实现，SIMD版本只用于FindLineEnd，FindCrlf的SIMD版本留作对比。
+ *
+ * FindCrlf     找第一个\r\n，返回\r的位置
+ * FindLineEnd  找第一个\n，同时找出它之前的第一个冒号（头部行中名称和值的分界）
+*/
+
+// 各个实现的函数类型，colon为nullptr时不找冒号
+typedef const char *(*FindCrlfFunction)(const char *data, size_t len);
+typedef const char *(*FindLineEndFunction)(const char *data, size_t len, const char **colon);
+
+// 逐字节实现
+inline const char *ScalarFindCrlf(const char *data, size_t len)
+{
+    const char *end = data + len;
+    while(data + 1 < end)
+    {
+        const char *cr = (const char *)memchr(data, '\r', end - data - 1);
+        if(!cr)
+            return nullptr;
+        if(cr[1] == '\n')
+            return cr;
+        data = cr + 1;
+    }
+    return nullptr;
+}
+
+inline const char *ScalarFindLineEnd(const char *data, size_t len, const char **colon)
+{
+    for(size_t i = 0; i < len; ++i)
+    {
+        if(data[i] == '\n')
+            return data + i;
+        if(data[i] == ':' && colon && !*colon)
+            *colon = data + i;
+    }
+    return nullptr;
+}
+
+#ifdef SCANNER_X86_BY_YQ
+
+/* 按块比较，最后不足一块的部分不逐字节处理，而是把最后一块和前面重叠着再比较一次，
+ * 重叠部分的匹配结果屏蔽掉。头部行一般只有几十个字节，这样能省掉大部分逐字节的尾巴。
+ * 整个范围不足一块时才交给更窄的实现。
+*/
+
+// \r的比较结果和错开一个字节的\n的比较结果取与，得到\r\n的起始位置
+__attribute__((target("sse2")))
+inline const char *Sse2FindCrlf(const char *data, size_t len)
+{
+    if(len < 17)
+        return ScalarFindCrlf(data, len);
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    size_t i = 0;
+    while(true)
+    {
+        // 最后一块和前面重叠，已经比较过的位置不算
+        size_t skip = 0;
+        if(i + 17 > len)
+        {
+            skip = i - (len - 17);
+            i = len - 17;
+        }
+        __m128i a = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(data + i + 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, cr), _mm_cmpeq_epi8(b, lf)));
+        mask &= ~((1u << skip) - 1);
+        if(mask)
+            return data + i + __builtin_ctz(mask);
+        i += 16;
+        if(i + 1 >= len)
+            return nullptr;
+    }
+}
+
+__attribute__((target("sse2")))
+inline const char *Sse2FindLineEnd(const char *data, size_t len, const char **colon)
+{
+    if(len < 16)
+        return ScalarFindLineEnd(data, len, colon);
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i co = _mm_set1_epi8(':');
+    size_t i = 0;
+    while(true)
+    {
+        size_t skip = 0;
+        if(i + 16 > len)
+        {
+            skip = i - (len - 16);
+            i = len - 16;
+        }
+        __m128i a = _mm_loadu_si128((const __m128i *)(data + i));
+        unsigned lfMask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, lf)) & ~((1u << skip) - 1);
+        if(colon && !*colon)
+        {
+            unsigned colonMask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, co)) & ~((1u << skip) - 1);
+            // 只要换行符之前的冒号
+            if(lfMask)
+                colonMask &= (1u << __builtin_ctz(lfMask)) - 1;
+            if(colonMask)
+                *colon = data + i + __builtin_ctz(colonMask);
+        }
+        if(lfMask)
+            return data + i + __builtin_ctz(lfMask);
+        i += 16;
+        if(i >= len)
+            return nullptr;
+    }
+}
+
+__attribute__((target("avx2")))
+inline const char *Avx2FindCrlf(const char *data, size_t len)
+{
+    if(len < 33)
+        return Sse2FindCrlf(data, len);
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    while(true)
+    {
+        size_t skip = 0;
+        if(i + 33 > len)
+        {
+            skip = i - (len - 33);
+            i = len - 33;
+        }
+        __m256i a = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(data + i + 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, cr), _mm256_cmpeq_epi8(b, lf)));
+        mask &= ~(unsigned)((1ull << skip) - 1);
+        if(mask)
+            return data + i + __builtin_ctz(mask);
+        i += 32;
+        if(i + 1 >= len)
+            return nullptr;
+    }
+}
+
+__attribute__((target("avx2")))
+inline const char *Avx2FindLineEnd(const char *data, size_t len, const char **colon)
+{
+    if(len < 32)
+        return Sse2FindLineEnd(data, len, colon);
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i co = _mm256_set1_epi8(':');
+    size_t i = 0;
+    while(true)
+    {
+        size_t skip = 0;
+        if(i + 32 > len)
+        {
+            skip = i - (len - 32);
+            i = len - 32;
+        }
+        unsigned skipMask = ~(unsigned)((1ull << skip) - 1);
+        __m256i a = _mm256_loadu_si256((const __m256i *)(data + i));
+        unsigned lfMask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, lf)) & skipMask;
+        if(colon && !*colon)
+        {
+            unsigned colonMask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, co)) & skipMask;
+            if(lfMask)
+                colonMask &= (unsigned)((1ull << __builtin_ctz(lfMask)) - 1);
+            if(colonMask)
+                *colon = data + i + __builtin_ctz(colonMask);
+        }
+        if(lfMask)
+            return data + i + __builtin_ctz(lfMask);
+        i += 32;
+        if(i >= len)
+            return nullptr;
+    }
+}
+
+#endif
+
+// 当前CPU上使用的实现
+struct ScannerImpl
+{
+    const char *name;
+    FindCrlfFunction findCrlf;
+    FindLineEndFunction findLineEnd;
+};
+
+inline const ScannerImpl &GetScanner()
+{
+    static const ScannerImpl impl = []() -> ScannerImpl {
+#ifdef SCANNER_X86_BY_YQ
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2"))
+            return {"avx2", ScalarFindCrlf, Avx2FindLineEnd};
+        if(__builtin_cpu_supports("sse2"))
+            return {"sse2", ScalarFindCrlf, Sse2FindLineEnd};
+#endif
+        return {"scalar", ScalarFindCrlf, ScalarFindLineEnd};
+    }();
+    return impl;
+}
+
+// 找第一个\r\n，返回\r的位置，没有时返回nullptr
+inline const char *FindCrlf(const char *data, size_t len)
+{
+    return GetScanner().findCrlf(data, len);
+}
+
+// 找第一个\n，没有时返回nullptr
+// colon不为nullptr且*colon为nullptr时，顺便把\n之前（没有\n时为整个范围内）的第一个冒号记到*colon
+inline const char *FindLineEnd(const char *data, size_t len, const char **colon = nullptr)
+{
+    return GetScanner().findLineEnd(data, len, colon);
+}
+
+#endif
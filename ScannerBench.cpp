@@ -0,0 +1,144 @@
+/*
+ * 分隔符扫描速度对比：Scanner.h中的逐字节、SSE2、AVX2实现
+ *
+ * 用浏览器的请求头和常见的响应头作为数据，像HttpParser那样逐行调用FindLineEnd（同时找冒号），
+ * 以及像chunk size行那样逐行调用FindCrlf，输出每种实现每秒扫描的字节数。
+ * 当前CPU不支持的实现跳过。
+ *
+ * 独立的程序，不参与代理服务器的构建，在仓库根目录下：
+ * make scannerbench && ./scannerbench [轮数]
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/time.h>
+#include "Scanner.h"
+
+static const char RequestHeader[] =
+    "GET /static/js/main.7c3f2a91.chunk.js?v=20241017 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"128\", \"Not;A=Brand\";v=\"24\", \"Google Chrome\";v=\"128\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/128.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Accept: */*\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: script\r\n"
+    "Referer: https://www.example.com/products/list?page=2&sort=price\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Cookie: _ga=GA1.2.1234567890.1700000000; sessionid=8f14e45fceea167a5a36dedd4bea2543; theme=dark\r\n"
+    "If-None-Match: \"5f3a9c2e-1b7d4\"\r\n"
+    "\r\n";
+
+static const char ResponseHeader[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Server: nginx/1.24.0\r\n"
+    "Date: Sat, 17 Oct 2026 12:00:00 GMT\r\n"
+    "Content-Type: application/javascript; charset=utf-8\r\n"
+    "Content-Length: 112237\r\n"
+    "Last-Modified: Thu, 15 Oct 2026 08:30:12 GMT\r\n"
+    "Connection: keep-alive\r\n"
+    "Vary: Accept-Encoding\r\n"
+    "ETag: \"5f3a9c2e-1b66d\"\r\n"
+    "Cache-Control: public, max-age=31536000, immutable\r\n"
+    "Strict-Transport-Security: max-age=63072000; includeSubDomains; preload\r\n"
+    "X-Content-Type-Options: nosniff\r\n"
+    "Accept-Ranges: bytes\r\n"
+    "\r\n";
+
+static long NowUs()
+{
+    timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000L + now.tv_usec;
+}
+
+// 逐行扫描整个头部，返回找到的冒号数，防止循环被优化掉
+static size_t ScanLines(FindLineEndFunction findLineEnd, const std::string &data)
+{
+    size_t colons = 0;
+    const char *p = data.data();
+    const char *end = p + data.size();
+    while(p < end)
+    {
+        const char *colon = nullptr;
+        const char *lf = findLineEnd(p, end - p, &colon);
+        if(lf == nullptr)
+            break;
+        if(colon != nullptr)
+            ++colons;
+        p = lf + 1;
+    }
+    return colons;
+}
+
+static size_t ScanCrlf(FindCrlfFunction findCrlf, const std::string &data)
+{
+    size_t lines = 0;
+    const char *p = data.data();
+    const char *end = p + data.size();
+    while(p < end)
+    {
+        const char *cr = findCrlf(p, end - p);
+        if(cr == nullptr)
+            break;
+        ++lines;
+        p = cr + 2;
+    }
+    return lines;
+}
+
+// 返回GB/s
+template <class Function>
+static double Measure(size_t (*scan)(Function, const std::string &), Function func, const std::string &data, int rounds)
+{
+    size_t check = 0;
+    long start = NowUs();
+    for(int i = 0; i < rounds; ++i)
+        check += scan(func, data);
+    long elapsed = NowUs() - start;
+    if(check == 0)
+        printf("unexpected result\n");
+    return elapsed > 0 ? (double)data.size() * rounds / elapsed / 1000 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = (argc > 1) ? atoi(argv[1]) : 200000;
+    // 请求头和响应头交替排列，模拟缓冲区中连续的多个消息
+    std::string data;
+    for(int i = 0; i < 8; ++i)
+        data.append(RequestHeader).append(ResponseHeader);
+
+    ScannerImpl impls[3] = {{"scalar", ScalarFindCrlf, ScalarFindLineEnd}};
+    int implCount = 1;
+#ifdef SCANNER_X86_BY_YQ
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2"))
+        impls[implCount++] = {"sse2", Sse2FindCrlf, Sse2FindLineEnd};
+    if(__builtin_cpu_supports("avx2"))
+        impls[implCount++] = {"avx2", Avx2FindCrlf, Avx2FindLineEnd};
+#endif
+
+    printf("%zu bytes x %d rounds, runtime choice: FindLineEnd %s, FindCrlf %s\n", data.size(), rounds,
+           GetScanner().name, GetScanner().findCrlf == ScalarFindCrlf ? "scalar" : GetScanner().name);
+    printf("%8s %18s %18s\n", "impl", "FindLineEnd GB/s", "FindCrlf GB/s");
+    double scalarLine = 0, scalarCrlf = 0;
+    for(int i = 0; i < implCount; ++i)
+    {
+        double line = Measure(ScanLines, impls[i].findLineEnd, data, rounds);
+        double crlf = Measure(ScanCrlf, impls[i].findCrlf, data, rounds);
+        if(i == 0)
+        {
+            scalarLine = line;
+            scalarCrlf = crlf;
+        }
+        printf("%8s %12.2f (%.1fx) %12.2f (%.1fx)\n", impls[i].name,
+               line, line / scalarLine, crlf, crlf / scalarCrlf);
+    }
+    return 0;
+}
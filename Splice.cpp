@@ -0,0 +1,85 @@
+#include "Splice.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include "Stats.h"
+
+// 希望的管道容量，越大一次splice搬运的数据越多
+const int PipeCapacity = 1024 * 1024;
+
+// 每个线程一根管道，线程退出时关闭
+struct SplicePipe
+{
+    int readFd = -1;
+    int writeFd = -1;
+    size_t capacity = 0;
+
+    ~SplicePipe()
+    {
+        reset();
+    }
+
+    bool ensure()
+    {
+        if(readFd >= 0)
+            return true;
+        int fds[2];
+        if(pipe2(fds, O_CLOEXEC) < 0)
+            return false;
+        readFd = fds[0];
+        writeFd = fds[1];
+        // 扩大管道容量，失败时使用默认容量
+        int size = fcntl(writeFd, F_SETPIPE_SZ, PipeCapacity);
+        if(size < 0)
+            size = fcntl(writeFd, F_GETPIPE_SZ);
+        capacity = size > 0 ? size : 65536;
+        return true;
+    }
+
+    // 出错时管道里可能残留数据，直接关闭，下次使用时重建
+    void reset()
+    {
+        if(readFd >= 0)
+            close(readFd);
+        if(writeFd >= 0)
+            close(writeFd);
+        readFd = writeFd = -1;
+    }
+};
+
+static thread_local SplicePipe threadPipe;
+
+ssize_t SpliceRelay(int fromSocket, int toSocket, size_t maxLen)
+{
+    if(!threadPipe.ensure())
+        return SpliceUnavailable;
+    if(maxLen > threadPipe.capacity)
+        maxLen = threadPipe.capacity;
+
+    // socket -> 管道
+    ssize_t moved;
+    do
+        moved = splice(fromSocket, NULL, threadPipe.writeFd, NULL, maxLen, SPLICE_F_MOVE | SPLICE_F_MORE);
+    while(moved < 0 && errno == EINTR);
+    if(moved < 0 && (errno == EINVAL || errno == ENOSYS))
+        return SpliceUnavailable;
+    if(moved <= 0)
+        return moved;
+
+    // 管道 -> socket，必须把管道中的数据全部写出
+    size_t left = moved;
+    while(left > 0)
+    {
+        ssize_t written = splice(threadPipe.readFd, NULL, toSocket, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if(written < 0 && errno == EINTR)
+            continue;
+        if(written <= 0)
+        {
+            threadPipe.reset();
+            return -1;
+        }
+        left -= written;
+    }
+    proxyStats.zeroCopyBytes += moved;
+    return moved;
+}
@@ -0,0 +1,21 @@
+/*
+ * 基于splice()的零拷贝转发
+ *
+ * 没有插件关心的body不需要进入用户态：数据经由每个线程自己的一根管道，
+ * 从一个socket直接在内核中搬到另一个socket，省去recv到缓冲区、拷贝进string、再send出去的开销。
+*/
+
+#ifndef SPLICE_BY_YQ
+#define SPLICE_BY_YQ
+
+#include <cstddef>
+#include <sys/types.h>
+
+// splice不可用（例如创建管道失败）时的返回值，调用方应改用普通的recv/send
+const ssize_t SpliceUnavailable = -2;
+
+// 从fromSocket搬运最多maxLen字节到toSocket（均为阻塞socket），
+// 返回实际搬运的字节数；0表示fromSocket对端已关闭；-1表示出错
+ssize_t SpliceRelay(int fromSocket, int toSocket, size_t maxLen);
+
+#endif
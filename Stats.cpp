@@ -0,0 +1,60 @@
+#include "Stats.h"
+#include <unistd.h>
+#include <pthread.h>
+
+ProxyStats proxyStats;
+
+static int reportInterval = 0;
+static Logger statsLogger;
+
+// 统计线程函数
+static void* funcStatsReporter(void* data)
+{
+    while(true)
+    {
+        sleep(reportInterval);
+        statsLogger.info("Requests: %llu forwarded, %llu pipelined",
+            (unsigned long long)proxyStats.forwardedRequests.load(),
+            (unsigned long long)proxyStats.pipelinedRequests.load());
+        statsLogger.info("Body bytes: %llu zero-copy (splice), %llu copied",
+            (unsigned long long)proxyStats.zeroCopyBytes.load(),
+            (unsigned long long)proxyStats.copiedBodyBytes.load());
+        statsLogger.info("DNS cache: %llu hits, %llu misses",
+            (unsigned long long)proxyStats.dnsCacheHits.load(),
+            (unsigned long long)proxyStats.dnsCacheMisses.load());
+        statsLogger.info("Upstream: %llu ejections, %llu failed health checks",
+            (unsigned long long)proxyStats.backendEjections.load(),
+            (unsigned long long)proxyStats.healthCheckFailures.load());
+        statsLogger.info("Response cache: %llu hits (%llu from disk), %llu misses, %llu evictions, %llu stored on disk",
+            (unsigned long long)proxyStats.cacheHits.load(),
+            (unsigned long long)proxyStats.cacheDiskHits.load(),
+            (unsigned long long)proxyStats.cacheMisses.load(),
+            (unsigned long long)proxyStats.cacheEvictions.load(),
+            (unsigned long long)proxyStats.cacheDiskStores.load());
+        statsLogger.info("Response cache: %llu stale hits, %llu revalidated, %llu collapsed requests",
+            (unsigned long long)proxyStats.cacheStaleHits.load(),
+            (unsigned long long)proxyStats.cacheRevalidated.load(),
+            (unsigned long long)proxyStats.cacheCollapsed.load());
+        statsLogger.info("Receive buffers: %lld allocated",
+            (long long)proxyStats.buffersAllocated.load());
+        statsLogger.info("Observer plugins: %llu snapshots submitted, %llu dropped",
+            (unsigned long long)proxyStats.observerSubmitted.load(),
+            (unsigned long long)proxyStats.observerDropped.load());
+    }
+    return NULL;
+}
+
+void StartStatsReporter(int intervalSeconds, Logger::LogLevel logLevel)
+{
+    if(intervalSeconds <= 0)
+        return;
+    reportInterval = intervalSeconds;
+    statsLogger.setLogLevel(logLevel);
+    statsLogger.setPrefix("Stats");
+
+    pthread_t threadId;
+    if(pthread_create(&threadId, NULL, funcStatsReporter, NULL) == 0)
+        pthread_detach(threadId);
+    else
+        statsLogger.warn("Fail to start stats reporter.");
+}
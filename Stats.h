@@ -0,0 +1,52 @@
+/*
+ * 运行统计
+ *
+ * 各模块在工作中累加的全局计数器，StatsInterval大于0时由后台线程定期输出到日志
+*/
+
+#ifndef STATS_BY_YQ
+#define STATS_BY_YQ
+
+#include <atomic>
+#include <cstdint>
+#include "Logger.h"
+
+struct ProxyStats
+{
+    // 转发给后端的请求数，其中在前面的响应还没收到时就转发的（流水线）请求数
+    std::atomic<uint64_t> forwardedRequests{0};
+    std::atomic<uint64_t> pipelinedRequests{0};
+    // 经splice()零拷贝转发的body字节数
+    std::atomic<uint64_t> zeroCopyBytes{0};
+    // 经普通recv/send转发的流式body字节数
+    std::atomic<uint64_t> copiedBodyBytes{0};
+    // 域名解析缓存命中/未命中次数
+    std::atomic<uint64_t> dnsCacheHits{0};
+    std::atomic<uint64_t> dnsCacheMisses{0};
+    // 后端被动摘除次数、主动健康检查失败次数
+    std::atomic<uint64_t> backendEjections{0};
+    std::atomic<uint64_t> healthCheckFailures{0};
+    // 响应缓存命中/未命中/淘汰次数
+    std::atomic<uint64_t> cacheHits{0};
+    std::atomic<uint64_t> cacheMisses{0};
+    std::atomic<uint64_t> cacheEvictions{0};
+    // 其中从磁盘缓存命中的次数，以及写入磁盘缓存的响应数
+    std::atomic<uint64_t> cacheDiskHits{0};
+    std::atomic<uint64_t> cacheDiskStores{0};
+    // 用过期响应回复的次数、后台重新验证得到304的次数、等待其他请求获取同一响应的次数
+    std::atomic<uint64_t> cacheStaleHits{0};
+    std::atomic<uint64_t> cacheRevalidated{0};
+    std::atomic<uint64_t> cacheCollapsed{0};
+    // 当前已分配的接收缓冲区数（包括各线程空闲链表中的）
+    std::atomic<int64_t> buffersAllocated{0};
+    // 交给异步观察插件的快照数，以及队列已满而丢弃的快照数
+    std::atomic<uint64_t> observerSubmitted{0};
+    std::atomic<uint64_t> observerDropped{0};
+};
+
+extern ProxyStats proxyStats;
+
+// 启动定期输出统计信息的后台线程，intervalSeconds <= 0 时不启动
+void StartStatsReporter(int intervalSeconds, Logger::LogLevel logLevel);
+
+#endif
@@ -0,0 +1,131 @@
+/*
+ * 线程池吞吐量对比：ThreadPool（单个加锁队列） vs WorkStealingPool（工作窃取）
+ *
+ * 线程数从1到64，每种线程数下分别测两种场景：
+ * 1. 外部添加：主线程逐个添加所有任务（对应主线程accept之后分派连接）
+ * 2. 任务派生：主线程添加少量根任务，每个根任务在线程池中再添加若干子任务
+ * 每个任务只做很少的计算，测的主要是调度开销，输出每秒完成的任务数（百万）
+ *
+ * 独立的程序，不参与代理服务器的构建，在仓库根目录下：
+ * make threadpoolbench && ./threadpoolbench [任务数]
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <unistd.h>
+#include <sys/time.h>
+#include "threadpool.h"
+#include "workstealing.h"
+
+// 每个任务的计算量
+const int WorkPerTask = 200;
+// 任务派生场景中每个根任务添加的子任务数
+const int ChildrenPerTask = 64;
+
+// 一次测试共享的数据
+template <class Pool>
+struct BenchContext
+{
+    Pool *pool;
+    std::atomic<long> done{0};
+};
+
+static long NowUs()
+{
+    timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000L + now.tv_usec;
+}
+
+static void DoWork()
+{
+    volatile int sink = 0;
+    for(int i = 0; i < WorkPerTask; ++i)
+        sink = sink + i;
+}
+
+// 添加任务，WorkStealingPool的全局队列满时稍后重试
+template <class Pool>
+static void AddTask(Pool *pool, TaskFunction func, void *data)
+{
+    while(!pool->addTask(func, data))
+        usleep(10);
+}
+
+template <class Pool>
+static void LeafTask(void *data)
+{
+    BenchContext<Pool> *ctx = (BenchContext<Pool> *)data;
+    DoWork();
+    ctx->done.fetch_add(1);
+}
+
+template <class Pool>
+static void ParentTask(void *data)
+{
+    BenchContext<Pool> *ctx = (BenchContext<Pool> *)data;
+    for(int i = 0; i < ChildrenPerTask; ++i)
+        AddTask(ctx->pool, LeafTask<Pool>, data);
+    DoWork();
+    ctx->done.fetch_add(1);
+}
+
+// ThreadPool析构时只是pthread_cancel各个线程，不等待它们退出，
+// 随后在同一块内存上构造的线程池可能被还没退出的线程破坏，因此测试用的ThreadPool不析构
+static void DestroyPool(ThreadPool *)
+{
+}
+
+static void DestroyPool(WorkStealingPool *pool)
+{
+    delete pool;
+}
+
+// 返回每秒完成的任务数（百万）
+template <class Pool>
+static double RunBench(int threads, long tasks, bool spawn)
+{
+    Pool *pool = new Pool(threads, threads, 5);
+    BenchContext<Pool> ctx;
+    ctx.pool = pool;
+
+    long start = NowUs();
+    long total = tasks;
+    if(spawn)
+    {
+        long parents = tasks / (ChildrenPerTask + 1);
+        total = parents * (ChildrenPerTask + 1);
+        for(long i = 0; i < parents; ++i)
+            AddTask(pool, ParentTask<Pool>, &ctx);
+    }
+    else
+    {
+        for(long i = 0; i < tasks; ++i)
+            AddTask(pool, LeafTask<Pool>, &ctx);
+    }
+    while(ctx.done.load() < total)
+        usleep(100);
+    long elapsed = NowUs() - start;
+    DestroyPool(pool);
+    return elapsed > 0 ? (double)total / elapsed : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    long tasks = (argc > 1) ? atol(argv[1]) : 200000;
+    printf("%ld tasks per run, %d CPUs\n", tasks, (int)sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s | %12s %12s %8s | %12s %12s %8s\n", "threads",
+           "queue", "stealing", "speedup", "queue", "stealing", "speedup");
+    printf("%8s | %34s | %34s\n", "", "external adds (Mtasks/s)", "spawned in pool (Mtasks/s)");
+    for(int threads = 1; threads <= 64; threads *= 2)
+    {
+        double queueExt = RunBench<ThreadPool>(threads, tasks, false);
+        double stealExt = RunBench<WorkStealingPool>(threads, tasks, false);
+        double queueSpawn = RunBench<ThreadPool>(threads, tasks, true);
+        double stealSpawn = RunBench<WorkStealingPool>(threads, tasks, true);
+        printf("%8d | %12.2f %12.2f %7.1fx | %12.2f %12.2f %7.1fx\n", threads,
+               queueExt, stealExt, stealExt / queueExt, queueSpawn, stealSpawn, stealSpawn / queueSpawn);
+    }
+    return 0;
+}
@@ -0,0 +1,185 @@
+/*
+ * 工作窃取线程池使用的两种无锁任务队列
+ *
+ * WorkStealingDeque：Chase-Lev双端队列，每个工作线程一个。
+ *     只有所属线程在底部push/pop（后进先出，刚产生的任务还在缓存中），其他线程从顶部steal（先进先出）。
+ *     容量固定，满时由调用方改为放入全局队列，因此不需要扩容和回收旧缓冲区。
+ *
+ * InjectionQueue：有界的多生产者多消费者队列（Vyukov算法），线程池外部添加的任务先进入这里。
+ *     每个槽位带一个序号，生产者和消费者各自用CAS抢占位置，序号表明槽位当前是否可写/可读。
+*/
+
+#ifndef TASK_QUEUES_BY_YQ
+#define TASK_QUEUES_BY_YQ
+
+#include <atomic>
+#include <cstddef>
+#include "threadpool.h"
+
+// 避免不同线程频繁修改的变量位于同一缓存行
+const size_t CacheLineSize = 64;
+
+class WorkStealingDeque
+{
+private:
+    // 槽位中的两个字段分别原子读写：steal读到的可能是正在被覆盖的旧值，但这时它的CAS一定失败，读到的值会被丢弃
+    struct Slot
+    {
+        std::atomic<TaskFunction> func{nullptr};
+        std::atomic<void*> data{nullptr};
+    };
+
+    alignas(CacheLineSize) std::atomic<long> top{0};
+    alignas(CacheLineSize) std::atomic<long> bottom{0};
+    alignas(CacheLineSize) Slot *slots;
+    long mask;
+
+public:
+    // capacity必须是2的幂
+    explicit WorkStealingDeque(size_t capacity = 1024)
+        :slots(new Slot[capacity]), mask(capacity - 1) {}
+    ~WorkStealingDeque() { delete[] slots; }
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // 以下两个函数只能由所属线程调用
+    // 队列已满时返回false
+    bool push(const TaskData &task)
+    {
+        long b = bottom.load(std::memory_order_relaxed);
+        long t = top.load(std::memory_order_acquire);
+        if(b - t > mask)
+            return false;
+        Slot &slot = slots[b & mask];
+        slot.func.store(task.func, std::memory_order_relaxed);
+        slot.data.store(task.data, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool pop(TaskData &task)
+    {
+        long b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long t = top.load(std::memory_order_relaxed);
+        if(t > b)
+        {
+            // 队列为空
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        Slot &slot = slots[b & mask];
+        task.func = slot.func.load(std::memory_order_relaxed);
+        task.data = slot.data.load(std::memory_order_relaxed);
+        if(t == b)
+        {
+            // 最后一个任务，和steal竞争
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // 任意线程调用，队列为空或与其他线程竞争失败时返回false
+    bool steal(TaskData &task)
+    {
+        long t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long b = bottom.load(std::memory_order_acquire);
+        if(t >= b)
+            return false;
+        Slot &slot = slots[t & mask];
+        task.func = slot.func.load(std::memory_order_relaxed);
+        task.data = slot.data.load(std::memory_order_relaxed);
+        return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    bool empty() const
+    {
+        return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+    }
+};
+
+class InjectionQueue
+{
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        TaskData task;
+    };
+
+    alignas(CacheLineSize) Cell *cells;
+    size_t mask;
+    alignas(CacheLineSize) std::atomic<size_t> enqueuePos{0};
+    alignas(CacheLineSize) std::atomic<size_t> dequeuePos{0};
+
+public:
+    // capacity必须是2的幂
+    explicit InjectionQueue(size_t capacity = 65536)
+        :cells(new Cell[capacity]), mask(capacity - 1)
+    {
+        for(size_t i = 0; i < capacity; ++i)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    ~InjectionQueue() { delete[] cells; }
+    InjectionQueue(const InjectionQueue&) = delete;
+    InjectionQueue& operator=(const InjectionQueue&) = delete;
+
+    // 队列已满时返回false
+    bool push(const TaskData &task)
+    {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while(true)
+        {
+            Cell &cell = cells[pos & mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            long diff = (long)seq - (long)pos;
+            if(diff == 0)
+            {
+                // 槽位可写，抢占这个位置
+                if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.task = task;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if(diff < 0)
+                return false;
+            else
+                pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    // 队列为空时返回false
+    bool pop(TaskData &task)
+    {
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        while(true)
+        {
+            Cell &cell = cells[pos & mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            long diff = (long)seq - (long)(pos + 1);
+            if(diff == 0)
+            {
+                // 槽位可读，抢占这个位置
+                if(dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    task = cell.task;
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if(diff < 0)
+                return false;
+            else
+                pos = dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+};
+
+#endif
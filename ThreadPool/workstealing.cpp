@@ -0,0 +1,209 @@
+#include "workstealing.h"
+#include <cstdlib>
+#include <sched.h>
+using namespace std;
+
+// 注意！如果出现嵌套加锁，必须严格按照先sleepLocker后threadListLocker的顺序，以免死锁
+
+// 找不到任务时，休眠之前再尝试的轮数
+const int SpinRounds = 2;
+
+// 当前线程所属的线程池和位置，线程池外部的线程为空
+static thread_local WorkStealingPool *currentPool = nullptr;
+static thread_local int currentIndex = -1;
+// 选择窃取对象用的随机数
+static thread_local unsigned int randomState = 0;
+
+// 新线程的参数
+struct WorkerStartData
+{
+    WorkStealingPool *pool;
+    int index;
+};
+
+// 线程池中执行的线程函数
+void* funcInWorkStealingPool(void* data)
+{
+    WorkerStartData *start = (WorkerStartData *)data;
+    WorkStealingPool *pool = start->pool;
+    int index = start->index;
+    delete start;
+    pool->run(index);
+    return NULL;
+}
+
+WorkStealingPool::WorkStealingPool(int minThreads, int maxThreads, int maxWait)
+{
+    this->minThreads = minThreads;
+    this->maxThreads = maxThreads > 0 ? maxThreads : 1;
+    this->maxWait = maxWait;
+    this->workers = new Worker[this->maxThreads];
+
+    // 初始化minThreads个线程到线程池
+    threadListLocker.lock();
+    for(int i=0; i<minThreads && i<this->maxThreads; ++i)
+    {
+        if(!startWorker())
+            exit(-1);
+    }
+    threadListLocker.unlock();
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    // 唤醒所有休眠的线程，让它们执行完剩余的任务后退出
+    sleepLocker.lock();
+    stopping = true;
+    cond.notifyAll();
+    sleepLocker.unlock();
+
+    threadListLocker.lock();
+    while(threadCount.load() > 0)
+        exitCond.wait(threadListLocker, 1);
+    threadListLocker.unlock();
+    delete[] workers;
+}
+
+bool WorkStealingPool::addTask(TaskFunction taskFunction, void* data)
+{
+    TaskData task = {taskFunction, data};
+    // 线程池中的任务添加的任务放入所在线程自己的队列，满了或者来自外部时放入全局队列
+    bool queued = (currentPool == this && workers[currentIndex].deque.push(task));
+    if(!queued && !injectionQueue.push(task))
+        return false;
+    int waiting = queuedTasks.fetch_add(1) + 1;
+
+    // 检查是否需要新增线程
+    if(freeThreads.load() < waiting && threadCount.load() < maxThreads)
+    {
+        threadListLocker.lock();
+        if(threadCount.load() < maxThreads)
+            startWorker();
+        threadListLocker.unlock();
+    }
+
+    // 有休眠的线程时才加锁唤醒
+    if(sleepingThreads.load() > 0)
+    {
+        sleepLocker.lock();
+        cond.notifyOne();
+        sleepLocker.unlock();
+    }
+    return true;
+}
+
+bool WorkStealingPool::startWorker()
+{
+    int index = 0;
+    while(index < maxThreads && workers[index].used)
+        ++index;
+    if(index == maxThreads)
+        return false;
+
+    // 新线程在开始运行前就算作空闲，避免接连到达的任务重复新增线程
+    ++threadCount;
+    ++freeThreads;
+    WorkerStartData *start = new WorkerStartData{this, index};
+    pthread_t threadId;
+    if(pthread_create(&threadId, NULL, funcInWorkStealingPool, start) != 0)
+    {
+        delete start;
+        --threadCount;
+        --freeThreads;
+        return false;
+    }
+    pthread_detach(threadId);
+    workers[index].used = true;
+    return true;
+}
+
+void WorkStealingPool::run(int index)
+{
+    currentPool = this;
+    currentIndex = index;
+    randomState = (unsigned int)index * 2654435761u + 1;
+
+    int misses = 0;
+    while(true)
+    {
+        TaskData task;
+        if(takeTask(index, task))
+        {
+            misses = 0;
+            --queuedTasks;
+            --freeThreads;
+            task.func(task.data);       // 执行任务
+            ++freeThreads;
+            continue;
+        }
+        // 任务可能正在被添加，稍等再试几轮再休眠
+        if(++misses <= SpinRounds)
+        {
+            sched_yield();
+            continue;
+        }
+        misses = 0;
+        if(!sleep(index))
+            break;
+    }
+    currentPool = nullptr;
+    currentIndex = -1;
+}
+
+bool WorkStealingPool::takeTask(int index, TaskData &task)
+{
+    if(workers[index].deque.pop(task))
+        return true;
+    if(injectionQueue.pop(task))
+        return true;
+
+    // 从随机的位置开始，依次尝试窃取其他线程的任务（没有线程的位置队列为空）
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    int start = randomState % maxThreads;
+    for(int i=0; i<maxThreads; ++i)
+    {
+        int victim = (start + i) % maxThreads;
+        if(victim != index && workers[victim].deque.steal(task))
+            return true;
+    }
+    return false;
+}
+
+bool WorkStealingPool::sleep(int index)
+{
+    sleepLocker.lock();
+    // 先登记为休眠再检查任务数：添加任务的线程要么能看到有线程休眠而来唤醒，要么任务数已经在这里可见
+    ++sleepingThreads;
+    if(queuedTasks.load() > 0)
+    {
+        --sleepingThreads;
+        sleepLocker.unlock();
+        return true;
+    }
+    bool timeout = false;
+    if(!stopping)
+        timeout = (cond.wait(sleepLocker, maxWait) == ConditionVar::Timeout);
+    --sleepingThreads;
+
+    if((timeout || stopping) && queuedTasks.load() == 0)
+    {
+        // 等待超时或线程池析构，检查此线程是否需要退出
+        threadListLocker.lock();
+        if((stopping || threadCount.load() > minThreads) && workers[index].deque.empty())
+        {
+            --threadCount;
+            --freeThreads;
+            workers[index].used = false;
+            exitCond.notifyAll();
+            // threadListLocker最后解锁，之后析构函数可能马上释放线程池
+            sleepLocker.unlock();
+            threadListLocker.unlock();
+            return false;
+        }
+        threadListLocker.unlock();
+    }
+    sleepLocker.unlock();
+    return true;
+}
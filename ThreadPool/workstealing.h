@@ -0,0 +1,78 @@
+/*
+ * 工作窃取线程池，用法与ThreadPool相同：pool.addTask(TaskFunction, data);
+ *
+ * ThreadPool中每个任务都要经过taskQueueLocker和threadListLocker两把锁，空闲线程在同一个条件变量上等待。
+ * 这里添加和取出任务都不加锁：
+ *
+ * 1. 每个工作线程有自己的双端队列（WorkStealingDeque），线程池中的任务再添加的任务放入自己的队列；
+ *    线程池外部（例如主线程accept之后）添加的任务放入全局的InjectionQueue
+ *
+ * 2. 工作线程依次从自己的队列、全局队列取任务，都没有时随机选一个其他线程，从它的队列顶部窃取
+ *
+ * 3. 找不到任务时才加锁进入休眠。添加任务时只有存在休眠的线程才加锁唤醒一个，
+ *    休眠前会再检查一次待执行的任务数，不会错过唤醒
+ *
+ * 4. 线程数的伸缩规则与ThreadPool相同：待执行的任务多于空闲线程时新增线程（不超过maxThreads），
+ *    休眠超过maxWait秒且线程数多于minThreads时退出。新增和退出线程时才使用threadListLocker
+ *
+ * 5. 析构时唤醒所有线程，等已添加的任务全部执行完、所有线程退出后再返回
+ *
+*/
+
+#ifndef WORK_STEALING_BY_YQ
+#define WORK_STEALING_BY_YQ
+
+#include <vector>
+#include <atomic>
+#include "mutex.h"
+#include "condition_var.h"
+#include "task_queues.h"
+
+class WorkStealingPool
+{
+private:
+    // 线程函数设友元以便访问私有成员
+    friend void* funcInWorkStealingPool(void* data);
+
+    // 每个工作线程占用一个位置，线程退出后位置留给新的线程
+    struct Worker
+    {
+        WorkStealingDeque deque;
+        bool used = false;          // 由threadListLocker保护
+    };
+
+    // 基本参数
+    int minThreads, maxThreads, maxWait;
+    Worker *workers;
+    InjectionQueue injectionQueue;
+
+    // 已添加、还没有被取走的任务数
+    alignas(CacheLineSize) std::atomic<int> queuedTasks{0};
+    // 空闲线程数、休眠线程数、线程总数
+    alignas(CacheLineSize) std::atomic<int> freeThreads{0};
+    std::atomic<int> sleepingThreads{0};
+    std::atomic<int> threadCount{0};
+    std::atomic<bool> stopping{false};
+
+    Mutex threadListLocker;     // 负责锁线程的新增和退出
+    Mutex sleepLocker;          // 负责锁休眠
+    ConditionVar cond;
+    ConditionVar exitCond;      // 析构时等待线程退出
+
+public:
+    WorkStealingPool(int minThreads = 3, int maxThreads = 10, int maxWait = 5);
+    ~WorkStealingPool();
+
+    // 向线程池添加一项任务，全局队列已满时返回false
+    bool addTask(TaskFunction taskFunction, void* data);
+
+private:
+    // 新增一个工作线程，调用前需要持有threadListLocker
+    bool startWorker();
+    void run(int index);
+    // 依次从自己的队列、全局队列、其他线程的队列取一个任务
+    bool takeTask(int index, TaskData &task);
+    // 没有任务时休眠，返回false表示线程应当退出
+    bool sleep(int index);
+};
+#endif
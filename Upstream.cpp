@@ -0,0 +1,417 @@
+#include "Upstream.h"
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include "UpstreamPool.h"
+#include "Stats.h"
+#include "Utils.h"
+using namespace std;
+
+// 每个权重单位在哈希环上的虚拟节点数
+static const int VirtualNodesPerWeight = 100;
+static const int MaxWeight = 100;
+// effectiveWeight相对配置权重的放大倍数，慢启动时按比例缩小
+static const int WeightScale = 100;
+// 慢启动开始时的权重比例（%）
+static const int SlowStartMinPercent = 10;
+// 连续摘除时摘除时间最多翻几次倍
+static const int MaxEjectShift = 3;
+
+static minstd_rand &Random()
+{
+    static thread_local minstd_rand rng(random_device{}());
+    return rng;
+}
+
+uint32_t HashBytes(const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < len; ++i)
+    {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    // FNV-1a的低位分布不够均匀，再做一次murmur3的混合
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+Backend::Backend(const string &host, int port, int weight)
+    : host(host), port(port), weight(weight)
+{
+    hostStr = port == 80 ? host : host + ":" + to_string(port);
+    poolKey = UpstreamPool::makeKey(host, port);
+}
+
+UpstreamGroup::~UpstreamGroup()
+{
+    for(Backend *backend : backends)
+        delete backend;
+}
+
+bool UpstreamGroup::init(const string &backendsStr, const string &defaultHost, int defaultPort,
+    const string &policyStr, const string &hashKeyStr, string &error)
+{
+    // 格式：host[:port] [weight=N], host2[:port] ...
+    for(const string &item : SplitStrWithPattern(backendsStr, ","))
+    {
+        string spec = Trim(item);
+        if(spec.empty())
+            continue;
+        istringstream in(spec);
+        string address, option;
+        in >> address;
+        int weight = 1;
+        while(in >> option)
+        {
+            if(StartsWith(option, "weight=") && isNumeric(option.substr(7)))
+                weight = atoi(option.c_str() + 7);
+            else
+            {
+                error = "unknown backend option: " + option;
+                return false;
+            }
+        }
+        if(weight < 1 || weight > MaxWeight)
+        {
+            error = "backend weight should be between 1 and " + to_string(MaxWeight) + ": " + spec;
+            return false;
+        }
+
+        string host = address;
+        int port = 80;
+        size_t colon = address.rfind(':');
+        if(colon != string::npos)
+        {
+            string portStr = address.substr(colon + 1);
+            if(!isNumeric(portStr) || atoi(portStr.c_str()) <= 0 || atoi(portStr.c_str()) > 65535)
+            {
+                error = "invalid backend port: " + spec;
+                return false;
+            }
+            host = address.substr(0, colon);
+            port = atoi(portStr.c_str());
+        }
+        if(host.empty())
+        {
+            error = "invalid backend: " + spec;
+            return false;
+        }
+        backends.push_back(new Backend(host, port, weight));
+    }
+    if(backends.empty())
+        backends.push_back(new Backend(defaultHost, defaultPort, 1));
+
+    if(policyStr.empty() || policyStr == "round_robin")
+        policy = Policy::RoundRobin;
+    else if(policyStr == "least_conn")
+        policy = Policy::LeastConn;
+    else if(policyStr == "p2c")
+        policy = Policy::PowerOfTwo;
+    else if(policyStr == "consistent_hash")
+        policy = Policy::ConsistentHash;
+    else
+    {
+        error = "unknown policy: " + policyStr;
+        return false;
+    }
+
+    if(hashKeyStr.empty() || hashKeyStr == "client_ip")
+        hashKey = HashKey::ClientIp;
+    else if(hashKeyStr == "uri")
+        hashKey = HashKey::Uri;
+    else
+    {
+        error = "unknown hash key: " + hashKeyStr;
+        return false;
+    }
+
+    buildSchedule();
+    buildRing();
+    return true;
+}
+
+const char *UpstreamGroup::getPolicyName() const
+{
+    switch(policy)
+    {
+    case Policy::RoundRobin:
+        return "round_robin";
+    case Policy::LeastConn:
+        return "least_conn";
+    case Policy::PowerOfTwo:
+        return "p2c";
+    case Policy::ConsistentHash:
+        return hashKey == HashKey::ClientIp ? "consistent_hash(client_ip)" : "consistent_hash(uri)";
+    }
+    return "";
+}
+
+void UpstreamGroup::buildSchedule()
+{
+    // 平滑加权轮询（nginx的算法）：每轮每个后端的current加上自己的权重，选current最大的，再减去总权重
+    // 一个周期长度为总权重，权重大的后端被均匀地分散在周期中，而不是连续选中
+    schedule.clear();
+    int totalWeight = 0;
+    for(Backend *backend : backends)
+        totalWeight += backend->weight;
+    vector<int> current(backends.size(), 0);
+    for(int n = 0; n < totalWeight; ++n)
+    {
+        int best = 0;
+        for(size_t i = 0; i < backends.size(); ++i)
+        {
+            current[i] += backends[i]->weight;
+            if(current[i] > current[best])
+                best = i;
+        }
+        current[best] -= totalWeight;
+        schedule.push_back(best);
+    }
+}
+
+void UpstreamGroup::buildRing()
+{
+    ring.clear();
+    if(policy != Policy::ConsistentHash)
+        return;
+    for(size_t i = 0; i < backends.size(); ++i)
+    {
+        // 虚拟节点由 host:port#序号 哈希得到，与后端在配置中的顺序无关
+        int nodes = backends[i]->weight * VirtualNodesPerWeight;
+        for(int n = 0; n < nodes; ++n)
+        {
+            string key = backends[i]->poolKey + "#" + to_string(n);
+            ring.push_back({HashBytes(key.data(), key.size()), (int)i});
+        }
+    }
+    sort(ring.begin(), ring.end());
+}
+
+void UpstreamGroup::setHealthOptions(int maxFails, int ejectTime, int slowStart, Logger::LogLevel logLevel)
+{
+    this->maxFails = maxFails;
+    this->ejectTime = ejectTime > 0 ? ejectTime : 1;
+    this->slowStart = slowStart > 0 ? slowStart : 0;
+    logger.setLogLevel(logLevel);
+    logger.setPrefix("Upstream");
+}
+
+int UpstreamGroup::effectiveWeight(const Backend *backend, time_t now, bool panic) const
+{
+    int full = backend->weight * WeightScale;
+    if(panic)
+        return full;
+    if(!backend->healthy.load(memory_order_relaxed) || now < backend->ejectedUntil.load(memory_order_relaxed))
+        return 0;
+    time_t elapsed = now - backend->recoveredAt.load(memory_order_relaxed);
+    if(slowStart <= 0 || elapsed >= slowStart)
+        return full;
+    return max(full * SlowStartMinPercent / 100, (int)(full * elapsed / slowStart));
+}
+
+Backend *UpstreamGroup::select(const in_addr &clientAddr, const string &uri)
+{
+    if(backends.size() == 1)
+        return backends[0];
+
+    // 所有后端都不可用时进入panic模式，忽略健康状态
+    time_t now = time(NULL);
+    bool panic = true;
+    for(Backend *backend : backends)
+    {
+        if(effectiveWeight(backend, now, false) > 0)
+        {
+            panic = false;
+            break;
+        }
+    }
+
+    switch(policy)
+    {
+    case Policy::RoundRobin:
+        return selectRoundRobin(now, panic);
+    case Policy::LeastConn:
+        return selectLeastConn(now, panic);
+    case Policy::PowerOfTwo:
+        return selectPowerOfTwo(now, panic);
+    case Policy::ConsistentHash:
+        if(hashKey == HashKey::ClientIp)
+            return selectHash(HashBytes(&clientAddr, sizeof(clientAddr)), now, panic);
+        return selectHash(HashBytes(uri.data(), uri.size()), now, panic);
+    }
+    return backends[0];
+}
+
+Backend *UpstreamGroup::selectRoundRobin(time_t now, bool panic)
+{
+    // 轮到不可用的后端时跳过；慢启动中的后端按当前权重比例决定是否选中，没选中就轮到下一个
+    Backend *fallback = nullptr;
+    for(size_t n = 0; n < schedule.size(); ++n)
+    {
+        uint64_t index = scheduleIndex.fetch_add(1, memory_order_relaxed);
+        Backend *backend = backends[schedule[index % schedule.size()]];
+        int weight = effectiveWeight(backend, now, panic);
+        if(weight == 0)
+            continue;
+        if(weight == backend->weight * WeightScale || (int)(Random()() % (backend->weight * WeightScale)) < weight)
+            return backend;
+        if(!fallback)
+            fallback = backend;
+    }
+    return fallback ? fallback : backends[0];
+}
+
+Backend *UpstreamGroup::selectLeastConn(time_t now, bool panic)
+{
+    // 比较 (activeRequests+1)/weight，交叉相乘避免除法；从轮询位置开始找，相同负载时不总是选第一个
+    size_t count = backends.size();
+    size_t start = scheduleIndex.fetch_add(1, memory_order_relaxed) % count;
+    Backend *best = nullptr;
+    long bestActive = 0, bestWeight = 0;
+    for(size_t n = 0; n < count; ++n)
+    {
+        Backend *backend = backends[(start + n) % count];
+        long weight = effectiveWeight(backend, now, panic);
+        if(weight == 0)
+            continue;
+        long active = backend->activeRequests.load(memory_order_relaxed) + 1;
+        if(!best || active * bestWeight < bestActive * weight)
+        {
+            best = backend;
+            bestActive = active;
+            bestWeight = weight;
+        }
+    }
+    return best ? best : backends[start];
+}
+
+int UpstreamGroup::randomIndex(const vector<int> &weights, int exclude)
+{
+    int total = 0;
+    for(size_t i = 0; i < weights.size(); ++i)
+        if((int)i != exclude)
+            total += weights[i];
+    if(total == 0)
+        return -1;
+    int value = Random()() % total;
+    for(size_t i = 0; i < weights.size(); ++i)
+    {
+        if((int)i == exclude)
+            continue;
+        value -= weights[i];
+        if(value < 0)
+            return i;
+    }
+    return -1;
+}
+
+Backend *UpstreamGroup::selectPowerOfTwo(time_t now, bool panic)
+{
+    static thread_local vector<int> weights;
+    weights.resize(backends.size());
+    for(size_t i = 0; i < backends.size(); ++i)
+        weights[i] = effectiveWeight(backends[i], now, panic);
+
+    // 按权重随机选出两个不同的后端，只剩一个可用时直接用它
+    int first = randomIndex(weights, -1);
+    if(first < 0)
+        return backends[0];
+    int second = randomIndex(weights, first);
+    if(second < 0)
+        return backends[first];
+    Backend *a = backends[first];
+    Backend *b = backends[second];
+    long activeA = a->activeRequests.load(memory_order_relaxed) + 1;
+    long activeB = b->activeRequests.load(memory_order_relaxed) + 1;
+    return activeB * weights[first] < activeA * weights[second] ? b : a;
+}
+
+Backend *UpstreamGroup::selectHash(uint32_t hash, time_t now, bool panic)
+{
+    // 顺时针找到第一个不小于hash的虚拟节点，超过末尾时回到开头
+    // 节点对应的后端不可用时继续往后找；慢启动中的后端只接收一部分key，同一个key的结果是固定的
+    auto it = lower_bound(ring.begin(), ring.end(), make_pair(hash, 0));
+    for(size_t n = 0; n < ring.size(); ++n, ++it)
+    {
+        if(it == ring.end())
+            it = ring.begin();
+        Backend *backend = backends[it->second];
+        int weight = effectiveWeight(backend, now, panic);
+        if(weight > 0 && (int)(hash % (backend->weight * WeightScale)) < weight)
+            return backend;
+    }
+    return backends[ring.empty() ? 0 : ring[0].second];
+}
+
+void UpstreamGroup::reportSuccess(Backend *backend)
+{
+    if(backend->failures.load(memory_order_relaxed) != 0)
+        backend->failures = 0;
+    // 慢启动结束后仍然正常，下次摘除的时间重新从EjectTime算起
+    if(backend->ejections.load(memory_order_relaxed) != 0 && time(NULL) >= backend->recoveredAt + slowStart)
+        backend->ejections = 0;
+}
+
+void UpstreamGroup::reportFailure(Backend *backend, const char *reason)
+{
+    logger.debug("Backend %s failed: %s", backend->hostStr.c_str(), reason);
+    if(maxFails <= 0 || backends.size() == 1 || ++backend->failures < maxFails)
+        return;
+
+    // 同一时间多个连接都失败时只摘除一次
+    time_t now = time(NULL);
+    time_t until = backend->ejectedUntil.load();
+    if(now < until)
+        return;
+    int shift = min(backend->ejections.load(), MaxEjectShift);
+    int duration = ejectTime << shift;
+    if(!backend->ejectedUntil.compare_exchange_strong(until, now + duration))
+        return;
+    ++backend->ejections;
+    backend->recoveredAt = now + duration;
+    backend->failures = 0;
+    ++proxyStats.backendEjections;
+    logger.warn("Backend %s ejected for %d seconds after %d consecutive failures (%s).",
+        backend->hostStr.c_str(), duration, maxFails, reason);
+}
+
+void UpstreamGroup::setHealthy(Backend *backend, bool healthy)
+{
+    if(backend->healthy.exchange(healthy) == healthy)
+        return;
+    if(healthy)
+    {
+        // 恢复之后的流量由慢启动控制
+        time_t now = time(NULL);
+        if(backend->recoveredAt < now)
+            backend->recoveredAt = now;
+        logger.info("Backend %s is healthy again.", backend->hostStr.c_str());
+    }
+    else
+        logger.warn("Backend %s is unhealthy, stop sending requests to it.", backend->hostStr.c_str());
+}
+
+void UpstreamGroup::inheritState(const UpstreamGroup &old)
+{
+    for(Backend *backend : backends)
+    {
+        for(const Backend *oldBackend : old.backends)
+        {
+            if(oldBackend->poolKey != backend->poolKey)
+                continue;
+            backend->lastAddr = oldBackend->lastAddr.load();
+            backend->healthy = oldBackend->healthy.load();
+            backend->failures = oldBackend->failures.load();
+            backend->ejections = oldBackend->ejections.load();
+            backend->ejectedUntil = oldBackend->ejectedUntil.load();
+            backend->recoveredAt = oldBackend->recoveredAt.load();
+            break;
+        }
+    }
+}
@@ -0,0 +1,124 @@
+/*
+ * 上游服务器组与负载均衡
+ *
+ * [Upstream] Backends 中可以配置多个后端服务器，每个请求按 Policy 选出一个后端转发：
+ *
+ *   round_robin       按权重平滑轮询
+ *   least_conn        选正在处理的请求数/权重最小的后端
+ *   p2c               按权重随机选两个后端，取其中正在处理的请求数/权重较小的一个
+ *   consistent_hash   按 HashKey（client_ip 或 uri）在一致性哈希环上选后端，每个后端按权重放若干虚拟节点，
+ *                     增删后端时只有一小部分key会换到别的后端
+ *
+ * 没有配置Backends时，使用[Proxy]中的TargetHost/TargetPort作为唯一的后端。
+ * 同一个客户端连接上，上一个请求的响应还没收完时，下一个请求只能继续发给同一个后端。
+ *
+ * 后端的健康状态：
+ *   被动摘除   连续MaxFails次连接失败/响应读取失败后，在EjectTime秒内不再选择，
+ *              恢复后马上又被摘除时，摘除时间翻倍（最多8倍）
+ *   主动检查   HealthChecker定期探测，结论为不健康的后端不再选择（见HealthCheck.h）
+ *   慢启动     后端恢复可用后的SlowStart秒内，权重从10%逐渐增加到配置值，避免一下子涌入大量请求
+ * 所有后端都不可用时忽略健康状态照常选择，总比直接拒绝请求好。
+ *
+ * 每份配置（见Config.h）有自己的上游服务器组，重新加载配置时建立新的组，旧的组随旧配置一起释放。
+*/
+
+#ifndef UPSTREAM_BY_YQ
+#define UPSTREAM_BY_YQ
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <netinet/in.h>
+#include "Logger.h"
+
+// 一个后端服务器
+struct Backend
+{
+    std::string host;
+    int port = 80;
+    int weight = 1;
+    std::string hostStr;                        // 改写Host头部时使用，端口不是80时带上端口
+    std::string poolKey;                        // 上游连接池中的key
+    std::atomic<int> activeRequests{0};         // 已转发、还没有收完响应的请求数
+    std::atomic<uint32_t> lastAddr{0};          // 最近一次解析得到的地址（网络字节序）
+
+    // 健康状态
+    std::atomic<bool> healthy{true};            // 主动健康检查的结论
+    std::atomic<int> failures{0};               // 连续失败次数
+    std::atomic<int> ejections{0};              // 连续被摘除的次数，决定下一次摘除多久
+    std::atomic<time_t> ejectedUntil{0};        // 被动摘除到这个时间为止
+    std::atomic<time_t> recoveredAt{0};         // 恢复可用的时间，慢启动由此开始计算
+
+    Backend(const std::string &host, int port, int weight);
+};
+
+class UpstreamGroup
+{
+public:
+    enum class Policy { RoundRobin, LeastConn, PowerOfTwo, ConsistentHash };
+    enum class HashKey { ClientIp, Uri };
+
+private:
+    std::vector<Backend *> backends;
+    Policy policy = Policy::RoundRobin;
+    HashKey hashKey = HashKey::ClientIp;
+
+    // 平滑加权轮询预先算好的顺序
+    std::vector<int> schedule;
+    std::atomic<uint64_t> scheduleIndex{0};
+    // 一致性哈希环，按hash排序
+    std::vector<std::pair<uint32_t, int>> ring;
+
+    // 被动摘除和慢启动
+    int maxFails = 3;
+    int ejectTime = 10;
+    int slowStart = 30;
+    Logger logger;
+
+public:
+    ~UpstreamGroup();
+
+    // 解析配置，backendsStr为空时使用defaultHost:defaultPort，配置有误时返回false
+    bool init(const std::string &backendsStr, const std::string &defaultHost, int defaultPort,
+        const std::string &policyStr, const std::string &hashKeyStr, std::string &error);
+
+    // 设置被动摘除和慢启动的参数，maxFails <= 0时不摘除
+    void setHealthOptions(int maxFails, int ejectTime, int slowStart, Logger::LogLevel logLevel);
+
+    // 为一个请求选择后端
+    Backend *select(const in_addr &clientAddr, const std::string &uri);
+
+    // 转发结果的反馈：收到完整响应时调用reportSuccess，连接或读取响应失败时调用reportFailure
+    void reportSuccess(Backend *backend);
+    void reportFailure(Backend *backend, const char *reason);
+    // 主动健康检查的结论
+    void setHealthy(Backend *backend, bool healthy);
+    // 重新加载配置时调用：host:port相同的后端沿用old中的健康状态和最近解析的地址
+    void inheritState(const UpstreamGroup &old);
+
+    const std::vector<Backend *> &getBackends() const { return backends; }
+    const char *getPolicyName() const;
+
+    // 请求开始/结束时调用，维护各后端正在处理的请求数
+    static void beginRequest(Backend *backend) { ++backend->activeRequests; }
+    static void endRequest(Backend *backend, int count = 1) { backend->activeRequests -= count; }
+
+private:
+    void buildSchedule();
+    void buildRing();
+    // 考虑健康状态和慢启动之后的权重（放大WeightScale倍），不可用时为0；panic为true时忽略健康状态
+    int effectiveWeight(const Backend *backend, time_t now, bool panic) const;
+    Backend *selectRoundRobin(time_t now, bool panic);
+    Backend *selectLeastConn(time_t now, bool panic);
+    Backend *selectPowerOfTwo(time_t now, bool panic);
+    Backend *selectHash(uint32_t hash, time_t now, bool panic);
+    // 按当前权重随机选一个后端的下标，weights为各后端的effectiveWeight
+    int randomIndex(const std::vector<int> &weights, int exclude);
+};
+
+// 32位哈希（FNV-1a再做一次混合）
+uint32_t HashBytes(const void *data, size_t len);
+
+#endif
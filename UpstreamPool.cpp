@@ -0,0 +1,111 @@
+#include "UpstreamPool.h"
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+using namespace std;
+
+UpstreamPool upstreamPool;
+
+// 检查空闲连接是否仍然可用：对端没有关闭，也没有发来多余的数据
+static bool IsConnAlive(int fd)
+{
+    char c;
+    ssize_t res = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if(res == 0)
+        return false;       // 对端已关闭
+    if(res > 0)
+        return false;       // 空闲连接上不应有数据，状态不可信
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+UpstreamPool::~UpstreamPool()
+{
+    for(auto &item : idleConns)
+        for(auto &conn : item.second)
+            close(conn.fd);
+}
+
+void UpstreamPool::init(bool enabled, int maxIdle, int maxPerHost, int idleTimeout)
+{
+    this->enabled = enabled;
+    this->maxIdle = maxIdle;
+    this->maxPerHost = maxPerHost;
+    this->idleTimeout = idleTimeout;
+}
+
+void UpstreamPool::dropExpired(deque<IdleConn> &conns, time_t now)
+{
+    // 队列头部是最早放入的连接
+    while(!conns.empty() && now - conns.front().idleSince >= idleTimeout)
+    {
+        close(conns.front().fd);
+        conns.pop_front();
+        --idleCount;
+    }
+}
+
+int UpstreamPool::acquire(const string &key, bool nonBlocking)
+{
+    if(!enabled)
+        return -1;
+
+    time_t now = time(NULL);
+    locker.lock();
+    auto it = idleConns.find(key);
+    if(it == idleConns.end())
+    {
+        locker.unlock();
+        return -1;
+    }
+    deque<IdleConn> &conns = it->second;
+    dropExpired(conns, now);
+
+    // 优先取最近归还的连接
+    int fd = -1;
+    while(!conns.empty())
+    {
+        int candidate = conns.back().fd;
+        conns.pop_back();
+        --idleCount;
+        if(IsConnAlive(candidate))
+        {
+            fd = candidate;
+            break;
+        }
+        close(candidate);
+    }
+    locker.unlock();
+
+    // 线程池模式使用阻塞socket，事件循环模式使用非阻塞socket，连接可能在两者之间流转
+    if(fd >= 0)
+    {
+        int flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, nonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+    }
+    return fd;
+}
+
+void UpstreamPool::release(const string &key, int fd)
+{
+    if(!enabled || fd < 0)
+    {
+        if(fd >= 0)
+            close(fd);
+        return;
+    }
+
+    time_t now = time(NULL);
+    locker.lock();
+    deque<IdleConn> &conns = idleConns[key];
+    dropExpired(conns, now);
+    if(idleCount >= maxIdle || (int)conns.size() >= maxPerHost)
+    {
+        locker.unlock();
+        close(fd);
+        return;
+    }
+    conns.push_back({fd, now});
+    ++idleCount;
+    locker.unlock();
+}
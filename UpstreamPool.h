@@ -0,0 +1,67 @@
+/*
+ * 上游空闲连接池
+ *
+ * 按 目标host:port 分组保存与上游服务器之间的空闲keep-alive连接。
+ * 一个响应完整接收、且双方都没有要求关闭连接时，连接可以归还到池中，
+ * 之后任意客户端连接到同一个目标时直接取出复用，省去TCP握手和域名解析。
+ *
+ * MaxIdle       池中空闲连接总数上限
+ * MaxPerHost    每个目标保留的空闲连接数上限
+ * IdleTimeout   空闲连接最长保留时间（秒），超时的连接在下次访问时关闭
+*/
+
+#ifndef UPSTREAM_POOL_BY_YQ
+#define UPSTREAM_POOL_BY_YQ
+
+#include <string>
+#include <deque>
+#include <map>
+#include <ctime>
+#include "ThreadPool/mutex.h"
+
+class UpstreamPool
+{
+private:
+    struct IdleConn
+    {
+        int fd;
+        time_t idleSince;
+    };
+
+    bool enabled = true;
+    int maxIdle = 64;
+    int maxPerHost = 16;
+    int idleTimeout = 30;
+
+    int idleCount = 0;
+    std::map<std::string, std::deque<IdleConn>> idleConns;
+    Mutex locker;
+
+public:
+    ~UpstreamPool();
+
+    // 设置参数，在开始工作之前调用
+    void init(bool enabled, int maxIdle, int maxPerHost, int idleTimeout);
+    bool isEnabled() const { return enabled; }
+
+    // 取出一个到key的空闲连接，没有可用连接时返回-1
+    // 取出的连接会按nonBlocking设置好阻塞模式
+    int acquire(const std::string &key, bool nonBlocking = false);
+    // 归还一个可以复用的连接，池满时直接关闭
+    void release(const std::string &key, int fd);
+
+    // 连接池的key
+    static std::string makeKey(const std::string &host, int port)
+    {
+        return host + ":" + std::to_string(port);
+    }
+
+private:
+    // 关闭队列头部已经超时的连接，调用前需要持有locker
+    void dropExpired(std::deque<IdleConn> &conns, time_t now);
+};
+
+// 全局共享的上游连接池
+extern UpstreamPool upstreamPool;
+
+#endif
@@ -2,6 +2,12 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
 
 // 将字符串根据指定pattern切分，放到vector里面
 std::vector<std::string> SplitStrWithPattern(const std::string& str, const std::string& pattern)
@@ -25,6 +31,16 @@ std::vector<std::string> SplitStrWithPattern(const std::string& str, const std::
     return resVec;
 }
 
+// 去掉首尾的空格和制表符
+std::string Trim(const std::string &str)
+{
+    size_t begin = str.find_first_not_of(" \t");
+    if(begin == std::string::npos)
+        return "";
+    size_t end = str.find_last_not_of(" \t");
+    return str.substr(begin, end - begin + 1);
+}
+
 // string替换
 std::string& ReplaceStr(std::string& str, const std::string& oldValue, const std::string& newValue) 
 {
@@ -67,4 +83,81 @@ bool EndsWith(const std::string& str, const std::string& end)
             return true;
     }
     return false;
-}
\ No newline at end of file
+}
+
+// 用sendfile把文件中的一段发完，被信号打断时继续
+bool SendFile(int targetSocket, int fd, off_t offset, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t bytesWritten = sendfile(targetSocket, fd, &offset, len);
+        if (bytesWritten < 0 && errno == EINTR)
+            continue;
+        if (bytesWritten <= 0)
+            return false;
+        len -= (size_t)bytesWritten;
+    }
+    return true;
+}
+
+// 用sendmsg把iovec数组中的所有数据发完
+bool SendIovec(int targetSocket, iovec *iov, size_t iovCount)
+{
+    while (iovCount > 0)
+    {
+        msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = std::min(iovCount, (size_t)IOV_MAX);
+        // 对端关闭时不要触发SIGPIPE
+        ssize_t bytesWritten = sendmsg(targetSocket, &msg, MSG_NOSIGNAL);
+        if (bytesWritten < 0 && errno == EINTR)
+            continue;
+        if (bytesWritten <= 0)      // 出现问题
+            return false;
+
+        // 跳过已经发完的段，最后一段可能只发了一部分
+        size_t written = (size_t)bytesWritten;
+        while (iovCount > 0 && written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            ++iov;
+            --iovCount;
+        }
+        if (iovCount > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+// 连接到addr，最多等待timeoutMs毫秒
+bool ConnectWithTimeout(int sock, const sockaddr_in &addr, int timeoutMs)
+{
+    if (timeoutMs <= 0)
+        return connect(sock, (const sockaddr *)&addr, sizeof(addr)) >= 0;
+
+    // 非阻塞地发起连接，用poll等待完成
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0)
+        return false;
+    bool connected = connect(sock, (const sockaddr *)&addr, sizeof(addr)) >= 0;
+    if (!connected && errno == EINPROGRESS)
+    {
+        pollfd pfd = {sock, POLLOUT, 0};
+        int res;
+        while ((res = poll(&pfd, 1, timeoutMs)) < 0 && errno == EINTR)
+            ;
+        int err = 0;
+        socklen_t errLen = sizeof(err);
+        if (res > 0 && getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &errLen) == 0 && err == 0)
+            connected = true;
+        else if (res == 0)
+            errno = ETIMEDOUT;
+        else if (err != 0)
+            errno = err;
+    }
+    fcntl(sock, F_SETFL, flags);
+    return connected;
+}
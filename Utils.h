@@ -4,10 +4,15 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <sys/uio.h>
+#include <netinet/in.h>
 
 // 将字符串根据指定pattern切分，放到vector里面
 std::vector<std::string> SplitStrWithPattern(const std::string& str, const std::string& pattern);
 
+// 去掉首尾的空格和制表符
+std::string Trim(const std::string &str);
+
 // string替换
 std::string& ReplaceStr(std::string& str, const std::string& oldValue, const std::string& newValue) ;
 
@@ -20,4 +25,26 @@ bool StartsWith(const std::string& str, const std::string& start);
 // 判断字符串是否由end结尾
 bool EndsWith(const std::string& str, const std::string& end);
 
+// 在iovec数组末尾添加一段数据，长度为0时忽略，与上一段在内存中相连时合并成一段
+inline void AppendIovec(std::vector<iovec> &iov, const void *data, size_t len)
+{
+    if(len == 0)
+        return;
+    if(!iov.empty() && (const char *)iov.back().iov_base + iov.back().iov_len == data)
+        iov.back().iov_len += len;
+    else
+        iov.push_back({const_cast<void *>(data), len});
+}
+
+// 用sendmsg把iovec数组中的所有数据发完，处理部分发送和IOV_MAX的限制
+// 会修改iov中的内容
+bool SendIovec(int targetSocket, iovec *iov, size_t iovCount);
+
+// 用sendfile把文件fd中从offset开始的len字节发给targetSocket（阻塞socket，也可以是普通文件），处理部分发送
+bool SendFile(int targetSocket, int fd, off_t offset, size_t len);
+
+// 连接到addr，最多等待timeoutMs毫秒，timeoutMs <= 0时不限时
+// 连接完成后socket恢复原来的阻塞模式
+bool ConnectWithTimeout(int sock, const sockaddr_in &addr, int timeoutMs);
+
 #endif
\ No newline at end of file